@@ -94,9 +94,28 @@ struct GpuVertexData
     glm::vec2 pad1;
 };
 
+struct GeometryTask::GpuData
+{
+    std::vector<GpuPrimitive> primitives;
+    std::vector<GpuMesh> meshes;
+    std::vector<GpuSphere> spheres;
+    std::vector<GpuPlane> planes;
+    std::vector<GpuInstance> instances;
+    std::vector<GpuBvhNode> bvhNodes;
+    std::vector<GpuTriangle> triangles;
+    std::vector<GpuVertexPos> verticesPos;
+    std::vector<GpuVertexData> verticesData;
+    uint64_t hash;
+};
+
 
 GeometryTask::GeometryTask() :
-    PathTracerProviderTask("Geometry")
+    PathTracerProviderTask("Geometry"),
+    _gpuData(new GpuData())
+{
+}
+
+GeometryTask::~GeometryTask()
 {
 }
 
@@ -123,6 +142,8 @@ bool GeometryTask::defineResources(GraphicContext& context)
                   gpuVerticesPos,
                   gpuVerticesData);
 
+    updateInstanceStates(context, gpuInstances, true);
+
     GpuResourceManager& resources = context.resources;
 
     bool ok = true;
@@ -196,67 +217,82 @@ bool GeometryTask::definePathTracerInterface(GraphicContext& context, PathTracer
 {
     bool ok = true;
 
-    ok = ok && interface.declareStorage({"Primitives"});
-    ok = ok && interface.declareStorage({"Meshes"});
-    ok = ok && interface.declareStorage({"Spheres"});
-    ok = ok && interface.declareStorage({"Planes"});
-    ok = ok && interface.declareStorage({"Instances"});
-    ok = ok && interface.declareStorage({"BvhNodes"});
-    ok = ok && interface.declareStorage({"Triangles"});
-    ok = ok && interface.declareStorage({"VerticesPos"});
-    ok = ok && interface.declareStorage({"VerticesData"});
+    ok = ok && interface.declareStorage({"Primitives", ResourceName(Primitives), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Meshes", ResourceName(Meshes), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Spheres", ResourceName(Spheres), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Planes", ResourceName(Planes), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Instances", ResourceName(Instances), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"BvhNodes", ResourceName(BvhNodes), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Triangles", ResourceName(Triangles), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"VerticesPos", ResourceName(VerticesPos), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"VerticesData", ResourceName(VerticesData), GpuResourceAccess::ReadOnly});
 
     return ok;
 }
 
-void GeometryTask::bindPathTracerResources(
-    GraphicContext& context,
-    CompiledGpuProgramInterface& compiledGpi) const
+void GeometryTask::prepare(GraphicContext& context)
 {
-    GpuResourceManager& resources = context.resources;
-
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Primitives)),      compiledGpi.getStorageBindPoint("Primitives"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Meshes)),          compiledGpi.getStorageBindPoint("Meshes"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Spheres)),         compiledGpi.getStorageBindPoint("Spheres"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Planes)),          compiledGpi.getStorageBindPoint("Planes"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Instances)),       compiledGpi.getStorageBindPoint("Instances"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(BvhNodes)),        compiledGpi.getStorageBindPoint("BvhNodes"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Triangles)),       compiledGpi.getStorageBindPoint("Triangles"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(VerticesPos)),     compiledGpi.getStorageBindPoint("VerticesPos"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(VerticesData)),    compiledGpi.getStorageBindPoint("VerticesData"));
+    // Vectors keep their capacity from frame to frame
+    GpuData& gpuData = *_gpuData;
+    gpuData.primitives.clear();
+    gpuData.meshes.clear();
+    gpuData.spheres.clear();
+    gpuData.planes.clear();
+    gpuData.instances.clear();
+    gpuData.bvhNodes.clear();
+    gpuData.triangles.clear();
+    gpuData.verticesPos.clear();
+    gpuData.verticesData.clear();
+
+    gpuData.hash = toGpu(context,
+          gpuData.primitives,
+          gpuData.meshes,
+          gpuData.spheres,
+          gpuData.planes,
+          gpuData.instances,
+          gpuData.bvhNodes,
+          gpuData.triangles,
+          gpuData.verticesPos,
+          gpuData.verticesData);
 }
 
 void GeometryTask::update(GraphicContext& context)
 {
     Profile(BVH);
 
-    std::vector<GpuPrimitive> gpuPrimitives;
-    std::vector<GpuMesh> gpuMeshes;
-    std::vector<GpuSphere> gpuSpheres;
-    std::vector<GpuPlane> gpuPlanes;
-    std::vector<GpuInstance> gpuInstances;
-    std::vector<GpuBvhNode> gpuBvhNodes;
-    std::vector<GpuTriangle> gpuTriangles;
-    std::vector<GpuVertexPos> gpuVerticesPos;
-    std::vector<GpuVertexData> gpuVerticesData;
+    _dirtyRegions.clear();
+
+    GpuData& gpuData = *_gpuData;
+    uint64_t hash = gpuData.hash;
+    std::vector<GpuPrimitive>& gpuPrimitives = gpuData.primitives;
+    std::vector<GpuMesh>& gpuMeshes = gpuData.meshes;
+    std::vector<GpuSphere>& gpuSpheres = gpuData.spheres;
+    std::vector<GpuPlane>& gpuPlanes = gpuData.planes;
+    std::vector<GpuInstance>& gpuInstances = gpuData.instances;
+    std::vector<GpuBvhNode>& gpuBvhNodes = gpuData.bvhNodes;
+    std::vector<GpuTriangle>& gpuTriangles = gpuData.triangles;
+    std::vector<GpuVertexPos>& gpuVerticesPos = gpuData.verticesPos;
+    std::vector<GpuVertexData>& gpuVerticesData = gpuData.verticesData;
 
-    uint64_t hash = toGpu(context,
-          gpuPrimitives,
-          gpuMeshes,
-          gpuSpheres,
-          gpuPlanes,
-          gpuInstances,
-          gpuBvhNodes,
-          gpuTriangles,
-          gpuVerticesPos,
-          gpuVerticesData);
+    GpuResourceManager& resources = context.resources;
 
+    // Moving instances only restarts the pixels they cover
     if(_hash == hash)
+    {
+        if(updateInstanceStates(context, gpuInstances, false))
+        {
+            resources.get<GpuStorageResource>(
+                ResourceName(Instances)).update({
+                    sizeof(GpuInstance),
+                    gpuInstances.size(),
+                    gpuInstances.data()});
+        }
+
         return;
+    }
 
     _hash = hash;
-    
-    GpuResourceManager& resources = context.resources;
+    updateInstanceStates(context, gpuInstances, true);
 
     resources.get<GpuStorageResource>(
         ResourceName(Primitives)).update({
@@ -317,6 +353,58 @@ void GeometryTask::render(GraphicContext& context)
 {
 }
 
+std::vector<std::shared_ptr<Instance>> GeometryTask::gatherInstances(const GraphicContext& context) const
+{
+    std::vector<std::shared_ptr<Instance>> instances;
+    auto addInstances = [&](const std::vector<std::shared_ptr<Instance>>& o)
+    {
+        instances.insert(instances.end(), o.begin(), o.end());
+    };
+
+    addInstances(context.scene.instances());
+    if (Terrain* terrain = context.scene.terrain().get())
+        addInstances(terrain->instances());
+
+    return instances;
+}
+
+bool GeometryTask::updateInstanceStates(
+    const GraphicContext& context,
+    const std::vector<GpuInstance>& gpuInstances,
+    bool reset)
+{
+    std::vector<std::shared_ptr<Instance>> instances = gatherInstances(context);
+
+    if(reset)
+        _instanceStates.clear();
+
+    bool moved = false;
+    for(std::size_t i = 0; i < gpuInstances.size(); ++i)
+    {
+        const GpuInstance& gpuInstance = gpuInstances[i];
+
+        if(i >= _instanceStates.size())
+        {
+            _instanceStates.push_back({gpuInstance.position, gpuInstance.quaternion, instances[i]->boundingRadius()});
+            continue;
+        }
+
+        InstanceState& state = _instanceStates[i];
+        if(state.position == gpuInstance.position && state.quaternion == gpuInstance.quaternion)
+            continue;
+
+        // Pixels covered before and after the move
+        _dirtyRegions.push_back({glm::dvec3(state.position), state.boundingRadius});
+        _dirtyRegions.push_back({glm::dvec3(gpuInstance.position), state.boundingRadius});
+
+        state.position = gpuInstance.position;
+        state.quaternion = gpuInstance.quaternion;
+        moved = true;
+    }
+
+    return moved;
+}
+
 uint64_t GeometryTask::toGpu(
     const GraphicContext& context,
         std::vector<GpuPrimitive>& gpuPrimitives,
@@ -329,15 +417,7 @@ uint64_t GeometryTask::toGpu(
         std::vector<GpuVertexPos>& gpuVerticesPos,
         std::vector<GpuVertexData>& gpuVerticesData)
 {
-    std::vector<std::shared_ptr<Instance>> instances;
-    auto addInstances = [&](const std::vector<std::shared_ptr<Instance>>& o)
-    {
-        instances.insert(instances.end(), o.begin(), o.end());
-    };
-
-    addInstances(context.scene.instances());
-    if (Terrain* terrain = context.scene.terrain().get())
-        addInstances(terrain->instances());
+    std::vector<std::shared_ptr<Instance>> instances = gatherInstances(context);
 
     for(const std::shared_ptr<Instance>& instance : instances)
     {
@@ -429,7 +509,14 @@ uint64_t GeometryTask::toGpu(
     hash = hashVec(gpuMeshes, hash);
     hash = hashVec(gpuSpheres, hash);
     hash = hashVec(gpuPlanes, hash);
-    hash = hashVec(gpuInstances, hash);
+
+    // Instance transforms are tracked by updateInstanceStates
+    for(const GpuInstance& gpuInstance : gpuInstances)
+    {
+        hash = hashVal(gpuInstance.primitiveBegin, hash);
+        hash = hashVal(gpuInstance.primitiveEnd, hash);
+    }
+
     hash = hashVec(gpuBvhNodes, hash);
     hash = hashVec(gpuTriangles, hash);
     hash = hashVec(gpuVerticesPos, hash);
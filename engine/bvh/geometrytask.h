@@ -9,6 +9,8 @@
 namespace unisim
 {
 
+class Instance;
+
 struct GpuPrimitive;
 struct GpuMesh;
 struct GpuSphere;
@@ -24,6 +26,7 @@ class GeometryTask : public PathTracerProviderTask
 {
 public:
     GeometryTask();
+    ~GeometryTask();
 
     bool defineResources(GraphicContext& context) override;
 
@@ -33,14 +36,20 @@ public:
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
     
+    void prepare(GraphicContext& context) override;
     void update(GraphicContext& context) override;
     void render(GraphicContext& context) override;
 
 private:
+    std::vector<std::shared_ptr<Instance>> gatherInstances(const GraphicContext& context) const;
+
+    // Flags moved instances as dirty regions, returns true if any moved
+    bool updateInstanceStates(
+        const GraphicContext& context,
+        const std::vector<GpuInstance>& gpuInstances,
+        bool reset);
+
     uint64_t toGpu(
         const GraphicContext& context,
             std::vector<GpuPrimitive>& gpuPrimitives,
@@ -52,6 +61,19 @@ private:
             std::vector<GpuTriangle>& gpuTriangles,
             std::vector<GpuVertexPos>& gpuVertPos,
             std::vector<GpuVertexData>& gpuVertData);
+
+    struct InstanceState
+    {
+        glm::vec4 position;
+        glm::vec4 quaternion;
+        double boundingRadius;
+    };
+
+    std::vector<InstanceState> _instanceStates;
+
+    // Packed by prepare(), uploaded by update()
+    struct GpuData;
+    std::unique_ptr<GpuData> _gpuData;
 };
 
 
@@ -1,11 +1,14 @@
 #include "lighttask.h"
 
+#include <algorithm>
+
 #include <imgui/imgui.h>
 
 #include "GLM/gtc/constants.hpp"
 
 #include "../system/profiler.h"
 
+#include "../resource/body.h"
 #include "../resource/light.h"
 #include "../resource/material.h"
 #include "../resource/instance.h"
@@ -24,12 +27,38 @@ DefineProfilePoint(Lighting);
 
 DefineResource(DirectionalLights);
 DefineResource(Emitters);
+DefineResource(LightBvhNodes);
+DefineResource(PrimitiveEmitters);
+
+
+const GLuint NO_EMITTER = ~GLuint(0);
+
+// Infinite planes are bounded by a large box so they can sit in the light BVH
+const float PLANE_LIGHT_EXTENT = 1e6f;
 
 
 struct GpuEmitter
 {
     GLuint instance;
     GLuint primitive;
+
+    // Branches taken from the light BVH root to this emitter's leaf (bit d: right child at depth d)
+    GLuint bvhTrail;
+    GLuint bvhDepth;
+};
+
+struct GpuLightBvhNode
+{
+    glm::vec3 aabbMin;
+    GLfloat power;
+    glm::vec3 aabbMax;
+    GLuint leftFirst; // Inner node: left child (right child follows), Leaf: emitter
+    glm::vec3 axis;
+    GLfloat cosThetaO;
+    GLfloat cosThetaE;
+    GLuint isLeaf;
+    GLuint pad1;
+    GLuint pad2;
 };
 
 struct GpuDirectionalLight
@@ -38,8 +67,23 @@ struct GpuDirectionalLight
     glm::vec4 emissionSolidAngle;
 };
 
+struct LightTask::GpuData
+{
+    std::vector<GpuEmitter> emitters;
+    std::vector<GpuLightBvhNode> lightBvhNodes;
+    std::vector<GLuint> primitiveEmitters;
+    std::vector<GpuDirectionalLight> directionalLights;
+    uint64_t hash;
+};
+
+
 LightTask::LightTask() :
-    PathTracerProviderTask("Light")
+    PathTracerProviderTask("Light"),
+    _gpuData(new GpuData())
+{
+}
+
+LightTask::~LightTask()
 {
 }
 
@@ -52,6 +96,186 @@ glm::vec3 toLinear(const glm::vec3& sRGB)
     return glm::mix(higher, lower, cutoff);
 }
 
+
+// LIGHT BVH //
+
+struct LightBounds
+{
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    float power;
+
+    // Orientation cone: emission normals within thetaO of axis, emitting up to thetaE around them
+    glm::vec3 axis;
+    float cosThetaO;
+    float cosThetaE;
+
+    GLuint emitter;
+};
+
+LightBounds unionBounds(const LightBounds& a, const LightBounds& b)
+{
+    LightBounds u;
+    u.aabbMin = glm::min(a.aabbMin, b.aabbMin);
+    u.aabbMax = glm::max(a.aabbMax, b.aabbMax);
+    u.power = a.power + b.power;
+    u.cosThetaE = glm::min(a.cosThetaE, b.cosThetaE);
+    u.emitter = NO_EMITTER;
+
+    // Widest cone first
+    const LightBounds& w = a.cosThetaO <= b.cosThetaO ? a : b;
+    const LightBounds& n = a.cosThetaO <= b.cosThetaO ? b : a;
+
+    float thetaW = glm::acos(glm::clamp(w.cosThetaO, -1.0f, 1.0f));
+    float thetaN = glm::acos(glm::clamp(n.cosThetaO, -1.0f, 1.0f));
+    float thetaD = glm::acos(glm::clamp(glm::dot(w.axis, n.axis), -1.0f, 1.0f));
+
+    u.axis = w.axis;
+    u.cosThetaO = w.cosThetaO;
+
+    if(glm::min(thetaD + thetaN, glm::pi<float>()) <= thetaW)
+        return u;
+
+    float thetaO = (thetaW + thetaD + thetaN) / 2;
+    glm::vec3 ortho = n.axis - w.axis * glm::dot(w.axis, n.axis);
+
+    if(thetaO >= glm::pi<float>() || glm::length(ortho) < 1e-6f)
+    {
+        u.axis = glm::vec3(0, 0, 1);
+        u.cosThetaO = -1;
+        return u;
+    }
+
+    float thetaR = thetaO - thetaW;
+    u.axis = glm::normalize(glm::cos(thetaR) * w.axis + glm::sin(thetaR) * glm::normalize(ortho));
+    u.cosThetaO = glm::cos(thetaO);
+
+    return u;
+}
+
+void buildLightBvh(
+        std::vector<GpuLightBvhNode>& gpuLightBvhNodes,
+        std::vector<GpuEmitter>& gpuEmitters,
+        std::vector<LightBounds>& bounds,
+        std::size_t nodeId,
+        std::size_t begin,
+        std::size_t end,
+        GLuint trail,
+        GLuint depth)
+{
+    LightBounds total = bounds[begin];
+    glm::vec3 centroidMin = (total.aabbMin + total.aabbMax) * 0.5f;
+    glm::vec3 centroidMax = centroidMin;
+    for(std::size_t i = begin + 1; i < end; ++i)
+    {
+        total = unionBounds(total, bounds[i]);
+
+        glm::vec3 centroid = (bounds[i].aabbMin + bounds[i].aabbMax) * 0.5f;
+        centroidMin = glm::min(centroidMin, centroid);
+        centroidMax = glm::max(centroidMax, centroid);
+    }
+
+    GpuLightBvhNode& node = gpuLightBvhNodes[nodeId];
+    node.aabbMin = total.aabbMin;
+    node.aabbMax = total.aabbMax;
+    node.power = total.power;
+    node.axis = total.axis;
+    node.cosThetaO = total.cosThetaO;
+    node.cosThetaE = total.cosThetaE;
+    node.pad1 = 0;
+    node.pad2 = 0;
+
+    if(end - begin == 1)
+    {
+        node.leftFirst = total.emitter;
+        node.isLeaf = 1;
+
+        gpuEmitters[total.emitter].bvhTrail = trail;
+        gpuEmitters[total.emitter].bvhDepth = depth;
+        return;
+    }
+
+    // Median split along the widest centroid axis keeps the tree balanced,
+    // so the branch trail of any emitter fits in 32 bits
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    std::size_t mid = (begin + end) / 2;
+    std::nth_element(bounds.begin() + begin, bounds.begin() + mid, bounds.begin() + end,
+        [axis](const LightBounds& a, const LightBounds& b) {
+            return a.aabbMin[axis] + a.aabbMax[axis] < b.aabbMin[axis] + b.aabbMax[axis];
+        });
+
+    std::size_t left = gpuLightBvhNodes.size();
+    gpuLightBvhNodes.resize(left + 2);
+    gpuLightBvhNodes[nodeId].leftFirst = left;
+    gpuLightBvhNodes[nodeId].isLeaf = 0;
+
+    buildLightBvh(gpuLightBvhNodes, gpuEmitters, bounds, left,     begin, mid, trail,                depth + 1);
+    buildLightBvh(gpuLightBvhNodes, gpuEmitters, bounds, left + 1, mid,   end, trail | (1u << depth), depth + 1);
+}
+
+LightBounds emitterBounds(const Instance& instance, const Primitive& primitive)
+{
+    const Material& material = *primitive.material();
+    glm::vec3 emission = material.defaultEmissionColor() * material.defaultEmissionLuminance();
+    float luminance = glm::dot(emission, glm::vec3(0.299f, 0.587f, 0.114f));
+
+    glm::vec3 center = instance.body()->position();
+
+    LightBounds bounds;
+    bounds.power = 0;
+
+    // Spheres, planes and meshes all emit on every side
+    bounds.axis = glm::vec3(0, 0, 1);
+    bounds.cosThetaO = -1;
+    bounds.cosThetaE = 0;
+
+    switch(primitive.type())
+    {
+    case Primitive::Mesh :
+    {
+        const Mesh& mesh = static_cast<const Mesh&>(primitive);
+
+        float radius = 0;
+        for(const Vertex& vertex : mesh.vertices())
+            radius = glm::max(radius, glm::length(vertex.position));
+
+        float area = 0;
+        for(const Triangle& tri : mesh.triangles())
+        {
+            const glm::vec3& A = mesh.vertices()[tri.v[0]].position;
+            const glm::vec3& B = mesh.vertices()[tri.v[1]].position;
+            const glm::vec3& C = mesh.vertices()[tri.v[2]].position;
+            area += glm::length(glm::cross(B-A, C-A)) / 2;
+        }
+
+        bounds.aabbMin = center - glm::vec3(radius);
+        bounds.aabbMax = center + glm::vec3(radius);
+        bounds.power = luminance * glm::pi<float>() * area;
+    }
+        break;
+    case Primitive::Sphere :
+    {
+        float radius = static_cast<const Sphere&>(primitive).radius();
+        bounds.aabbMin = center - glm::vec3(radius);
+        bounds.aabbMax = center + glm::vec3(radius);
+        bounds.power = luminance * glm::pi<float>() * 4 * glm::pi<float>() * radius * radius;
+    }
+        break;
+    case Primitive::Plane :
+        bounds.aabbMin = center - glm::vec3(PLANE_LIGHT_EXTENT);
+        bounds.aabbMax = center + glm::vec3(PLANE_LIGHT_EXTENT);
+        bounds.power = luminance * glm::pi<float>() * PLANE_LIGHT_EXTENT * PLANE_LIGHT_EXTENT;
+        break;
+    default:
+        bounds.aabbMin = center;
+        bounds.aabbMax = center;
+        break;
+    }
+
+    return bounds;
+}
+
 bool LightTask::defineResources(GraphicContext& context)
 {
     bool ok = true;
@@ -59,19 +283,35 @@ bool LightTask::defineResources(GraphicContext& context)
     GpuResourceManager& resources = context.resources;
 
     std::vector<GpuEmitter> gpuEmitters;
+    std::vector<GpuLightBvhNode> gpuLightBvhNodes;
+    std::vector<GLuint> gpuPrimitiveEmitters;
     std::vector<GpuDirectionalLight> gpuDirectionalLights;
 
     _hash = toGpu(
         context,
         gpuEmitters,
+        gpuLightBvhNodes,
+        gpuPrimitiveEmitters,
         gpuDirectionalLights);
 
     ok = ok && resources.define<GpuStorageResource>(
              ResourceName(Emitters), {
-              sizeof(gpuEmitters),
+              sizeof(GpuEmitter),
               gpuEmitters.size(),
               gpuEmitters.data()});
 
+    ok = ok && resources.define<GpuStorageResource>(
+             ResourceName(LightBvhNodes), {
+              sizeof(GpuLightBvhNode),
+              gpuLightBvhNodes.size(),
+              gpuLightBvhNodes.data()});
+
+    ok = ok && resources.define<GpuStorageResource>(
+             ResourceName(PrimitiveEmitters), {
+              sizeof(GLuint),
+              gpuPrimitiveEmitters.size(),
+              gpuPrimitiveEmitters.data()});
+
     ok = ok && resources.define<GpuStorageResource>(
              ResourceName(DirectionalLights), {
               sizeof(GpuDirectionalLight),
@@ -81,26 +321,44 @@ bool LightTask::defineResources(GraphicContext& context)
     return ok;
 }
 
+bool LightTask::definePathTracerModules(
+    GraphicContext& context,
+    std::vector<std::shared_ptr<PathTracerModule>>& modules)
+{
+    if(!addPathTracerModule(modules, "Light BVH", context.settings, "shaders/common/lightbvh.glsl"))
+        return false;
+
+    return true;
+}
+
 bool LightTask::definePathTracerInterface(
     GraphicContext& context,
     PathTracerInterface& interface)
 {
     bool ok = true;
 
-    ok = ok && interface.declareStorage({"Emitters"});
-    ok = ok && interface.declareStorage({"DirectionalLights"});
+    ok = ok && interface.declareStorage({"Emitters", ResourceName(Emitters), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"LightBvhNodes", ResourceName(LightBvhNodes), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"PrimitiveEmitters", ResourceName(PrimitiveEmitters), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"DirectionalLights", ResourceName(DirectionalLights), GpuResourceAccess::ReadOnly});
 
     return ok;
 }
 
-void LightTask::bindPathTracerResources(
-    GraphicContext &context,
-    CompiledGpuProgramInterface& compiledGpi) const
+void LightTask::prepare(GraphicContext& context)
 {
-    GpuResourceManager& resources = context.resources;
+    GpuData& gpuData = *_gpuData;
+    gpuData.emitters.clear();
+    gpuData.lightBvhNodes.clear();
+    gpuData.primitiveEmitters.clear();
+    gpuData.directionalLights.clear();
 
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(Emitters)),          compiledGpi.getStorageBindPoint("Emitters"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(DirectionalLights)), compiledGpi.getStorageBindPoint("DirectionalLights"));
+    gpuData.hash = toGpu(
+        context,
+        gpuData.emitters,
+        gpuData.lightBvhNodes,
+        gpuData.primitiveEmitters,
+        gpuData.directionalLights);
 }
 
 void LightTask::update(GraphicContext& context)
@@ -109,25 +367,35 @@ void LightTask::update(GraphicContext& context)
 
     GpuResourceManager& resources = context.resources;
 
-    std::vector<GpuEmitter> gpuEmitters;
-    std::vector<GpuDirectionalLight> gpuDirectionalLights;
-
-    uint64_t hash = toGpu(
-        context,
-        gpuEmitters,
-        gpuDirectionalLights);
+    GpuData& gpuData = *_gpuData;
+    std::vector<GpuEmitter>& gpuEmitters = gpuData.emitters;
+    std::vector<GpuLightBvhNode>& gpuLightBvhNodes = gpuData.lightBvhNodes;
+    std::vector<GLuint>& gpuPrimitiveEmitters = gpuData.primitiveEmitters;
+    std::vector<GpuDirectionalLight>& gpuDirectionalLights = gpuData.directionalLights;
 
-    if(_hash == hash)
+    if(_hash == gpuData.hash)
         return;
 
-    _hash = hash;
+    _hash = gpuData.hash;
 
     resources.get<GpuStorageResource>(
                 ResourceName(Emitters)).update({
-                    sizeof(gpuEmitters),
+                    sizeof(GpuEmitter),
                     gpuEmitters.size(),
                     gpuEmitters.data()});
 
+    resources.get<GpuStorageResource>(
+                ResourceName(LightBvhNodes)).update({
+                    sizeof(GpuLightBvhNode),
+                    gpuLightBvhNodes.size(),
+                    gpuLightBvhNodes.data()});
+
+    resources.get<GpuStorageResource>(
+                ResourceName(PrimitiveEmitters)).update({
+                    sizeof(GLuint),
+                    gpuPrimitiveEmitters.size(),
+                    gpuPrimitiveEmitters.data()});
+
     resources.get<GpuStorageResource>(
                 ResourceName(DirectionalLights)).update({
                     sizeof(GpuDirectionalLight),
@@ -138,9 +406,13 @@ void LightTask::update(GraphicContext& context)
 uint64_t LightTask::toGpu(
     GraphicContext& context,
         std::vector<GpuEmitter>& gpuEmitters,
+        std::vector<GpuLightBvhNode>& gpuLightBvhNodes,
+        std::vector<GLuint>& gpuPrimitiveEmitters,
         std::vector<GpuDirectionalLight>& gpuDirectionalLights)
 {
     // Emitters
+    std::vector<LightBounds> bounds;
+
     const auto& instances = context.scene.instances();
     for(std::size_t i = 0; i < instances.size(); ++i)
     {
@@ -150,13 +422,32 @@ uint64_t LightTask::toGpu(
             const Primitive& primitive = *instance.primitives()[p];
             if(glm::any(glm::greaterThan(primitive.material()->defaultEmissionColor(), glm::vec3())))
             {
+                gpuPrimitiveEmitters.push_back(gpuEmitters.size());
+
+                LightBounds& emitter = bounds.emplace_back(emitterBounds(instance, primitive));
+                emitter.emitter = gpuEmitters.size();
+
                 GpuEmitter& gpuEmitter = gpuEmitters.emplace_back();
                 gpuEmitter.instance = i;
                 gpuEmitter.primitive = p;
+                gpuEmitter.bvhTrail = 0;
+                gpuEmitter.bvhDepth = 0;
+            }
+            else
+            {
+                gpuPrimitiveEmitters.push_back(NO_EMITTER);
             }
         }
     }
 
+    // Light BVH
+    if(!bounds.empty())
+    {
+        gpuLightBvhNodes.reserve(2 * bounds.size() - 1);
+        gpuLightBvhNodes.resize(1);
+        buildLightBvh(gpuLightBvhNodes, gpuEmitters, bounds, 0, 0, bounds.size(), 0, 0);
+    }
+
     // Directional lights
     gpuDirectionalLights.reserve(2);
     auto processDirectionalLight = [&](DirectionalLight& light)
@@ -180,6 +471,8 @@ uint64_t LightTask::toGpu(
     // Finalize
     uint64_t hash = 0;
     hash = hashVec(gpuEmitters, hash);
+    hash = hashVec(gpuLightBvhNodes, hash);
+    hash = hashVec(gpuPrimitiveEmitters, hash);
     hash = hashVec(gpuDirectionalLights, hash);
 
     return hash;
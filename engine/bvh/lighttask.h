@@ -15,6 +15,7 @@ namespace unisim
 class Scene;
 
 struct GpuEmitter;
+struct GpuLightBvhNode;
 struct GpuDirectionalLight;
 
 
@@ -22,23 +23,31 @@ class LightTask : public PathTracerProviderTask
 {
 public:
     LightTask();
+    ~LightTask();
 
     bool defineResources(GraphicContext& context) override;
 
+    bool definePathTracerModules(
+        GraphicContext& context,
+        std::vector<std::shared_ptr<PathTracerModule>>& modules) override;
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
 
+    void prepare(GraphicContext& context) override;
     void update(GraphicContext& context) override;
 
 private:
     uint64_t toGpu(
         GraphicContext& context,
             std::vector<GpuEmitter>& gpuEmitters,
+            std::vector<GpuLightBvhNode>& gpuLightBvhNodes,
+            std::vector<GLuint>& gpuPrimitiveEmitters,
             std::vector<GpuDirectionalLight>& gpuDirectionalLights);
+
+    // Packed by prepare(), uploaded by update()
+    struct GpuData;
+    std::unique_ptr<GpuData> _gpuData;
 };
 
 }
@@ -4,6 +4,8 @@
 
 #include "../system/profiler.h"
 
+#include "../resource/asset.h"
+#include "../resource/body.h"
 #include "../resource/instance.h"
 #include "../resource/material.h"
 #include "../resource/primitive.h"
@@ -12,6 +14,7 @@
 #include "../graphic/gpudevice.h"
 #include "../graphic/gpuresource.h"
 
+#include "../camera.h"
 #include "../scene.h"
 
 
@@ -22,6 +25,19 @@ DefineProfilePoint(Material);
 
 DefineResource(MaterialDatabase);
 DefineResource(BindlessTextures);
+DefineResource(MaterialFeedback);
+
+// Texture exists on disk but is not on the GPU yet
+const int TEXTURE_NONE = -1;
+const int TEXTURE_PENDING = -2;
+
+int textureIndex(const TextureAsset* asset)
+{
+    if(asset == nullptr || asset->state() == TextureAsset::State::Failed)
+        return TEXTURE_NONE;
+    else
+        return TEXTURE_PENDING;
+}
 
 
 struct GpuMaterial
@@ -36,9 +52,24 @@ struct GpuMaterial
     int pad2;
 };
 
+struct MaterialTask::GpuData
+{
+    std::vector<GpuMaterial> materials;
+    std::vector<GpuBindlessTextureDescriptor> textures;
+    std::vector<uint64_t> materialHashes;
+    uint64_t uploadHash;
+    uint64_t hash;
+};
+
 
 MaterialTask::MaterialTask() :
-    PathTracerProviderTask("Material")
+    PathTracerProviderTask("Material"),
+    _uploadHash(0),
+    _gpuData(new GpuData())
+{
+}
+
+MaterialTask::~MaterialTask()
 {
 }
 
@@ -74,6 +105,8 @@ void MaterialTask::registerDynamicResources(GraphicContext& context)
             resources.registerDynamicResource(material->name() + "_texture_specular"),
             resources.registerDynamicResource(material->name() + "_bindless_albedo"),
             resources.registerDynamicResource(material->name() + "_bindless_specular"),
+            false,
+            false
         });
     }
 }
@@ -84,30 +117,16 @@ bool MaterialTask::defineResources(GraphicContext& context)
 
     GpuResourceManager& resources = context.resources;
 
-    const std::vector<std::shared_ptr<Material>>& materials = context.scene.materialDb()->materials();
+    ok = ok && defineTextures(context);
 
-    for(std::size_t i = 0; i < materials.size(); ++i)
-    {
-        const Material& material = *materials[i];
-
-        if(material.albedo() != nullptr)
-        {
-            ok = ok && resources.define<GpuTextureResource>(_materialsResourceIds[i].textureAlbedo, {*material.albedo()});
-            const auto& albedoTexure = resources.get<GpuTextureResource>(_materialsResourceIds[i].textureAlbedo);
-            ok = ok && resources.define<GpuBindlessResource>(_materialsResourceIds[i].bindlessAlbedo, {material.albedo(), albedoTexure});
-        }
-
-        if(material.specular() != nullptr)
-        {
-            ok = ok && resources.define<GpuTextureResource>(_materialsResourceIds[i].textureSpecular, {*material.specular()});
-            const auto& specularTexture = resources.get<GpuTextureResource>(_materialsResourceIds[i].textureSpecular);
-            ok = ok && resources.define<GpuBindlessResource>(_materialsResourceIds[i].bindlessSpecular, {material.specular(), specularTexture});
-        }
-    }
+    std::vector<GLuint> feedback(context.scene.materialDb()->materials().size(), 0);
+    ok = ok && resources.define<GpuStorageResource>(
+             ResourceName(MaterialFeedback),
+             {sizeof(GLuint), feedback.size(), feedback.data()});
 
     std::vector<GpuMaterial> gpuMaterials;
     std::vector<GpuBindlessTextureDescriptor> gpuTextures;
-    _hash = toGpu(context, gpuTextures, gpuMaterials);
+    _hash = toGpu(context, gpuTextures, gpuMaterials, _materialHashes, _uploadHash);
 
     ok = ok && context.resources.define<GpuStorageResource>(
              ResourceName(MaterialDatabase),
@@ -129,50 +148,201 @@ bool MaterialTask::definePathTracerInterface(GraphicContext& context, PathTracer
 {
     bool ok = true;
 
-    ok = ok && interface.declareStorage({"Textures"});
-    ok = ok && interface.declareStorage({"Materials"});
+    ok = ok && interface.declareStorage({"Textures", ResourceName(BindlessTextures), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"Materials", ResourceName(MaterialDatabase), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"MaterialFeedback", ResourceName(MaterialFeedback)});
 
     return ok;
 }
 
-void MaterialTask::bindPathTracerResources(
-    GraphicContext& context,
-    CompiledGpuProgramInterface& compiledGpi) const
+void MaterialTask::prepare(GraphicContext& context)
 {
-    GpuResourceManager& resources = context.resources;
-
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(BindlessTextures)), compiledGpi.getStorageBindPoint("Textures"));
-    context.device.bindBuffer(resources.get<GpuStorageResource>(ResourceName(MaterialDatabase)), compiledGpi.getStorageBindPoint("Materials"));
+    // Textures defined by the previous update() are still streaming, packing before defining them changes nothing
+    GpuData& gpuData = *_gpuData;
+    gpuData.materials.clear();
+    gpuData.textures.clear();
+    gpuData.hash = toGpu(context, gpuData.textures, gpuData.materials, gpuData.materialHashes, gpuData.uploadHash);
 }
 
 void MaterialTask::update(GraphicContext& context)
 {
     Profile(Material);
 
-    std::vector<GpuMaterial> gpuMaterials;
-    std::vector<GpuBindlessTextureDescriptor> gpuTextures;
-    uint64_t hash = toGpu(context, gpuTextures, gpuMaterials);
+    _dirtyRegions.clear();
+
+    requestTextures(context);
+    defineTextures(context);
 
-    if(_hash == hash)
+    GpuData& gpuData = *_gpuData;
+
+    if(_uploadHash == gpuData.uploadHash)
         return;
 
-    _hash = hash;
-    
+    // Edits and streamed textures only restart the pixels of the instances using them
+    if(_hash == gpuData.hash)
+        addDirtyMaterials(context, gpuData.materialHashes);
+
+    _hash = gpuData.hash;
+    _uploadHash = gpuData.uploadHash;
+    _materialHashes = gpuData.materialHashes;
+
+
     GpuResourceManager& resources = context.resources;
     resources.get<GpuStorageResource>(ResourceName(BindlessTextures)).update(
-                {sizeof(GpuBindlessTextureDescriptor), gpuTextures.size(), gpuTextures.data()});
+                {sizeof(GpuBindlessTextureDescriptor), gpuData.textures.size(), gpuData.textures.data()});
     resources.get<GpuStorageResource>(ResourceName(MaterialDatabase)).update(
-                {sizeof(GpuMaterial), gpuMaterials.size(), gpuMaterials.data()});
+                {sizeof(GpuMaterial), gpuData.materials.size(), gpuData.materials.data()});
 }
 
 void MaterialTask::render(GraphicContext& context)
 {
 }
 
+void MaterialTask::addDirtyMaterials(
+    const GraphicContext& context,
+    const std::vector<uint64_t>& materialHashes)
+{
+    const std::shared_ptr<MaterialDatabase>& materialDb = context.scene.materialDb();
+
+    auto addDirtyInstances = [&](const std::vector<std::shared_ptr<Instance>>& instances)
+    {
+        for(const auto& instance : instances)
+        {
+            for(const auto& primitive : instance->primitives())
+            {
+                if(!primitive->material())
+                    continue;
+
+                MaterialId materialId = materialDb->materialId(primitive->material());
+                if(materialId < materialHashes.size() && _materialHashes[materialId] != materialHashes[materialId])
+                {
+                    _dirtyRegions.push_back({instance->body()->position(), instance->boundingRadius()});
+                    break;
+                }
+            }
+        }
+    };
+
+    addDirtyInstances(context.scene.instances());
+    if (Terrain* terrain = context.scene.terrain().get())
+        addDirtyInstances(terrain->instances());
+}
+
+bool MaterialTask::defineTextures(GraphicContext& context)
+{
+    bool ok = true;
+
+    GpuResourceManager& resources = context.resources;
+
+    const std::vector<std::shared_ptr<Material>>& materials = context.scene.materialDb()->materials();
+
+    for(std::size_t i = 0; i < materials.size(); ++i)
+    {
+        const Material& material = *materials[i];
+        MaterialResources& materialResources = _materialsResourceIds[i];
+
+        if(material.albedo() != nullptr && !materialResources.albedoDefined)
+        {
+            ok = ok && resources.define<GpuTextureResource>(materialResources.textureAlbedo, {*material.albedo(), &context.device.textureStreamer()});
+            const auto& albedoTexure = resources.get<GpuTextureResource>(materialResources.textureAlbedo);
+            ok = ok && resources.define<GpuBindlessResource>(materialResources.bindlessAlbedo, {material.albedo(), albedoTexure});
+            materialResources.albedoDefined = true;
+        }
+
+        if(material.specular() != nullptr && !materialResources.specularDefined)
+        {
+            ok = ok && resources.define<GpuTextureResource>(materialResources.textureSpecular, {*material.specular(), &context.device.textureStreamer()});
+            const auto& specularTexture = resources.get<GpuTextureResource>(materialResources.textureSpecular);
+            ok = ok && resources.define<GpuBindlessResource>(materialResources.bindlessSpecular, {material.specular(), specularTexture});
+            materialResources.specularDefined = true;
+        }
+    }
+
+    return ok;
+}
+
+void MaterialTask::requestTextures(GraphicContext& context)
+{
+    const std::shared_ptr<MaterialDatabase>& materialDb = context.scene.materialDb();
+
+    auto request = [](const Material& material, float priority)
+    {
+        if(TextureAsset* albedo = material.albedoAsset())
+            albedo->request(priority);
+        if(TextureAsset* specular = material.specularAsset())
+            specular->request(priority);
+    };
+
+    // Visible instances, the bigger on screen the sooner
+    auto requestVisible = [&](const std::vector<std::shared_ptr<Instance>>& instances)
+    {
+        for(const auto& instance : instances)
+        {
+            float radius = context.camera.projectedRadius(instance->body()->position(), instance->boundingRadius());
+            if(radius <= 0.0f)
+                continue;
+
+            for(const auto& primitive : instance->primitives())
+            {
+                if(primitive->material())
+                    request(*primitive->material(), radius * radius);
+            }
+        }
+    };
+
+    requestVisible(context.scene.instances());
+    if (Terrain* terrain = context.scene.terrain().get())
+        requestVisible(terrain->instances());
+
+    // Materials only seen through reflections are reported by the path tracer.
+    // The report is copied back behind a fence and read a few frames late, only while needed.
+    bool hasUnrequested = false;
+    for(const auto& material : materialDb->materials())
+    {
+        for(TextureAsset* asset : {material->albedoAsset(), material->specularAsset()})
+        {
+            if(asset && asset->state() == TextureAsset::State::Unloaded)
+                hasUnrequested = true;
+        }
+    }
+
+    if(!hasUnrequested)
+        return;
+
+    const GpuStorageResource& feedbackResource = context.resources.get<GpuStorageResource>(ResourceName(MaterialFeedback));
+
+    std::vector<GLuint> feedback(materialDb->materials().size(), 0);
+    std::size_t feedbackSize = feedback.size() * sizeof(GLuint);
+
+    bool hasHits = false;
+    if(feedbackResource.fetchRead(feedback.data(), feedbackSize))
+    {
+        for(std::size_t i = 0; i < feedback.size(); ++i)
+        {
+            if(feedback[i] != 0)
+            {
+                request(*materialDb->materials()[i], 1.0f);
+                hasHits = true;
+            }
+        }
+    }
+
+    // Copies the hits of the last frame before they get cleared
+    feedbackResource.requestRead(feedbackSize);
+
+    if(hasHits)
+    {
+        std::fill(feedback.begin(), feedback.end(), 0);
+        feedbackResource.update({sizeof(GLuint), feedback.size(), feedback.data()});
+    }
+}
+
 uint64_t MaterialTask::toGpu(
     const GraphicContext& context,
     std::vector<GpuBindlessTextureDescriptor>& gpuBindless,
-    std::vector<GpuMaterial>& gpuMaterials)
+    std::vector<GpuMaterial>& gpuMaterials,
+    std::vector<uint64_t>& materialHashes,
+    uint64_t& uploadHash)
 {
     GpuResourceManager& resources = context.resources;
 
@@ -197,32 +367,58 @@ uint64_t MaterialTask::toGpu(
                     material.defaultReflectance(),
                     0);
 
-        if(material.albedo() != nullptr)
+        const MaterialResources& materialResources = _materialsResourceIds[i];
+
+        // Bindless handles are only exposed once their texels are all uploaded
+        if(materialResources.albedoDefined && resources.get<GpuTextureResource>(materialResources.textureAlbedo).isReady())
         {
             gpuMaterial.albedoTexture = gpuBindless.size();
-            gpuBindless.emplace_back(resources.get<GpuBindlessResource>(_materialsResourceIds[i].bindlessAlbedo).handle());
+            gpuBindless.emplace_back(resources.get<GpuBindlessResource>(materialResources.bindlessAlbedo).handle());
         }
         else
         {
-            gpuMaterial.albedoTexture = -1;
+            gpuMaterial.albedoTexture = textureIndex(material.albedoAsset());
         }
 
-        if(material.specular() != nullptr)
+        if(materialResources.specularDefined && resources.get<GpuTextureResource>(materialResources.textureSpecular).isReady())
         {
             gpuMaterial.specularTexture = gpuBindless.size();
-            gpuBindless.emplace_back(resources.get<GpuBindlessResource>(_materialsResourceIds[i].bindlessSpecular).handle());
+            gpuBindless.emplace_back(resources.get<GpuBindlessResource>(materialResources.bindlessSpecular).handle());
         }
         else
         {
-            gpuMaterial.specularTexture = -1;
+            gpuMaterial.specularTexture = textureIndex(material.specularAsset());
         }
 
         gpuMaterials.push_back(gpuMaterial);
     }
 
+    uploadHash = 0;
+    uploadHash = hashVec(gpuBindless, uploadHash);
+    uploadHash = hashVec(gpuMaterials, uploadHash);
+
+    // Texture indices shift as other textures get ready, their descriptors identify them
+    auto hashTexture = [&](int index, uint64_t seed)
+    {
+        return index >= 0 ? hashVal(gpuBindless[index], seed) : hashVal(index, seed);
+    };
+
+    materialHashes.clear();
+    for(const GpuMaterial& gpuMaterial : gpuMaterials)
+    {
+        uint64_t materialHash = 0;
+        materialHash = hashVal(gpuMaterial.albedo, materialHash);
+        materialHash = hashVal(gpuMaterial.specular, materialHash);
+        materialHash = hashTexture(gpuMaterial.albedoTexture, materialHash);
+        materialHash = hashTexture(gpuMaterial.specularTexture, materialHash);
+        materialHashes.push_back(materialHash);
+    }
+
+    // Emissive materials light the whole scene
     uint64_t hash = 0;
-    hash = hashVec(gpuBindless, hash);
-    hash = hashVec(gpuMaterials, hash);
+    hash = hashVal(gpuMaterials.size(), hash);
+    for(const GpuMaterial& gpuMaterial : gpuMaterials)
+        hash = hashVal(gpuMaterial.emission, hash);
 
     return hash;
 }
@@ -19,7 +19,8 @@ class MaterialTask : public PathTracerProviderTask
 {
 public:
     MaterialTask();
-    
+    ~MaterialTask();
+
     void registerDynamicResources(GraphicContext& context) override;
     bool defineResources(GraphicContext& context) override;
 
@@ -29,18 +30,25 @@ public:
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
     
+    void prepare(GraphicContext& context) override;
     void update(GraphicContext& context) override;
     void render(GraphicContext& context) override;
 
 private:
+    bool defineTextures(GraphicContext& context);
+    void requestTextures(GraphicContext& context);
+
     uint64_t toGpu(
         const GraphicContext& context,
         std::vector<GpuBindlessTextureDescriptor>& textures,
-        std::vector<GpuMaterial>& materials);
+        std::vector<GpuMaterial>& materials,
+        std::vector<uint64_t>& materialHashes,
+        uint64_t& uploadHash);
+
+    void addDirtyMaterials(
+        const GraphicContext& context,
+        const std::vector<uint64_t>& materialHashes);
 
     struct MaterialResources
     {
@@ -48,9 +56,18 @@ private:
         ResourceId textureSpecular;
         ResourceId bindlessAlbedo;
         ResourceId bindlessSpecular;
+        bool albedoDefined;
+        bool specularDefined;
     };
 
     std::vector<MaterialResources> _materialsResourceIds;
+
+    uint64_t _uploadHash;
+    std::vector<uint64_t> _materialHashes;
+
+    // Packed by prepare(), uploaded by update()
+    struct GpuData;
+    std::unique_ptr<GpuData> _gpuData;
 };
 
 }
@@ -1,5 +1,8 @@
 #include "camera.h"
 
+#include <fstream>
+#include <iostream>
+
 #include <imgui/imgui.h>
 
 #include "GLM/gtx/transform.hpp"
@@ -127,6 +130,137 @@ glm::mat4 Camera::screen() const
         glm::translate(glm::vec3(1, 1, 0));
 }
 
+float Camera::projectedRadius(const glm::dvec3& center, double radius) const
+{
+    glm::dvec3 viewCenter = glm::dvec3(view() * glm::dvec4(center, 1.0));
+    double depth = -viewCenter.z;
+
+    // Camera is inside or touching the sphere
+    if(depth <= radius)
+        return float(_viewport.height);
+
+    double tanY = glm::tan(_fov * 0.5);
+    double tanX = tanY * _viewport.width / double(_viewport.height);
+
+    // Distance to the side planes of the frustum
+    double sideX = (glm::abs(viewCenter.x) - tanX * depth) / glm::sqrt(1.0 + tanX * tanX);
+    double sideY = (glm::abs(viewCenter.y) - tanY * depth) / glm::sqrt(1.0 + tanY * tanY);
+    if(sideX > radius || sideY > radius)
+        return 0.0f;
+
+    return float(radius / (depth * tanY) * _viewport.height * 0.5);
+}
+
+bool Camera::projectedBounds(const glm::dvec3& center, double radius, glm::ivec4& bounds) const
+{
+    if(projectedRadius(center, radius) <= 0.0f)
+        return false;
+
+    glm::dvec3 viewCenter = glm::dvec3(view() * glm::dvec4(center, 1.0));
+    double depth = -viewCenter.z;
+
+    // Camera is inside or touching the sphere
+    if(depth <= radius)
+    {
+        bounds = glm::ivec4(0, 0, _viewport.width, _viewport.height);
+        return true;
+    }
+
+    // Extremes of x/z and y/z over the sphere's view space bounding box
+    glm::dvec2 low = glm::min((glm::dvec2(viewCenter) - radius) / (depth - radius),
+                              (glm::dvec2(viewCenter) - radius) / (depth + radius));
+    glm::dvec2 high = glm::max((glm::dvec2(viewCenter) + radius) / (depth - radius),
+                               (glm::dvec2(viewCenter) + radius) / (depth + radius));
+
+    double pixelsPerTan = _viewport.height * 0.5 / glm::tan(_fov * 0.5);
+    glm::dvec2 halfSize = glm::dvec2(_viewport.width, _viewport.height) * 0.5;
+    glm::ivec2 minPixel = glm::ivec2(glm::floor(low * pixelsPerTan + halfSize));
+    glm::ivec2 maxPixel = glm::ivec2(glm::ceil(high * pixelsPerTan + halfSize));
+
+    bounds = glm::ivec4(glm::max(minPixel, glm::ivec2(0)),
+                        glm::min(maxPixel, glm::ivec2(_viewport.width, _viewport.height)));
+
+    return bounds.x < bounds.z && bounds.y < bounds.w;
+}
+
+bool Camera::load(const std::string& fileName)
+{
+    std::ifstream file(fileName);
+    if(!file.is_open())
+    {
+        std::cerr << "Could not open camera file: " << fileName << std::endl;
+        return false;
+    }
+
+    auto readVec = [&](glm::dvec3& v) { file >> v.x >> v.y >> v.z; };
+
+    std::string name;
+    while(file >> name)
+    {
+        if(name == "position")
+            readVec(_position);
+        else if(name == "lookAt")
+            readVec(_lookAt);
+        else if(name == "up")
+            readVec(_up);
+        else if(name == "filmHeight")
+            file >> _filmHeight;
+        else if(name == "focalLength")
+            file >> _focalLength;
+        else if(name == "focusDistance")
+            file >> _focusDistance;
+        else if(name == "dofEnabled")
+            file >> _dofEnabled;
+        else if(name == "fstop")
+            file >> _fstop;
+        else if(name == "shutterSpeed")
+            file >> _shutterSpeed;
+        else if(name == "iso")
+            file >> _iso;
+        else
+        {
+            std::cerr << "Unknown camera parameter '" << name << "' in " << fileName << std::endl;
+            return false;
+        }
+
+        if(file.fail())
+        {
+            std::cerr << "Invalid value for camera parameter '" << name << "' in " << fileName << std::endl;
+            return false;
+        }
+    }
+
+    updateEV();
+    // Update field of view
+    setFocalLength(_focalLength);
+
+    return true;
+}
+
+bool Camera::save(const std::string& fileName) const
+{
+    std::ofstream file(fileName);
+    if(!file.is_open())
+    {
+        std::cerr << "Could not write camera file: " << fileName << std::endl;
+        return false;
+    }
+
+    file.precision(17);
+    file << "position " << _position.x << " " << _position.y << " " << _position.z << "\n";
+    file << "lookAt " << _lookAt.x << " " << _lookAt.y << " " << _lookAt.z << "\n";
+    file << "up " << _up.x << " " << _up.y << " " << _up.z << "\n";
+    file << "filmHeight " << _filmHeight << "\n";
+    file << "focalLength " << _focalLength << "\n";
+    file << "focusDistance " << _focusDistance << "\n";
+    file << "dofEnabled " << _dofEnabled << "\n";
+    file << "fstop " << _fstop << "\n";
+    file << "shutterSpeed " << _shutterSpeed << "\n";
+    file << "iso " << _iso << "\n";
+
+    return file.good();
+}
+
 void Camera::updateEV()
 {
     _ev = glm::log2(_fstop * _fstop * 100 / (_iso * _shutterSpeed));
@@ -209,6 +343,10 @@ void Camera::ui()
     ImGui::InputFloat4("",       &screen[3][0]);
 
     ImGui::Separator();
+
+    // Usable with the offline renderer's --camera option
+    if(ImGui::Button("Save camera.txt"))
+        save("camera.txt");
 }
 
 CameraMan::CameraMan(View& view) :
@@ -1,6 +1,8 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <string>
+
 #include "GLM/glm.hpp"
 
 #include "../system/input.h"
@@ -67,6 +69,16 @@ public:
     glm::mat4 proj() const;
     glm::mat4 screen() const;
 
+    // Radius in pixels of a projected sphere, 0 when out of the frustum
+    float projectedRadius(const glm::dvec3& center, double radius) const;
+
+    // Pixel rectangle (min x, min y, max x, max y) covering a projected sphere, false when off screen
+    bool projectedBounds(const glm::dvec3& center, double radius, glm::ivec4& bounds) const;
+
+    // Text files with one 'name values...' line per parameter, viewport excluded
+    bool load(const std::string& fileName);
+    bool save(const std::string& fileName) const;
+
     void ui();
 
 private:
@@ -0,0 +1,373 @@
+#include "cpudenoiser.h"
+
+#include <cfloat>
+#include <thread>
+
+#include "../../system/threadpool.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DENOISER_SSE2
+#endif
+
+
+namespace unisim
+{
+
+const float CpuDenoiser::ALBEDO_EPSILON = 1e-3f;
+
+
+namespace
+{
+
+// B3 spline a-trous kernel
+const float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+const float LOG2E = 1.44269504f;
+
+float toLuminance(float r, float g, float b)
+{
+    return glm::sqrt(0.299f*r*r + 0.587f*g*g + 0.114f*b*b);
+}
+
+#ifdef DENOISER_SSE2
+__m128 toLuminance(__m128 r, __m128 g, __m128 b)
+{
+    __m128 sum = _mm_mul_ps(_mm_set1_ps(0.299f), _mm_mul_ps(r, r));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(0.587f), _mm_mul_ps(g, g)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(0.114f), _mm_mul_ps(b, b)));
+    return _mm_sqrt_ps(sum);
+}
+
+__m128 absPs(__m128 x)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+// Within 2e-5 relative error, results below 2^-126 flush to it
+__m128 exp2Ps(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+
+    // Truncation rounds negative values up
+    __m128 integer = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    integer = _mm_sub_ps(integer, _mm_and_ps(_mm_cmpgt_ps(integer, x), _mm_set1_ps(1.0f)));
+    __m128 fraction = _mm_sub_ps(x, integer);
+
+    // Taylor series of 2^f on [0, 1)
+    __m128 p = _mm_set1_ps(1.54035304e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(1.33335581e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(9.61812911e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(5.55041087e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(2.40226507e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(6.93147181e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, fraction), _mm_set1_ps(1.0f));
+
+    __m128i exponent = _mm_add_epi32(_mm_cvttps_epi32(integer), _mm_set1_epi32(127));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(exponent, 23)));
+}
+
+// Within 2e-6 absolute error for positive normal floats
+__m128 log2Ps(__m128 x)
+{
+    __m128i bits = _mm_castps_si128(x);
+    __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128 mantissa = _mm_castsi128_ps(_mm_or_si128(
+        _mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+    // log2(m) = 2 / ln(2) * atanh((m - 1) / (m + 1))
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 t = _mm_div_ps(_mm_sub_ps(mantissa, one), _mm_add_ps(mantissa, one));
+    __m128 t2 = _mm_mul_ps(t, t);
+
+    __m128 p = _mm_set1_ps(1.0f / 9.0f);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 7.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 5.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 3.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), one);
+
+    return _mm_add_ps(exponent, _mm_mul_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.0f * LOG2E)));
+}
+#endif
+
+}
+
+
+void CpuDenoiser::ColorPlanes::resize(std::size_t size)
+{
+    r.resize(size);
+    g.resize(size);
+    b.resize(size);
+    luminance.resize(size);
+}
+
+void CpuDenoiser::GuidePlanes::resize(std::size_t size)
+{
+    normalX.resize(size);
+    normalY.resize(size);
+    normalZ.resize(size);
+    depth.resize(size);
+    relativeError.resize(size);
+}
+
+
+CpuDenoiser::CpuDenoiser(unsigned int threadCount) :
+    _threadCount(threadCount)
+{
+    if(_threadCount == 0)
+        _threadCount = glm::max(1u, std::thread::hardware_concurrency());
+}
+
+CpuDenoiser::~CpuDenoiser()
+{
+}
+
+template<typename Job>
+void CpuDenoiser::parallelRows(int height, const Job& job)
+{
+    unsigned int jobCount = glm::min(_threadCount, (unsigned int)glm::max(1, height));
+
+    // Workers are only started once the CPU denoiser is used, the calling thread takes its share of the rows
+    if(jobCount > 1 && !_threadPool)
+        _threadPool.reset(new ThreadPool(_threadCount - 1));
+
+    // Interleaved rows balance the sky and geometry heavy parts of the image
+    auto rows = [&](unsigned int j)
+    {
+        for(int y = j; y < height; y += jobCount)
+            job(y);
+    };
+
+    for(unsigned int j = 1; j < jobCount; ++j)
+        _threadPool->submit([&rows, j]{ rows(j); });
+
+    rows(0);
+
+    if(jobCount > 1)
+        _threadPool->wait();
+}
+
+void CpuDenoiser::denoise(const Images& images, const DenoiserSettings& settings, std::vector<glm::vec4>& output)
+{
+    std::size_t pixelCount = std::size_t(images.width) * images.height;
+
+    _ping.resize(pixelCount);
+    _pong.resize(pixelCount);
+    _guides.resize(pixelCount);
+    output.resize(pixelCount);
+
+    // Demodulate albedo and gather guides
+    parallelRows(images.height, [&](int y)
+    {
+        for(int x = 0; x < images.width; ++x)
+        {
+            std::size_t p = std::size_t(y) * images.width + x;
+
+            glm::vec4 color = images.color[p];
+            glm::vec3 albedo = glm::max(glm::vec3(images.albedo[p]), glm::vec3(ALBEDO_EPSILON));
+            glm::vec3 demodulated = glm::vec3(color) / glm::max(color.a, 1.0f) / albedo;
+            _ping.r[p] = demodulated.r;
+            _ping.g[p] = demodulated.g;
+            _ping.b[p] = demodulated.b;
+            _ping.luminance[p] = toLuminance(demodulated.r, demodulated.g, demodulated.b);
+
+            glm::vec3 normal = glm::vec3(images.normalDepth[p]);
+            float normalLength = glm::length(normal);
+            normal = normalLength > 0 ? normal / normalLength : normal;
+            _guides.normalX[p] = normal.x;
+            _guides.normalY[p] = normal.y;
+            _guides.normalZ[p] = normal.z;
+            _guides.depth[p] = images.normalDepth[p].w;
+
+            const glm::vec4& moments = images.moments[p];
+            float count = glm::max(1.0f, moments.b);
+            float mean = moments.r / count;
+            float variance = glm::max(0.0f, moments.g / count - mean * mean);
+            _guides.relativeError[p] = glm::sqrt(variance / count) / glm::max(mean, 1e-3f);
+        }
+    });
+
+    for(unsigned int i = 0; i < settings.iterationCount; ++i)
+    {
+        parallelRows(images.height, [&](int y)
+        {
+            filterRow(images, settings, i, y, _ping, _pong);
+        });
+
+        std::swap(_ping, _pong);
+    }
+
+    // Remodulate albedo
+    parallelRows(images.height, [&](int y)
+    {
+        for(int x = 0; x < images.width; ++x)
+        {
+            std::size_t p = std::size_t(y) * images.width + x;
+
+            glm::vec3 albedo = glm::max(glm::vec3(images.albedo[p]), glm::vec3(ALBEDO_EPSILON));
+            output[p] = glm::vec4(glm::vec3(_ping.r[p], _ping.g[p], _ping.b[p]) * albedo, 1);
+        }
+    });
+}
+
+void CpuDenoiser::filterRow(const Images& images, const DenoiserSettings& settings, unsigned int iteration, int y,
+                            const ColorPlanes& source, ColorPlanes& destination) const
+{
+    int stepSize = 1 << iteration;
+
+    // Every tap of pixels in [interiorBegin, interiorEnd) lands inside the row
+    int interiorBegin = glm::min(images.width, 2 * stepSize);
+    int interiorEnd = glm::max(interiorBegin, images.width - 2 * stepSize);
+
+    int x = 0;
+    for(; x < interiorBegin; ++x)
+        filterPixel(images, settings, stepSize, x, y, source, destination);
+
+#ifdef DENOISER_SSE2
+    for(; x + 4 <= interiorEnd; x += 4)
+        filterPixels4(images, settings, stepSize, x, y, source, destination);
+#else
+    // Scalar path on targets without SSE2
+    for(; x < interiorEnd; ++x)
+        filterPixel(images, settings, stepSize, x, y, source, destination);
+#endif
+
+    for(; x < images.width; ++x)
+        filterPixel(images, settings, stepSize, x, y, source, destination);
+}
+
+void CpuDenoiser::filterPixel(const Images& images, const DenoiserSettings& settings, int stepSize, int x, int y,
+                              const ColorPlanes& source, ColorPlanes& destination) const
+{
+    float colorScale = settings.colorPhi / float(stepSize);
+
+    std::size_t p = std::size_t(y) * images.width + x;
+
+    glm::vec3 centerNormal(_guides.normalX[p], _guides.normalY[p], _guides.normalZ[p]);
+    float centerDepth = _guides.depth[p];
+    float centerLuminance = source.luminance[p];
+    float luminanceSigma = colorScale * _guides.relativeError[p] * centerLuminance + 1e-4f;
+
+    glm::vec3 colorSum(0);
+    float weightSum = 0;
+
+    for(int dy = -2; dy <= 2; ++dy)
+    {
+        int qy = y + dy * stepSize;
+        if(qy < 0 || qy >= images.height)
+            continue;
+
+        for(int dx = -2; dx <= 2; ++dx)
+        {
+            int qx = x + dx * stepSize;
+            if(qx < 0 || qx >= images.width)
+                continue;
+
+            std::size_t q = std::size_t(qy) * images.width + qx;
+
+            float luminanceWeight = glm::exp(-glm::abs(centerLuminance - source.luminance[q]) / luminanceSigma);
+
+            glm::vec3 normal(_guides.normalX[q], _guides.normalY[q], _guides.normalZ[q]);
+            float normalWeight = glm::pow(glm::max(0.0f, glm::dot(centerNormal, normal)), settings.normalPhi);
+
+            float depth = _guides.depth[q];
+            float depthRange = settings.depthPhi * stepSize * glm::max(centerDepth, depth) + 1e-6f;
+            float depthWeight = glm::exp(-glm::abs(centerDepth - depth) / depthRange);
+
+            float weight = KERNEL[glm::abs(dx)] * KERNEL[glm::abs(dy)]
+                    * luminanceWeight * normalWeight * depthWeight;
+
+            colorSum += weight * glm::vec3(source.r[q], source.g[q], source.b[q]);
+            weightSum += weight;
+        }
+    }
+
+    // The center tap always has a positive weight unless its normal is degenerate
+    glm::vec3 color = weightSum > 0 ? colorSum / weightSum : glm::vec3(source.r[p], source.g[p], source.b[p]);
+
+    destination.r[p] = color.r;
+    destination.g[p] = color.g;
+    destination.b[p] = color.b;
+    destination.luminance[p] = toLuminance(color.r, color.g, color.b);
+}
+
+#ifdef DENOISER_SSE2
+void CpuDenoiser::filterPixels4(const Images& images, const DenoiserSettings& settings, int stepSize, int x, int y,
+                                const ColorPlanes& source, ColorPlanes& destination) const
+{
+    std::size_t p = std::size_t(y) * images.width + x;
+
+    __m128 centerNormalX = _mm_loadu_ps(&_guides.normalX[p]);
+    __m128 centerNormalY = _mm_loadu_ps(&_guides.normalY[p]);
+    __m128 centerNormalZ = _mm_loadu_ps(&_guides.normalZ[p]);
+    __m128 centerDepth = _mm_loadu_ps(&_guides.depth[p]);
+    __m128 centerLuminance = _mm_loadu_ps(&source.luminance[p]);
+
+    // Weights are a single power of two, exponents are in base 2
+    __m128 luminanceSigma = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(settings.colorPhi / float(stepSize)),
+        _mm_mul_ps(_mm_loadu_ps(&_guides.relativeError[p]), centerLuminance)), _mm_set1_ps(1e-4f));
+    __m128 luminanceScale = _mm_div_ps(_mm_set1_ps(-LOG2E), luminanceSigma);
+
+    __m128 depthScale = _mm_set1_ps(settings.depthPhi * stepSize);
+    __m128 normalPhi = _mm_set1_ps(settings.normalPhi);
+    bool hasNormalWeight = settings.normalPhi != 0.0f;
+
+    __m128 colorSumR = _mm_setzero_ps();
+    __m128 colorSumG = _mm_setzero_ps();
+    __m128 colorSumB = _mm_setzero_ps();
+    __m128 weightSum = _mm_setzero_ps();
+
+    for(int dy = -2; dy <= 2; ++dy)
+    {
+        int qy = y + dy * stepSize;
+        if(qy < 0 || qy >= images.height)
+            continue;
+
+        for(int dx = -2; dx <= 2; ++dx)
+        {
+            std::size_t q = std::size_t(qy) * images.width + x + dx * stepSize;
+
+            __m128 exponent = _mm_mul_ps(absPs(_mm_sub_ps(centerLuminance, _mm_loadu_ps(&source.luminance[q]))), luminanceScale);
+
+            __m128 depth = _mm_loadu_ps(&_guides.depth[q]);
+            __m128 depthRange = _mm_add_ps(_mm_mul_ps(depthScale, _mm_max_ps(centerDepth, depth)), _mm_set1_ps(1e-6f));
+            exponent = _mm_sub_ps(exponent, _mm_div_ps(_mm_mul_ps(absPs(_mm_sub_ps(centerDepth, depth)), _mm_set1_ps(LOG2E)), depthRange));
+
+            __m128 hasWeight = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            if(hasNormalWeight)
+            {
+                __m128 dot = _mm_mul_ps(centerNormalX, _mm_loadu_ps(&_guides.normalX[q]));
+                dot = _mm_add_ps(dot, _mm_mul_ps(centerNormalY, _mm_loadu_ps(&_guides.normalY[q])));
+                dot = _mm_add_ps(dot, _mm_mul_ps(centerNormalZ, _mm_loadu_ps(&_guides.normalZ[q])));
+
+                hasWeight = _mm_cmpgt_ps(dot, _mm_setzero_ps());
+                exponent = _mm_add_ps(exponent, _mm_mul_ps(normalPhi, log2Ps(_mm_max_ps(dot, _mm_set1_ps(FLT_MIN)))));
+            }
+
+            __m128 weight = _mm_mul_ps(_mm_set1_ps(KERNEL[glm::abs(dx)] * KERNEL[glm::abs(dy)]), exp2Ps(exponent));
+            weight = _mm_and_ps(hasWeight, weight);
+
+            colorSumR = _mm_add_ps(colorSumR, _mm_mul_ps(weight, _mm_loadu_ps(&source.r[q])));
+            colorSumG = _mm_add_ps(colorSumG, _mm_mul_ps(weight, _mm_loadu_ps(&source.g[q])));
+            colorSumB = _mm_add_ps(colorSumB, _mm_mul_ps(weight, _mm_loadu_ps(&source.b[q])));
+            weightSum = _mm_add_ps(weightSum, weight);
+        }
+    }
+
+    // The center tap always has a positive weight unless its normal is degenerate
+    __m128 isWeighted = _mm_cmpgt_ps(weightSum, _mm_setzero_ps());
+    __m128 invWeightSum = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(weightSum, _mm_set1_ps(FLT_MIN)));
+
+    __m128 r = _mm_or_ps(_mm_and_ps(isWeighted, _mm_mul_ps(colorSumR, invWeightSum)), _mm_andnot_ps(isWeighted, _mm_loadu_ps(&source.r[p])));
+    __m128 g = _mm_or_ps(_mm_and_ps(isWeighted, _mm_mul_ps(colorSumG, invWeightSum)), _mm_andnot_ps(isWeighted, _mm_loadu_ps(&source.g[p])));
+    __m128 b = _mm_or_ps(_mm_and_ps(isWeighted, _mm_mul_ps(colorSumB, invWeightSum)), _mm_andnot_ps(isWeighted, _mm_loadu_ps(&source.b[p])));
+
+    _mm_storeu_ps(&destination.r[p], r);
+    _mm_storeu_ps(&destination.g[p], g);
+    _mm_storeu_ps(&destination.b[p], b);
+    _mm_storeu_ps(&destination.luminance[p], toLuminance(r, g, b));
+}
+
+#endif
+
+}
@@ -0,0 +1,102 @@
+#ifndef CPUDENOISER_H
+#define CPUDENOISER_H
+
+#include <memory>
+#include <vector>
+
+#include <GLM/glm.hpp>
+
+
+namespace unisim
+{
+
+class ThreadPool;
+
+struct DenoiserSettings
+{
+    unsigned int iterationCount;
+    float colorPhi;
+    float normalPhi;
+    float depthPhi;
+};
+
+
+// Edge-avoiding a-trous filter matching shaders/denoise.glsl, has no GPU dependency
+class CpuDenoiser
+{
+public:
+    // Row major RGBA images laid out like the path tracer's outputs
+    struct Images
+    {
+        int width;
+        int height;
+
+        // Linear color sum and sample count
+        const glm::vec4* color;
+
+        // First hit guides
+        const glm::vec4* albedo;
+        const glm::vec4* normalDepth;
+
+        // Luminance sum, squared luminance sum and sample count
+        const glm::vec4* moments;
+    };
+
+    // Uses every hardware thread when 'threadCount' is 0
+    CpuDenoiser(unsigned int threadCount = 0);
+    ~CpuDenoiser();
+
+    // Output is linear with a sample count of one
+    void denoise(const Images& images, const DenoiserSettings& settings, std::vector<glm::vec4>& output);
+
+    static const float ALBEDO_EPSILON;
+
+private:
+    // Planar layout, the filter weighs four horizontally adjacent pixels at once
+    struct ColorPlanes
+    {
+        void resize(std::size_t size);
+
+        std::vector<float> r;
+        std::vector<float> g;
+        std::vector<float> b;
+        std::vector<float> luminance;
+    };
+
+    struct GuidePlanes
+    {
+        void resize(std::size_t size);
+
+        std::vector<float> normalX;
+        std::vector<float> normalY;
+        std::vector<float> normalZ;
+        std::vector<float> depth;
+
+        // Relative standard error of the mean
+        std::vector<float> relativeError;
+    };
+
+    template<typename Job>
+    void parallelRows(int height, const Job& job);
+
+    void filterRow(const Images& images, const DenoiserSettings& settings, unsigned int iteration, int y,
+                   const ColorPlanes& source, ColorPlanes& destination) const;
+    void filterPixel(const Images& images, const DenoiserSettings& settings, int stepSize, int x, int y,
+                     const ColorPlanes& source, ColorPlanes& destination) const;
+    void filterPixels4(const Images& images, const DenoiserSettings& settings, int stepSize, int x, int y,
+                       const ColorPlanes& source, ColorPlanes& destination) const;
+
+    unsigned int _threadCount;
+    std::unique_ptr<ThreadPool> _threadPool;
+
+    // Demodulated linear color ping-pong buffers
+    ColorPlanes _ping;
+    ColorPlanes _pong;
+
+    // Normalized normal and depth
+    GuidePlanes _guides;
+};
+
+}
+
+#endif // CPUDENOISER_H
@@ -0,0 +1,303 @@
+#include "denoisingtask.h"
+
+#include "../system/profiler.h"
+
+#include "../graphic/gpudevice.h"
+
+#include "../pathtracer/pathtracertask.h"
+
+#include "../camera.h"
+
+
+namespace unisim
+{
+
+DefineProfilePoint(DenoisingCpu);
+DefineProfilePointGpu(Denoising);
+
+DeclareResource(PathTracerResult);
+DeclareResource(PathTracerMoments);
+
+DefineResource(DenoisedResult);
+DefineResource(DenoisePing);
+DefineResource(DenoisePong);
+DefineResource(DenoiseParams);
+
+
+struct GpuDenoiseParams
+{
+    GLint stepSize;
+    GLuint isFirstIteration;
+    GLuint isLastIteration;
+    GLfloat colorPhi;
+    GLfloat normalPhi;
+    GLfloat depthPhi;
+};
+
+
+DenoisingTask::DenoisingTask() :
+    GraphicTask("Denoising"),
+    _sourceBindPoint(GpuProgramImageBindPoint::invalid()),
+    _destinationBindPoint(GpuProgramImageBindPoint::invalid()),
+    _cpuPendingReads(0),
+    _cpuInputsChanged(false)
+{
+}
+
+DenoisingTask::~DenoisingTask()
+{
+}
+
+PathTracerAovMask DenoisingTask::pathTracerAovs(const GraphicSettings& settings) const
+{
+    if(settings.denoiser == DenoiserType::None)
+        return 0;
+
+    return aovMask(PathTracerAov::Albedo) | aovMask(PathTracerAov::NormalDepth);
+}
+
+bool DenoisingTask::defineResources(GraphicContext& context)
+{
+    bool ok = true;
+
+    GpuResourceManager& resources = context.resources;
+
+    _viewport.reset(new Viewport(context.camera.viewport()));
+
+    GpuImageResource::Definition imageDef = {
+        .width  = _viewport->width,
+        .height = _viewport->height,
+        .depth  = 1,
+        .format = TextureFormat::R32G32B32A32_FLOAT};
+
+    ok = ok && resources.define<GpuImageResource>(ResourceName(DenoisedResult), imageDef);
+    ok = ok && resources.define<GpuImageResource>(ResourceName(DenoisePing), imageDef);
+    ok = ok && resources.define<GpuImageResource>(ResourceName(DenoisePong), imageDef);
+
+    GpuDenoiseParams params = {1, 1, 1, 0.0f, 0.0f, 0.0f};
+    ok = ok && resources.define<GpuConstantResource>(
+             ResourceName(DenoiseParams), {
+              sizeof(GpuDenoiseParams),
+              &params});
+
+    // Converged images are denoised once
+    addInput(ResourceName(PathTracerResult));
+    addInput(ResourceName(PathTracerMoments));
+    addInput(PathTracerTask::aovResource(PathTracerAov::Albedo));
+    addInput(PathTracerTask::aovResource(PathTracerAov::NormalDepth));
+
+    return ok;
+}
+
+bool DenoisingTask::defineShaders(GraphicContext& context)
+{
+    _denoiseGpi.reset(new GpuProgramInterface());
+    _denoiseGpi->declareConstant({"DenoiseParams", ResourceName(DenoiseParams)});
+    _denoiseGpi->declareImage({"source"});
+    _denoiseGpi->declareImage({"destination"});
+    _denoiseGpi->declareImage({"albedo", PathTracerTask::aovResource(PathTracerAov::Albedo), GpuResourceAccess::ReadOnly});
+    _denoiseGpi->declareImage({"normalDepth", PathTracerTask::aovResource(PathTracerAov::NormalDepth), GpuResourceAccess::ReadOnly});
+    _denoiseGpi->declareImage({"moments", ResourceName(PathTracerMoments), GpuResourceAccess::ReadOnly});
+
+    if(!generateComputeProgram(_denoiseProgram, "Denoise", "shaders/denoise.glsl"))
+        return false;
+
+    if(!_denoiseGpi->compile(_denoiseCompiledGpi, *_denoiseProgram))
+        return false;
+
+    // Ping-pong images change every iteration
+    _sourceBindPoint = _denoiseCompiledGpi.getImageBindPoint("source");
+    _destinationBindPoint = _denoiseCompiledGpi.getImageBindPoint("destination");
+
+    return true;
+}
+
+void DenoisingTask::update(GraphicContext& context)
+{
+    const Viewport& viewport = context.camera.viewport();
+
+    if(*_viewport != viewport)
+    {
+        *_viewport = viewport;
+
+        GpuImageResource::Definition imageDef = {
+            .width  = viewport.width,
+            .height = viewport.height,
+            .depth  = 1,
+            .format = TextureFormat::R32G32B32A32_FLOAT};
+
+        context.resources.update<GpuImageResource>(ResourceName(DenoisedResult), imageDef);
+        context.resources.update<GpuImageResource>(ResourceName(DenoisePing), imageDef);
+        context.resources.update<GpuImageResource>(ResourceName(DenoisePong), imageDef);
+    }
+}
+
+void DenoisingTask::render(GraphicContext& context)
+{
+    switch(context.settings.denoiser)
+    {
+    case DenoiserType::Gpu:
+        renderGpu(context);
+        break;
+    case DenoiserType::Cpu:
+        _cpuInputsChanged = true;
+        renderCpu(context);
+        break;
+    default:
+        break;
+    }
+}
+
+void DenoisingTask::skipRender(GraphicContext& context)
+{
+    // Copies in flight still land, and inputs that changed meanwhile are read back after them
+    if(context.settings.denoiser == DenoiserType::Cpu && (_cpuPendingReads != 0 || _cpuInputsChanged))
+        renderCpu(context);
+}
+
+uint64_t DenoisingTask::inputHash(const GraphicContext& context) const
+{
+    const GraphicSettings& settings = context.settings;
+
+    uint64_t hash = 0;
+    hash = PathTracerProviderTask::hashVal(settings.denoiser, hash);
+    hash = PathTracerProviderTask::hashVal(settings.denoiserIterationCount, hash);
+    hash = PathTracerProviderTask::hashVal(settings.denoiserColorPhi, hash);
+    hash = PathTracerProviderTask::hashVal(settings.denoiserNormalPhi, hash);
+    hash = PathTracerProviderTask::hashVal(settings.denoiserDepthPhi, hash);
+
+    return hash;
+}
+
+void DenoisingTask::renderGpu(GraphicContext& context)
+{
+    ProfileGpu(Denoising);
+
+    if(!_denoiseProgram->isValid())
+        return;
+
+    const GraphicSettings& settings = context.settings;
+    GpuResourceManager& resources = context.resources;
+
+    const auto& params = resources.get<GpuConstantResource>(ResourceName(DenoiseParams));
+    const GpuImageResource* pingPong[2] = {
+        &resources.get<GpuImageResource>(ResourceName(DenoisePing)),
+        &resources.get<GpuImageResource>(ResourceName(DenoisePong))};
+
+    GraphicProgramScope programScope(*_denoiseProgram);
+
+    _denoiseCompiledGpi.bind(context.device, resources);
+
+    // Ping-pong between intermediate images, the last iteration remodulates into the result
+    const GpuImageResource* source = &resources.get<GpuImageResource>(ResourceName(PathTracerResult));
+    unsigned int iterationCount = glm::max(1u, settings.denoiserIterationCount);
+
+    for(unsigned int i = 0; i < iterationCount; ++i)
+    {
+        bool isLastIteration = i + 1 == iterationCount;
+        const GpuImageResource* destination = isLastIteration ?
+                    &resources.get<GpuImageResource>(ResourceName(DenoisedResult)) :
+                    pingPong[i % 2];
+
+        GpuDenoiseParams gpuParams = {
+            1 << i,
+            i == 0,
+            isLastIteration,
+            settings.denoiserColorPhi,
+            settings.denoiserNormalPhi,
+            settings.denoiserDepthPhi};
+        params.update({sizeof(GpuDenoiseParams), &gpuParams});
+
+        context.device.bindImage(*source, _sourceBindPoint, GpuResourceAccess::ReadOnly);
+        context.device.bindImage(*destination, _destinationBindPoint);
+
+        context.device.dispatch((_viewport->width + GROUP_WIDTH - 1) / GROUP_WIDTH,
+                                (_viewport->height + GROUP_HEIGHT - 1) / GROUP_HEIGHT);
+
+        source = destination;
+    }
+}
+
+void DenoisingTask::renderCpu(GraphicContext& context)
+{
+    Profile(DenoisingCpu);
+
+    const GraphicSettings& settings = context.settings;
+    GpuResourceManager& resources = context.resources;
+
+    std::size_t pixelCount = std::size_t(_viewport->width) * _viewport->height;
+    _cpuColor.resize(pixelCount);
+    _cpuAlbedo.resize(pixelCount);
+    _cpuNormalDepth.resize(pixelCount);
+    _cpuMoments.resize(pixelCount);
+
+    const GpuImageResource* sources[] = {
+        &resources.get<GpuImageResource>(ResourceName(PathTracerResult)),
+        &resources.get<GpuImageResource>(PathTracerTask::aovResource(PathTracerAov::Albedo)),
+        &resources.get<GpuImageResource>(PathTracerTask::aovResource(PathTracerAov::NormalDepth)),
+        &resources.get<GpuImageResource>(ResourceName(PathTracerMoments))};
+    glm::vec4* destinations[] = {
+        _cpuColor.data(),
+        _cpuAlbedo.data(),
+        _cpuNormalDepth.data(),
+        _cpuMoments.data()};
+
+    // Never waits for the path tracer, the denoised result lags a few frames behind
+    if(_cpuPendingReads != 0)
+    {
+        bool isDropped = false;
+        for(int i = 0; i < 4; ++i)
+        {
+            if((_cpuPendingReads & (1u << i)) == 0)
+                continue;
+
+            if(sources[i]->fetchRead(destinations[i]))
+                _cpuPendingReads &= ~(1u << i);
+            else if(!sources[i]->isReadInFlight())
+                isDropped = true;
+        }
+
+        // Resized images drop their copies in flight, a new set is requested instead
+        if(isDropped)
+        {
+            _cpuPendingReads = 0;
+            _cpuInputsChanged = true;
+        }
+        else if(_cpuPendingReads != 0)
+            return;
+        else
+        {
+            CpuDenoiser::Images images = {
+                _viewport->width,
+                _viewport->height,
+                _cpuColor.data(),
+                _cpuAlbedo.data(),
+                _cpuNormalDepth.data(),
+                _cpuMoments.data()};
+
+            DenoiserSettings denoiserSettings = {
+                glm::max(1u, settings.denoiserIterationCount),
+                settings.denoiserColorPhi,
+                settings.denoiserNormalPhi,
+                settings.denoiserDepthPhi};
+
+            _cpuDenoiser.denoise(images, denoiserSettings, _cpuDenoised);
+
+            resources.get<GpuImageResource>(ResourceName(DenoisedResult)).write(_cpuDenoised.data());
+        }
+    }
+
+    if(!_cpuInputsChanged)
+        return;
+
+    // A single set of copies is in flight, so that the images all come from the same frame
+    for(int i = 0; i < 4; ++i)
+    {
+        if(sources[i]->requestRead())
+            _cpuPendingReads |= 1u << i;
+    }
+
+    _cpuInputsChanged = false;
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef DENOISINGTASK_H
+#define DENOISINGTASK_H
+
+#include <memory>
+
+#include <GLM/glm.hpp>
+
+#include "../taskgraph/graphictask.h"
+
+#include "cpudenoiser.h"
+
+
+namespace unisim
+{
+
+struct Viewport;
+
+
+class DenoisingTask : public GraphicTask
+{
+public:
+    DenoisingTask();
+    ~DenoisingTask();
+
+    PathTracerAovMask pathTracerAovs(const GraphicSettings& settings) const override;
+
+    bool defineResources(GraphicContext& context) override;
+    bool defineShaders(GraphicContext& context) override;
+
+    void update(GraphicContext& context) override;
+    void render(GraphicContext& context) override;
+    void skipRender(GraphicContext& context) override;
+
+    // Must match the denoiser's work group size
+    static const unsigned int GROUP_WIDTH = 8;
+    static const unsigned int GROUP_HEIGHT = 8;
+
+protected:
+    uint64_t inputHash(const GraphicContext& context) const override;
+
+private:
+    void renderGpu(GraphicContext& context);
+    void renderCpu(GraphicContext& context);
+
+    GraphicProgramPtr _denoiseProgram;
+    GpuProgramInterfacePtr _denoiseGpi;
+    CompiledGpuProgramInterface _denoiseCompiledGpi;
+    GpuProgramImageBindPoint _sourceBindPoint;
+    GpuProgramImageBindPoint _destinationBindPoint;
+
+    std::unique_ptr<Viewport> _viewport;
+
+    CpuDenoiser _cpuDenoiser;
+    std::vector<glm::vec4> _cpuColor;
+    std::vector<glm::vec4> _cpuAlbedo;
+    std::vector<glm::vec4> _cpuNormalDepth;
+    std::vector<glm::vec4> _cpuMoments;
+    std::vector<glm::vec4> _cpuDenoised;
+
+    // Bit per image whose copy is still in flight
+    unsigned int _cpuPendingReads;
+
+    // Inputs were written since the copies in flight were requested
+    bool _cpuInputsChanged;
+};
+
+}
+
+#endif // DENOISINGTASK_H
@@ -2,8 +2,14 @@
 
 #include "../system/profiler.h"
 
+#include "../resource/texture.h"
+
+#include "../pathtracer/accumulation.h"
+
 #include "../graphic/gpudevice.h"
 
+#include "../camera.h"
+
 
 namespace unisim
 {
@@ -11,26 +17,95 @@ namespace unisim
 DefineProfilePointGpu(ColorGrading);
 
 DeclareResource(PathTracerResult);
+DeclareResource(DenoisedResult);
 DeclareResource(FullScreenTriangle);
+DefineResource(GradingParams);
+
+
+struct GpuGradingParams
+{
+    GLfloat exposure;
+};
+
+// Must match shaders/colorgrade.frag
+float sRGB(float x)
+{
+    if (x <= 0.0031308f)
+        return 12.92f * x;
+    else
+        return 1.055f * glm::pow(x, 1.0f / 2.4f) - 0.055f;
+}
+
+glm::vec3 ACESFilm(const glm::vec3& x)
+{
+    float a = 2.51f;
+    float b = 0.03f;
+    float c = 2.43f;
+    float d = 0.59f;
+    float e = 0.14f;
+    return glm::clamp((x*(a*x+b))/(x*(c*x+d)+e), 0.0f, 1.0f);
+}
 
 
 GradingTask::GradingTask() :
-    GraphicTask("Color Grading")
+    GraphicTask("Color Grading"),
+    _inputBindPoint(GpuProgramTextureBindPoint::invalid()),
+    _exposure(1.0f)
 {
 }
 
 bool GradingTask::defineShaders(GraphicContext& context)
 {
     _colorGradingGpi.reset(new GpuProgramInterface());
+    _colorGradingGpi->declareConstant({"GradingParams", ResourceName(GradingParams)});
     _colorGradingGpi->declareTexture({"Input"});
 
-    _colorGradingProgram.reset();
     if(!generateGraphicProgram(_colorGradingProgram, "Color Grading", "shaders/fullscreen.vert", "shaders/colorgrade.frag"))
         return false;
 
+    if(!_colorGradingGpi->compile(_colorGradingCompiledGpi, *_colorGradingProgram))
+        return false;
+
+    // Input follows the denoiser setting
+    _inputBindPoint = _colorGradingCompiledGpi.getTextureBindPoint("Input");
+
     return true;
 }
 
+bool GradingTask::defineResources(GraphicContext& context)
+{
+    bool ok = true;
+
+    GpuGradingParams params = {_exposure};
+    ok = ok && context.resources.define<GpuConstantResource>(
+             ResourceName(GradingParams), {
+              sizeof(GpuGradingParams),
+              &params});
+
+    addInput(ResourceName(PathTracerResult));
+    addInput(ResourceName(DenoisedResult));
+    addInput(ResourceName(GradingParams));
+
+    return ok;
+}
+
+void GradingTask::update(GraphicContext& context)
+{
+    // Only uploaded on change, a new version redraws the swapchain
+    if(_exposure == context.camera.exposure())
+        return;
+
+    _exposure = context.camera.exposure();
+
+    // Exposure is applied here so that changing it keeps the accumulation
+    GpuGradingParams params = {_exposure};
+
+    context.resources.get<GpuConstantResource>(
+                ResourceName(GradingParams)).update({
+                    sizeof(GpuGradingParams),
+                    &params});
+}
+
 void GradingTask::render(GraphicContext& context)
 {
     ProfileGpu(ColorGrading);
@@ -38,17 +113,86 @@ void GradingTask::render(GraphicContext& context)
     if(!_colorGradingProgram->isValid())
         return;
 
-    CompiledGpuProgramInterface compiledGpi;
-    if (!_colorGradingGpi->compile(compiledGpi, *_colorGradingProgram))
-        return;
-
     GraphicProgramScope programScope(*_colorGradingProgram);
 
+    ResourceId input = inputResource(context.settings);
+
     GpuResourceManager& resources = context.resources;
-    context.device.bindTexture(resources.get<GpuImageResource>(ResourceName(PathTracerResult)),
-                               compiledGpi.getTextureBindPoint("Input"));
+    _colorGradingCompiledGpi.bind(context.device, resources);
+    context.device.bindTexture(resources.get<GpuImageResource>(input), _inputBindPoint);
 
     context.device.draw(resources.get<GpuGeometryResource>(ResourceName(FullScreenTriangle)));
 }
 
+void GradingTask::readInput(GraphicContext& context, Accumulation& accumulation) const
+{
+    const GpuImageResource& input = context.resources.get<GpuImageResource>(inputResource(context.settings));
+
+    accumulation.width = input.handle().width;
+    accumulation.height = input.handle().height;
+    accumulation.exposure = context.camera.exposure();
+    accumulation.result.resize(std::size_t(accumulation.width) * accumulation.height);
+    input.read(accumulation.result.data());
+    accumulation.moments.clear();
+}
+
+bool GradingTask::save(const Accumulation& accumulation, const std::string& fileName)
+{
+    int width = accumulation.width;
+    int height = accumulation.height;
+
+    bool isExr = fileName.find(".exr") != std::string::npos;
+
+    Texture texture;
+    texture.width = width;
+    texture.height = height;
+    texture.format = isExr ? TextureFormat::R32G32B32A32_FLOAT : TextureFormat::R8G8B8A8_UNORM;
+    texture.numComponents = 4;
+    texture.data.resize(accumulation.result.size() * (isExr ? sizeof(glm::vec4) : 4));
+
+    float exposure = accumulation.exposure;
+
+    for(int y = 0; y < height; ++y)
+    {
+        // Images are stored bottom to top
+        const glm::vec4* row = &accumulation.result[std::size_t(height - 1 - y) * width];
+
+        for(int x = 0; x < width; ++x)
+        {
+            std::size_t p = std::size_t(y) * width + x;
+            glm::vec3 linear = exposure * glm::vec3(row[x]) / glm::max(row[x].a, 1.0f);
+
+            if(isExr)
+            {
+                reinterpret_cast<glm::vec4*>(texture.data.data())[p] = glm::vec4(linear, 1.0f);
+            }
+            else
+            {
+                glm::vec3 aces = ACESFilm(linear);
+                glm::vec3 graded(sRGB(aces.r), sRGB(aces.g), sRGB(aces.b));
+                glm::u8vec3 texel = glm::u8vec3(glm::round(glm::clamp(graded, 0.0f, 1.0f) * 255.0f));
+
+                texture.data[p * 4 + 0] = texel.r;
+                texture.data[p * 4 + 1] = texel.g;
+                texture.data[p * 4 + 2] = texel.b;
+                texture.data[p * 4 + 3] = 255;
+            }
+        }
+    }
+
+    return texture.save(fileName);
+}
+
+uint64_t GradingTask::inputHash(const GraphicContext& context) const
+{
+    return uint64_t(context.settings.denoiser);
+}
+
+ResourceId GradingTask::inputResource(const GraphicSettings& settings)
+{
+    return settings.denoiser != DenoiserType::None ?
+                ResourceName(DenoisedResult) :
+                ResourceName(PathTracerResult);
+}
+
 }
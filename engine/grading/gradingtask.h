@@ -7,18 +7,38 @@
 namespace unisim
 {
 
+struct Accumulation;
+
 class GradingTask : public GraphicTask
 {
 public:
     GradingTask();
 
     bool defineShaders(GraphicContext& context) override;
-    
+    bool defineResources(GraphicContext& context) override;
+
+    void update(GraphicContext& context) override;
+    bool drawsSwapChain() const override { return true; }
     void render(GraphicContext& context) override;
 
+    // Denoised result when a denoiser is enabled, the path tracer's otherwise
+    void readInput(GraphicContext& context, Accumulation& accumulation) const;
+
+    // Linear exposed image for EXRs, graded 8 bit image for PNGs
+    static bool save(const Accumulation& accumulation, const std::string& fileName);
+
+protected:
+    uint64_t inputHash(const GraphicContext& context) const override;
+
 private:
+    static ResourceId inputResource(const GraphicSettings& settings);
+
     GraphicProgramPtr _colorGradingProgram;
     GpuProgramInterfacePtr _colorGradingGpi;
+    CompiledGpuProgramInterface _colorGradingCompiledGpi;
+    GpuProgramTextureBindPoint _inputBindPoint;
+
+    float _exposure;
 };
 
 }
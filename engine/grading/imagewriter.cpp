@@ -0,0 +1,106 @@
+#include "imagewriter.h"
+
+#include <iostream>
+
+#include "gradingtask.h"
+
+
+namespace unisim
+{
+
+const unsigned int ImageWriter::MAX_PENDING_IMAGES = 4;
+
+
+ImageWriter::ImageWriter(unsigned int threadCount) :
+    _activeJobCount(0),
+    _failed(false),
+    _stopping(false)
+{
+    if(threadCount == 0)
+        threadCount = glm::max(1u, std::thread::hardware_concurrency() / 2);
+
+    for(unsigned int i = 0; i < threadCount; ++i)
+        _workers.emplace_back(&ImageWriter::workerLoop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    finish();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+
+    for(std::thread& worker : _workers)
+        worker.join();
+}
+
+void ImageWriter::write(Accumulation&& accumulation, const std::string& fileName)
+{
+    {
+        // Frames are hundreds of megabytes at high resolutions, bound the memory held by the queue
+        std::unique_lock<std::mutex> lock(_mutex);
+        _workDone.wait(lock, [&]{ return _pendingJobs.size() < MAX_PENDING_IMAGES; });
+
+        _pendingJobs.push_back({std::move(accumulation), fileName});
+    }
+    _workAvailable.notify_one();
+}
+
+bool ImageWriter::finish()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _workDone.wait(lock, [&]{ return _pendingJobs.empty() && _activeJobCount == 0; });
+
+    bool ok = !_failed;
+    _failed = false;
+
+    return ok;
+}
+
+bool ImageWriter::save(const Accumulation& accumulation, const std::string& fileName)
+{
+    if(fileName.find(".acc") != std::string::npos)
+        return accumulation.save(fileName);
+
+    return GradingTask::save(accumulation, fileName);
+}
+
+void ImageWriter::workerLoop()
+{
+    while(true)
+    {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workAvailable.wait(lock, [&]{ return _stopping || !_pendingJobs.empty(); });
+
+            if(_pendingJobs.empty())
+                return;
+
+            job = std::move(_pendingJobs.front());
+            _pendingJobs.pop_front();
+            ++_activeJobCount;
+        }
+        _workDone.notify_all();
+
+        bool ok = save(job.accumulation, job.fileName);
+
+        if(ok)
+            std::cout << "Wrote " << job.fileName << std::endl;
+        else
+            std::cerr << "Could not write " << job.fileName << std::endl;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_activeJobCount;
+            _failed = _failed || !ok;
+        }
+        _workDone.notify_all();
+    }
+}
+
+}
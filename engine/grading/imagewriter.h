@@ -0,0 +1,57 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../pathtracer/accumulation.h"
+
+
+namespace unisim
+{
+
+// Grades and encodes rendered frames on worker threads while the GPU renders the next ones
+class ImageWriter
+{
+public:
+    // Uses half the hardware threads when 'threadCount' is 0
+    ImageWriter(unsigned int threadCount = 0);
+    ~ImageWriter();
+
+    // Blocks while MAX_PENDING_IMAGES are already waiting to be written
+    void write(Accumulation&& accumulation, const std::string& fileName);
+
+    // Waits for every pending image, returns false if any could not be written
+    bool finish();
+
+    // Accumulations are kept as is in .acc files, graded otherwise
+    static bool save(const Accumulation& accumulation, const std::string& fileName);
+
+    static const unsigned int MAX_PENDING_IMAGES;
+
+private:
+    struct Job
+    {
+        Accumulation accumulation;
+        std::string fileName;
+    };
+
+    void workerLoop();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _workDone;
+    std::deque<Job> _pendingJobs;
+    unsigned int _activeJobCount;
+    bool _failed;
+    bool _stopping;
+};
+
+}
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,123 @@
+#include "accumulation.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+namespace unisim
+{
+
+const char ACCUMULATION_MAGIC[8] = {'U', 'N', 'I', 'A', 'C', 'C', '0', '1'};
+
+struct AccumulationHeader
+{
+    char magic[8];
+    int32_t width;
+    int32_t height;
+    float exposure;
+    int32_t pad1;
+};
+
+
+Accumulation::Accumulation() :
+    width(0),
+    height(0),
+    exposure(1.0f)
+{
+}
+
+bool Accumulation::load(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cerr << "Could not open accumulation file: " << fileName << std::endl;
+        return false;
+    }
+
+    AccumulationHeader header;
+    file.read((char*)&header, sizeof(AccumulationHeader));
+
+    if(!file || std::memcmp(header.magic, ACCUMULATION_MAGIC, sizeof(ACCUMULATION_MAGIC)) != 0 ||
+       header.width <= 0 || header.height <= 0)
+    {
+        std::cerr << "Invalid accumulation file: " << fileName << std::endl;
+        return false;
+    }
+
+    width = header.width;
+    height = header.height;
+    exposure = header.exposure;
+
+    std::size_t pixelCount = std::size_t(width) * height;
+    result.resize(pixelCount);
+    moments.resize(pixelCount);
+
+    file.read((char*)result.data(), sizeof(glm::vec4) * pixelCount);
+    file.read((char*)moments.data(), sizeof(glm::vec4) * pixelCount);
+
+    if(!file)
+    {
+        std::cerr << "Truncated accumulation file: " << fileName << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Accumulation::save(const std::string& fileName) const
+{
+    std::ofstream file(fileName, std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cerr << "Could not write accumulation file: " << fileName << std::endl;
+        return false;
+    }
+
+    AccumulationHeader header;
+    std::memcpy(header.magic, ACCUMULATION_MAGIC, sizeof(ACCUMULATION_MAGIC));
+    header.width = width;
+    header.height = height;
+    header.exposure = exposure;
+    header.pad1 = 0;
+
+    file.write((const char*)&header, sizeof(AccumulationHeader));
+    file.write((const char*)result.data(), sizeof(glm::vec4) * result.size());
+    file.write((const char*)moments.data(), sizeof(glm::vec4) * moments.size());
+
+    return file.good();
+}
+
+bool Accumulation::merge(const Accumulation& other)
+{
+    if(result.empty())
+    {
+        *this = other;
+        return true;
+    }
+
+    if(other.width != width || other.height != height)
+    {
+        std::cerr << "Cannot merge a " << other.width << "x" << other.height
+                  << " accumulation into a " << width << "x" << height << " one" << std::endl;
+        return false;
+    }
+
+    if(other.exposure != exposure)
+    {
+        std::cerr << "Cannot merge accumulations rendered with different exposures" << std::endl;
+        return false;
+    }
+
+    // Sums and sample counts add up, pixels keep their own sample count
+    for(std::size_t p = 0; p < result.size(); ++p)
+    {
+        result[p] += other.result[p];
+        moments[p] += other.moments[p];
+    }
+
+    return true;
+}
+
+}
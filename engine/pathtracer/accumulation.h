@@ -0,0 +1,37 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include <string>
+#include <vector>
+
+#include <GLM/glm.hpp>
+
+
+namespace unisim
+{
+
+// Path tracer samples of a frame, written by distributed render workers
+struct Accumulation
+{
+    Accumulation();
+
+    bool load(const std::string& fileName);
+    bool save(const std::string& fileName) const;
+
+    // Both accumulations must have been traced with disjoint sample offsets
+    bool merge(const Accumulation& other);
+
+    int width;
+    int height;
+    float exposure;
+
+    // Rows are stored bottom to top, as on the GPU
+    // Linear color sum and sample count
+    std::vector<glm::vec4> result;
+    // Luminance sum, squared luminance sum and sample count
+    std::vector<glm::vec4> moments;
+};
+
+}
+
+#endif // ACCUMULATION_H
@@ -1,18 +1,26 @@
 #include "pathtracertask.h"
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <random>
 
 #include "../system/profiler.h"
 #include "../system/random.h"
 
+#include "../resource/instance.h"
+#include "../resource/material.h"
+#include "../resource/primitive.h"
+#include "../resource/sky.h"
 #include "../resource/texture.h"
 
 #include "../graphic/graphic.h"
 #include "../graphic/gpudevice.h"
 
 #include "../camera.h"
+#include "../scene.h"
+
+#include "accumulation.h"
 
 
 namespace unisim
@@ -20,9 +28,27 @@ namespace unisim
 
 DefineProfilePoint(PathTracer);
 DefineProfilePointGpu(PathTracer);
+DefineProfilePointGpu(PathTracerTiles);
 
 DefineResource(PathTracerResult);
 DefineResource(PathTracerCommonParams);
+DefineResource(PathTracerMoments);
+DefineResource(PathTracerAlbedo);
+DefineResource(PathTracerNormalDepth);
+DefineResource(PathTracerIds);
+DefineResource(PathTracerDirect);
+DefineResource(PathTracerIndirect);
+DefineResource(PathTracerTiles);
+DefineResource(ConvergenceParams);
+DefineResource(PathTracerTileParams);
+DefineResource(TileDispatchParams);
+DefineResource(PathTracerDispatch);
+DefineResource(PathTracerStats);
+DefineResource(PathTracerHistoryParams);
+DefineResource(HistoryResult);
+DefineResource(HistoryMoments);
+DefineResource(HistoryNormalDepth);
+DefineResource(BlueNoise);
 
 
 struct GpuPathTracerCommonParams
@@ -32,86 +58,112 @@ struct GpuPathTracerCommonParams
     glm::vec4 lenseDirection;
     GLfloat focusDistance;
     GLfloat apertureRadius;
-    GLfloat exposure;
+    GLuint sampleOffset;
 
     GLuint frameIndex;
-    
-    GpuBindlessTextureDescriptor blueNoise[PathTracerTask::BLUE_NOISE_TEX_COUNT];
-    glm::vec4 halton[PathTracerTask::HALTON_SAMPLE_COUNT];
 };
 
+const char BLUE_NOISE_CACHE_MAGIC[8] = {'U', 'N', 'I', 'B', 'N', '6', '4', '1'};
 
-PathTracerTask::PathTracerTask() :
-    PathTracerProviderTask("Path Tracer"),
-    _frameIndex(0),
-    _pathTracerHash(0)
+struct BlueNoiseCacheHeader
 {
-    for(unsigned int i = 0; i < HALTON_SAMPLE_COUNT; ++i)
-    {
-        double* sample = halton(i, 4);
-        _halton[i] = glm::vec4(sample[0], sample[1], sample[2], sample[4]);
-        delete sample;
-    }
-}
+    char magic[8];
+    int32_t size;
+    int32_t layerCount;
+};
 
-void PathTracerTask::registerDynamicResources(GraphicContext& context)
+struct GpuConvergenceParams
 {
-    GpuResourceManager& resources = context.resources;
+    GLfloat errorThreshold;
+    GLuint minSampleCount;
+    GLuint frameIndex;
+    GLuint passIndex;
+};
 
-    for(unsigned int i = 0; i < BLUE_NOISE_TEX_COUNT; ++i)
-    {
-        _blueNoiseTextureResourceIds[i] = resources.registerDynamicResource("Blue Noise Texture " + std::to_string(i));
-        _blueNoiseBindlessResourceIds[i] = resources.registerDynamicResource("Blue Noise Bindless " + std::to_string(i));
-    }
-}
+struct GpuTileDispatchParams
+{
+    GLuint chunkTileCount;
+    GLuint chunkCount;
+};
 
-bool PathTracerTask::defineResources(GraphicContext& context)
+struct GpuPathTracerTileParams
 {
-    bool ok = true;
+    GLuint tileOffset;
+};
 
-    GpuResourceManager& resources = context.resources;
+struct GpuPathTracerStats
+{
+    GLuint pathCount;
+    GLuint segmentCount;
+};
 
-    for(unsigned int i = 0; i < BLUE_NOISE_TEX_COUNT; ++i)
-    {
-        std::string blueNoiseName = "LDR_RGBA_" + std::to_string(i) + ".png";
+struct GpuPathTracerHistoryParams
+{
+    glm::mat4 historyScreenMatrix;
+    glm::vec4 historyLensePosition;
+    GLfloat historyMaxSampleCount;
+    GLuint historyIsValid;
+};
 
-        Texture* texture = nullptr;
-        if(!(texture = Texture::load("textures/bluenoise64/" + blueNoiseName)))
-        {
-            std::cerr << "Cannot load blue noise texture. Did you install the texture pack?" << std::endl;
 
-            texture = new Texture();
-            texture->width = 64;
-            texture->height = 64;
-            texture->format = TextureFormat::R8G8B8A8_UNORM;
-            texture->numComponents = 4;
-            texture->data.resize(64*64*4);
+PathTracerTask::PathTracerTask() :
+    PathTracerProviderTask("Path Tracer"),
+    _frameIndex(0),
+    _pathTracerHash(0),
+    _passStarted(false),
+    _passCompleted(false),
+    _passIsStale(false),
+    _isConverged(false),
+    _tileCount(0),
+    _passTileCount(0),
+    _passTileCountKnown(false),
+    _passChunkTileCount(1),
+    _tileOffset(0),
+    _chunkTileCount(0),
+    _passIndex(0),
+    _validPassIndex(1),
+    _nsPerTile(0),
+    _averagePathLength(0),
+    _aovs(0),
+    _features((1u << (unsigned int)PathTracerFeature::Count) - 1),
+    _programAovs(0),
+    _programFeatures(0),
+    _programReprojection(false),
+    _aovImageMask(0),
+    _cameraHash(0),
+    _historyIsAllocated(false),
+    _historyIsValid(false),
+    _convergenceThreshold(0),
+    _convergenceMinSampleCount(0)
+{
+}
+
+bool PathTracerTask::defineResources(GraphicContext& context)
+{
+    bool ok = true;
 
-            std::seed_seq seed{i};
-            std::mt19937 eng(seed);
-            std::uniform_real_distribution<double> urd(0, 1);
+    GpuResourceManager& resources = context.resources;
 
-            for(unsigned int j = 0; j < 64*64; ++j)
-            {
-                texture->data[j*4] = glm::clamp<unsigned char>(urd(eng) * 255, 0, 255);
-                texture->data[j*4+1] = glm::clamp<unsigned char>(urd(eng) * 255, 0, 255);
-                texture->data[j*4+2] = glm::clamp<unsigned char>(urd(eng) * 255, 0, 255);
-                texture->data[j*4+3] = glm::clamp<unsigned char>(urd(eng) * 255, 0, 255);
-            }
-        }
+    std::vector<unsigned char> blueNoise;
+    loadBlueNoise(blueNoise);
 
-        ok = ok && resources.define<GpuTextureResource>(_blueNoiseTextureResourceIds[i], {*texture});
-        const auto& textureResource = resources.get<GpuTextureResource>(_blueNoiseTextureResourceIds[i]);
-        ok = ok && resources.define<GpuBindlessResource>(_blueNoiseBindlessResourceIds[i], {texture, textureResource});
+    ok = ok && resources.define<GpuImageResource>(
+             ResourceName(BlueNoise), {
+              .width  = BLUE_NOISE_SIZE,
+              .height = BLUE_NOISE_SIZE,
+              .depth  = BLUE_NOISE_TEX_COUNT,
+              .format = TextureFormat::R8G8B8A8_UNORM,
+              .layered = true});
 
-        delete texture;
-    }
+    if(ok)
+        resources.get<GpuImageResource>(ResourceName(BlueNoise)).write(blueNoise.data());
 
     GpuPathTracerCommonParams gpuCommonParams;
 
     _hash = toGpu(
         context,
-        gpuCommonParams);
+        gpuCommonParams,
+        _cameraHash);
 
     ok = ok && resources.define<GpuConstantResource>(
              ResourceName(PathTracerCommonParams), {
@@ -127,50 +179,253 @@ bool PathTracerTask::defineResources(GraphicContext& context)
               .depth  = 1,
               .format = TextureFormat::R32G32B32A32_FLOAT});
 
+    ok = ok && resources.define<GpuImageResource>(
+             ResourceName(PathTracerMoments), {
+              .width  = _viewport->width,
+              .height = _viewport->height,
+              .depth  = 1,
+              .format = TextureFormat::R32G32B32A32_FLOAT});
+
+    // Disabled outputs keep a placeholder image
+    for(int a = 0; a < (int)PathTracerAov::Count; ++a)
+    {
+        PathTracerAov aov = PathTracerAov(a);
+        if(PathTracerInterface::aovImageName(aov))
+            ok = ok && resources.define<GpuImageResource>(aovResource(aov), aovDefinition(aov));
+    }
+
+    _aovImageMask = _programAovs;
+
+    _historyIsAllocated = _programReprojection;
+    ok = ok && resources.define<GpuImageResource>(ResourceName(HistoryResult), historyDefinition());
+    ok = ok && resources.define<GpuImageResource>(ResourceName(HistoryMoments), historyDefinition());
+    ok = ok && resources.define<GpuImageResource>(ResourceName(HistoryNormalDepth), historyDefinition());
+
+    GpuPathTracerHistoryParams historyParams = {glm::mat4(1), glm::vec4(0), 0.0f, 0};
+    ok = ok && resources.define<GpuConstantResource>(
+             ResourceName(PathTracerHistoryParams), {
+              sizeof(GpuPathTracerHistoryParams),
+              &historyParams});
+
+    GpuConvergenceParams convergenceParams = {0.0f, 0, 0, 0};
+    ok = ok && resources.define<GpuConstantResource>(
+             ResourceName(ConvergenceParams), {
+              sizeof(GpuConvergenceParams),
+              &convergenceParams});
+
+    GpuTileDispatchParams dispatchParams = {1, 0};
+    ok = ok && resources.define<GpuConstantResource>(
+             ResourceName(TileDispatchParams), {
+              sizeof(GpuTileDispatchParams),
+              &dispatchParams});
+
+    GpuPathTracerTileParams tileParams = {0};
+    ok = ok && resources.define<GpuConstantResource>(
+             ResourceName(PathTracerTileParams), {
+              sizeof(GpuPathTracerTileParams),
+              &tileParams});
+
+    GpuPathTracerStats stats = {0, 0};
+    ok = ok && resources.define<GpuStorageResource>(
+             ResourceName(PathTracerStats), {
+              sizeof(GpuPathTracerStats), 1, &stats});
+
+    ok = ok && defineTiles(context, false);
+
     return ok;
 }
 
+bool PathTracerTask::defineTiles(GraphicContext& context, bool redefine)
+{
+    _tileCount =
+            ((_viewport->width + TILE_WIDTH - 1) / TILE_WIDTH) *
+            ((_viewport->height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+
+    // Active tile count and its pass index followed by the active tile list
+    std::vector<GLuint> tiles(4 + _tileCount, 0);
+
+    // Indirect dispatch arguments of chunks of at least one tile
+    std::vector<GLuint> dispatchArgs(3 * _tileCount, 0);
+
+    GpuStorageResource::Definition def = {sizeof(GLuint), tiles.size(), tiles.data()};
+    GpuStorageResource::Definition dispatchDef = {3 * sizeof(GLuint), _tileCount, dispatchArgs.data()};
+
+    if(!redefine)
+    {
+        return context.resources.define<GpuStorageResource>(ResourceName(PathTracerTiles), def) &&
+               context.resources.define<GpuStorageResource>(ResourceName(PathTracerDispatch), dispatchDef);
+    }
+
+    context.resources.get<GpuStorageResource>(ResourceName(PathTracerTiles)).update(def);
+    context.resources.get<GpuStorageResource>(ResourceName(PathTracerDispatch)).update(dispatchDef);
+    return true;
+}
+
 bool PathTracerTask::defineShaders(GraphicContext& context)
 {
-    _pathTracerModules.clear();
-    _pathTracerInterface.reset(new PathTracerInterface());
+    // The previous program keeps running until the new one links
+    std::vector<std::shared_ptr<PathTracerModule>> modules;
+    std::shared_ptr<PathTracerInterface> interface(new PathTracerInterface());
 
     for (auto& task : _pathTracerProviders)
     {
-        if (!task->definePathTracerModules(context, _pathTracerModules))
+        if (!task->definePathTracerModules(context, modules))
         {
             PILS_ERROR("Could not define path tracer module for: ", task->name());
             return false;
         }
 
-        if (!task->definePathTracerInterface(context, *_pathTracerInterface))
+        if (!task->definePathTracerInterface(context, *interface))
         {
             PILS_ERROR("Could not define path tracer interface for: ", task->name());
             return false;
         }
     }
 
-    // Remove duplicated modules
-    std::sort( _pathTracerModules.begin(), _pathTracerModules.end() );
-    _pathTracerModules.erase( std::unique( _pathTracerModules.begin(), _pathTracerModules.end() ), _pathTracerModules.end());
+    // Remove duplicated modules, unchanged sources share their compiled shader
+    modules.erase( std::remove( modules.begin(), modules.end(), nullptr ), modules.end());
+    std::sort( modules.begin(), modules.end(), [](const PathTracerModulePtr& a, const PathTracerModulePtr& b){
+        return a->sourceHash() < b->sourceHash(); });
+    modules.erase( std::unique( modules.begin(), modules.end(), [](const PathTracerModulePtr& a, const PathTracerModulePtr& b){
+        return a->sourceHash() == b->sourceHash(); }), modules.end());
 
     // Gather shaders
     std::vector<std::shared_ptr<GraphicShader>> shaders;
-    for (const auto& module : _pathTracerModules)
-        if (module)
-            shaders.push_back(module->shader());
+    for (const auto& module : modules)
+        shaders.push_back(module->shader());
+
+    // Generate program, only modules whose source changed get compiled.
+    // Switching back to a feature set loads its program from the program binary cache.
+    GraphicProgramPtr program;
+    if(!generateComputeProgram(program, "Path Tracer", {shaders}))
+        return false;
+
+    CompiledGpuProgramInterface compiledGpi;
+    if(!interface->compile(compiledGpi, *program))
+        return false;
+
+    // Samples of the previous program are not accumulated with the new one's
+    if(program != _pathTracerProgram)
+        _pathTracerHash = 0;
+
+    _pathTracerProgram = program;
+
+    _pathTracerModules.swap(modules);
+    _pathTracerInterface = interface;
+    _pathTracerCompiledGpi = std::move(compiledGpi);
+    _programAovs = _aovs;
+    _programFeatures = _features;
+    _programReprojection = context.settings.reprojection;
+
+    _convergenceGpi.reset(new GpuProgramInterface());
+    _convergenceGpi->declareConstant({"ConvergenceParams", ResourceName(ConvergenceParams)});
+    _convergenceGpi->declareImage({"moments", ResourceName(PathTracerMoments), GpuResourceAccess::ReadOnly});
+    _convergenceGpi->declareStorage({"PathTracerTiles", ResourceName(PathTracerTiles)});
+
+    if(!generateComputeProgram(_convergenceProgram, "Convergence", "shaders/convergence.glsl"))
+        return false;
+
+    if(!_convergenceGpi->compile(_convergenceCompiledGpi, *_convergenceProgram))
+        return false;
+
+    _tileDispatchGpi.reset(new GpuProgramInterface());
+    _tileDispatchGpi->declareConstant({"TileDispatchParams", ResourceName(TileDispatchParams)});
+    _tileDispatchGpi->declareStorage({"PathTracerTiles", ResourceName(PathTracerTiles), GpuResourceAccess::ReadOnly});
+    _tileDispatchGpi->declareStorage({"PathTracerDispatch", ResourceName(PathTracerDispatch)});
+
+    if(!generateComputeProgram(_tileDispatchProgram, "Tile Dispatch", "shaders/tiledispatch.glsl"))
+        return false;
 
-    // Generate program
-    _pathTracerProgram.reset();
-    if(!generateComputeProgram(_pathTracerProgram, "Path Tracer", {shaders}))
+    if(!_tileDispatchGpi->compile(_tileDispatchCompiledGpi, *_tileDispatchProgram))
         return false;
 
     return true;
 }
 
+PathTracerFeatureMask PathTracerTask::sceneFeatures(const Scene& scene)
+{
+    PathTracerFeatureMask features = 0;
+
+    for(const auto& instance : scene.instances())
+    {
+        for(const auto& primitive : instance->primitives())
+        {
+            switch(primitive->type())
+            {
+            case Primitive::Mesh :
+                features |= featureMask(PathTracerFeature::Meshes);
+                break;
+            case Primitive::Sphere :
+                features |= featureMask(PathTracerFeature::Spheres);
+                break;
+            case Primitive::Plane :
+                features |= featureMask(PathTracerFeature::Planes);
+                break;
+            default:
+                break;
+            }
+
+            // Must match LightTask's emitter test
+            if(glm::any(glm::greaterThan(primitive->material()->defaultEmissionColor(), glm::vec3())))
+                features |= featureMask(PathTracerFeature::Emitters);
+        }
+    }
+
+    if(scene.sky()->atmosphere())
+        features |= featureMask(PathTracerFeature::DirectionalLights);
+
+    return features;
+}
+
+std::vector<std::string> PathTracerTask::featureDefines(PathTracerFeatureMask features)
+{
+    const char* defines[] = {
+        "HAS_MESHES",
+        "HAS_SPHERES",
+        "HAS_PLANES",
+        "HAS_EMITTERS",
+        "HAS_DIRECTIONAL_LIGHTS"};
+    static_assert(sizeof(defines) / sizeof(defines[0]) == (int)PathTracerFeature::Count, "Missing feature defines");
+
+    std::vector<std::string> featureDefines;
+    int primitiveTypeCount = 0;
+    for(int f = 0; f < (int)PathTracerFeature::Count; ++f)
+    {
+        if(features & featureMask(PathTracerFeature(f)))
+        {
+            featureDefines.push_back(defines[f]);
+
+            if(f <= (int)PathTracerFeature::Planes)
+                ++primitiveTypeCount;
+        }
+    }
+
+    // Intersection loops skip the primitive type test
+    if(primitiveTypeCount == 1)
+        featureDefines.push_back("SINGLE_PRIMITIVE_TYPE");
+
+    return featureDefines;
+}
+
+PathTracerAovMask PathTracerTask::pathTracerAovs(const GraphicSettings& settings) const
+{
+    // Reprojection validates history with first hit normals and depths
+    if(settings.reprojection)
+        return aovMask(PathTracerAov::NormalDepth);
+
+    return 0;
+}
+
 bool PathTracerTask::definePathTracerModules(GraphicContext& context, std::vector<std::shared_ptr<PathTracerModule>>& modules)
 {
-    if(!addPathTracerModule(modules, "Path Trace", context.settings, "shaders/pathtrace.glsl"))
+    std::vector<std::string> defines = PathTracerInterface::aovDefines(_aovs);
+
+    std::vector<std::string> features = featureDefines(_features);
+    defines.insert(defines.end(), features.begin(), features.end());
+    if(context.settings.reprojection)
+        defines.push_back("REPROJECTION");
+
+    if(!addPathTracerModule(modules, "Path Trace", context.settings, "shaders/pathtrace.glsl", defines))
         return false;
 
     if(!addPathTracerModule(modules, "Utils", context.settings, "shaders/common/utils.glsl"))
@@ -183,23 +438,27 @@ bool PathTracerTask::definePathTracerInterface(GraphicContext& context, PathTrac
 {
     bool ok = true;
 
-    ok = ok && interface.declareConstant({"PathTracerCommonParams"});
-    ok = ok && interface.declareImage({"result"});
+    ok = ok && interface.declareConstant({"PathTracerCommonParams", ResourceName(PathTracerCommonParams)});
+    ok = ok && interface.declareImage({"result", ResourceName(PathTracerResult)});
+    ok = ok && interface.declareImage({"moments", ResourceName(PathTracerMoments)});
+    ok = ok && interface.declareTexture({"blueNoise", ResourceName(BlueNoise)});
+    ok = ok && interface.declareStorage({"PathTracerTiles", ResourceName(PathTracerTiles), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareConstant({"PathTracerTileParams", ResourceName(PathTracerTileParams)});
+    ok = ok && interface.declareStorage({"PathTracerStats", ResourceName(PathTracerStats)});
 
-    return ok;
-}
+    for(int a = 0; a < (int)PathTracerAov::Count; ++a)
+        if(_aovs & aovMask(PathTracerAov(a)))
+            ok = ok && interface.declareAov(PathTracerAov(a), aovResource(PathTracerAov(a)));
 
-void PathTracerTask::bindPathTracerResources(
-    GraphicContext &context,
-    CompiledGpuProgramInterface& compiledGpi) const
-{
-    GpuResourceManager& resources = context.resources;
-
-    context.device.bindBuffer(resources.get<GpuConstantResource>(ResourceName(PathTracerCommonParams)),
-                              compiledGpi.getConstantBindPoint("PathTracerCommonParams"));
+    if(context.settings.reprojection)
+    {
+        ok = ok && interface.declareConstant({"PathTracerHistoryParams", ResourceName(PathTracerHistoryParams)});
+        ok = ok && interface.declareTexture({"historyResult", ResourceName(HistoryResult)});
+        ok = ok && interface.declareTexture({"historyMoments", ResourceName(HistoryMoments)});
+        ok = ok && interface.declareTexture({"historyNormalDepth", ResourceName(HistoryNormalDepth)});
+    }
 
-    context.device.bindImage(resources.get<GpuImageResource>(ResourceName(PathTracerResult)),
-                             compiledGpi.getImageBindPoint("result"));
+    return ok;
 }
 
 void PathTracerTask::update(GraphicContext& context)
@@ -210,7 +469,9 @@ void PathTracerTask::update(GraphicContext& context)
     const Viewport& viewport = camera.viewport();
     GpuResourceManager& resources = context.resources;
 
-    if(*_viewport != viewport)
+    bool viewportChanged = *_viewport != viewport;
+
+    if(viewportChanged)
     {
         *_viewport = viewport;
         resources.update<GpuImageResource>(
@@ -219,14 +480,48 @@ void PathTracerTask::update(GraphicContext& context)
                         .height = viewport.height,
                         .depth  = 1,
                         .format = TextureFormat::R32G32B32A32_FLOAT});
+        resources.update<GpuImageResource>(
+                    ResourceName(PathTracerMoments), {
+                        .width  = viewport.width,
+                        .height = viewport.height,
+                        .depth  = 1,
+                        .format = TextureFormat::R32G32B32A32_FLOAT});
+        defineTiles(context, true);
+
+        _passStarted = false;
+    }
+
+    // Resize outputs that were toggled or follow the viewport
+    for(int a = 0; a < (int)PathTracerAov::Count; ++a)
+    {
+        PathTracerAov aov = PathTracerAov(a);
+        bool toggled = (_aovImageMask ^ _programAovs) & aovMask(aov);
+        bool resized = viewportChanged && (_programAovs & aovMask(aov));
+
+        if(PathTracerInterface::aovImageName(aov) && (toggled || resized))
+            resources.update<GpuImageResource>(aovResource(aov), aovDefinition(aov));
+    }
+
+    _aovImageMask = _programAovs;
+
+    // History follows the viewport, its content is lost on resize
+    if(_historyIsAllocated != _programReprojection || (viewportChanged && _historyIsAllocated))
+    {
+        _historyIsAllocated = _programReprojection;
+        resources.update<GpuImageResource>(ResourceName(HistoryResult), historyDefinition());
+        resources.update<GpuImageResource>(ResourceName(HistoryMoments), historyDefinition());
+        resources.update<GpuImageResource>(ResourceName(HistoryNormalDepth), historyDefinition());
+        _historyIsValid = false;
     }
 
     GpuPathTracerCommonParams gpuCommonParams;
 
     // Provier hash
+    uint64_t cameraHash = 0;
     uint64_t hash = toGpu(
         context,
-        gpuCommonParams);
+        gpuCommonParams,
+        cameraHash);
 
     if(_hash != hash)
     {
@@ -238,16 +533,146 @@ void PathTracerTask::update(GraphicContext& context)
     for(const auto& provider : _pathTracerProviders)
         pathTracerHash = PathTracerProviderTask::combineHashes(pathTracerHash, provider->hash());
 
-    if(_pathTracerHash != pathTracerHash)
+    bool convergenceChanged =
+            _convergenceThreshold != context.settings.convergenceThreshold ||
+            _convergenceMinSampleCount != context.settings.convergenceMinSampleCount;
+    _convergenceThreshold = context.settings.convergenceThreshold;
+    _convergenceMinSampleCount = context.settings.convergenceMinSampleCount;
+
+    // Providers' changes only affecting some pixels
+    bool hasDirtyRegions = false;
+    for(const auto& provider : _pathTracerProviders)
+        hasDirtyRegions = hasDirtyRegions || !provider->dirtyRegions().empty();
+
+    // Pixels stop receiving samples once the frame count is maxed out
+    bool regionalRestart = context.settings.regionalRestart && _frameIndex < MAX_FRAME_COUNT;
+
+    bool sceneChanged = _pathTracerHash != pathTracerHash || (hasDirtyRegions && !regionalRestart);
+
+    if(sceneChanged && _passStarted && _frameIndex == 0)
+    {
+        // Finish a first pass in flight so that every tile gets traced even if
+        // the scene keeps changing, then start over with another first pass
+        _pathTracerHash = pathTracerHash;
+        _passIsStale = true;
+        _isConverged = false;
+
+        _cameraHash = cameraHash;
+        _historyIsValid = false;
+    }
+    else if(sceneChanged || viewportChanged)
     {
+        // Restart from scratch, even in the middle of a pass
         _frameIndex = 0;
         _pathTracerHash = pathTracerHash;
+        _passStarted = false;
+        _passCompleted = false;
+        _passIsStale = false;
+        _isConverged = false;
+        _validPassIndex = _passIndex + 1;
+
+        _cameraHash = cameraHash;
+        _historyIsValid = false;
     }
-    else
+    else if(_cameraHash != cameraHash && _passStarted && _frameIndex == 0)
+    {
+        // The rest of the first pass in flight is reprojected from the same history,
+        // so that every tile is reprojected even if the camera keeps moving
+        _passIsStale = true;
+        _isConverged = false;
+
+        _cameraHash = cameraHash;
+    }
+    else if(_cameraHash != cameraHash)
+    {
+        // Keep the current history if the accumulation was restarted before a first pass
+        // completed with a single camera, or if its guides are still a placeholder
+        bool hasGuides = _aovImageMask & aovMask(PathTracerAov::NormalDepth);
+        if(!hasGuides)
+        {
+            _historyIsValid = false;
+        }
+        else if(_frameIndex > 0 || (_passCompleted && !_passIsStale))
+        {
+            resources.get<GpuImageResource>(ResourceName(HistoryResult)).copy(
+                        resources.get<GpuImageResource>(ResourceName(PathTracerResult)));
+            resources.get<GpuImageResource>(ResourceName(HistoryMoments)).copy(
+                        resources.get<GpuImageResource>(ResourceName(PathTracerMoments)));
+            resources.get<GpuImageResource>(ResourceName(HistoryNormalDepth)).copy(
+                        resources.get<GpuImageResource>(aovResource(PathTracerAov::NormalDepth)));
+
+            _historyScreenMatrix = _accumulationScreenMatrix;
+            _historyLensePosition = _accumulationLensePosition;
+            _historyIsValid = true;
+        }
+
+        // Reprojected while tracing the first pass
+        _frameIndex = 0;
+        _passStarted = false;
+        _passCompleted = false;
+        _passIsStale = false;
+        _isConverged = false;
+        _validPassIndex = _passIndex + 1;
+
+        _cameraHash = cameraHash;
+    }
+    else if(_passCompleted && _passIsStale)
+    {
+        _passCompleted = false;
+        _passIsStale = false;
+    }
+    else if(_passCompleted)
     {
         ++_frameIndex;
+        _passCompleted = false;
+    }
+
+    if(convergenceChanged)
+    {
+        _isConverged = false;
+        _validPassIndex = _passIndex + 1;
+    }
+
+    // Reprojected history is validated against the new geometry,
+    // edited materials fade out with the history clamp
+    if(hasDirtyRegions && regionalRestart)
+    {
+        const GpuImageResource& result = resources.get<GpuImageResource>(ResourceName(PathTracerResult));
+        const GpuImageResource& moments = resources.get<GpuImageResource>(ResourceName(PathTracerMoments));
+
+        for(const auto& provider : _pathTracerProviders)
+        {
+            for(const PathTracerDirtyRegion& region : provider->dirtyRegions())
+            {
+                glm::ivec4 bounds;
+                if(!camera.projectedBounds(region.center, region.radius, bounds))
+                    continue;
+
+                result.clear(bounds.x, bounds.y, bounds.z - bounds.x, bounds.w - bounds.y);
+                moments.clear(bounds.x, bounds.y, bounds.z - bounds.x, bounds.w - bounds.y);
+                _isConverged = false;
+                _validPassIndex = _passIndex + 1;
+            }
+        }
     }
 
+    if(_frameIndex == 0)
+    {
+        _accumulationScreenMatrix = glm::inverse(gpuCommonParams.rayMatrix);
+        _accumulationLensePosition = gpuCommonParams.lensePosition;
+    }
+
+    GpuPathTracerHistoryParams historyParams = {
+        _historyScreenMatrix,
+        _historyLensePosition,
+        context.settings.reprojectionMaxSampleCount,
+        _historyIsValid};
+
+    resources.get<GpuConstantResource>(
+                ResourceName(PathTracerHistoryParams)).update({
+                    sizeof(GpuPathTracerHistoryParams),
+                    &historyParams});
+
     gpuCommonParams.frameIndex = _frameIndex;
 
     resources.get<GpuConstantResource>(
@@ -263,25 +688,283 @@ void PathTracerTask::render(GraphicContext& context)
     if(!_pathTracerProgram->isValid())
         return;
 
-    CompiledGpuProgramInterface compiledGpi;
-    if(!_pathTracerInterface->compile(compiledGpi, *_pathTracerProgram))
-        return;
-    
     GpuResourceManager& resources = context.resources;
 
-    const auto& pathTracerResult = resources.get<GpuImageResource>(ResourceName(PathTracerResult));
+    if(!_convergenceProgram->isValid() || !_tileDispatchProgram->isValid())
+        return;
+
+    const auto& tiles = resources.get<GpuStorageResource>(ResourceName(PathTracerTiles));
+
+    // Timing of the previous frame's tiles
+    unsigned int prevChunkTileCount = _chunkTileCount;
+    _chunkTileCount = 0;
+
+    float chunkNs = Profiler::GetInstance().getGpuPointNs(PID_GPU(PathTracerTiles));
+    if(chunkNs > 0 && prevChunkTileCount > 0)
+    {
+        float nsPerTile = chunkNs / prevChunkTileCount;
+        _nsPerTile = _nsPerTile > 0 ? glm::mix(_nsPerTile, nsPerTile, 0.25f) : nsPerTile;
+    }
+
+    // Path length of the latest traced chunk the GPU is done with, kept while copies are in flight
+    const auto& stats = resources.get<GpuStorageResource>(ResourceName(PathTracerStats));
+    GpuPathTracerStats gpuStats;
+    if(stats.fetchRead(&gpuStats, sizeof(GpuPathTracerStats)) && gpuStats.pathCount > 0)
+        _averagePathLength = float(gpuStats.segmentCount) / gpuStats.pathCount;
 
-    if(_frameIndex < MAX_FRAME_COUNT)
+    // Active tile count of a previous pass, never waited on
+    GLuint tileCount[2];
+    if(tiles.fetchRead(tileCount, sizeof(tileCount)) && tileCount[1] >= _validPassIndex && !_passTileCountKnown)
     {
+        _passTileCount = tileCount[0];
+        _passTileCountKnown = tileCount[1] == _passIndex;
+
+        // Nothing was traced since the count was taken
+        if(_passTileCount == 0)
+        {
+            _isConverged = true;
+            _passStarted = false;
+        }
+        else if(_passStarted && _tileOffset >= _passTileCount)
+        {
+            _passStarted = false;
+            _passCompleted = true;
+            return;
+        }
+    }
+
+    if(_frameIndex >= MAX_FRAME_COUNT || _isConverged)
+        return;
+
+    if(!_passStarted)
+    {
+        ++_passIndex;
+
+        GpuConvergenceParams convergenceParams;
+        convergenceParams.errorThreshold = context.settings.convergenceThreshold;
+        convergenceParams.minSampleCount = context.settings.convergenceMinSampleCount;
+        convergenceParams.frameIndex = _frameIndex;
+        convergenceParams.passIndex = _passIndex;
+
+        resources.get<GpuConstantResource>(
+                    ResourceName(ConvergenceParams)).update({
+                        sizeof(GpuConvergenceParams),
+                        &convergenceParams});
+
+        // Gather tiles that still need samples
+        {
+            GraphicProgramScope programScope(*_convergenceProgram);
+
+            tiles.clear(0, sizeof(GLuint));
+
+            _convergenceCompiledGpi.bind(context.device, resources);
+
+            context.device.dispatch((_viewport->width + TILE_WIDTH - 1) / TILE_WIDTH,
+                                    (_viewport->height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+        }
+
+        _passChunkTileCount = INITIAL_TILE_BUDGET;
+        if(_nsPerTile > 0)
+            _passChunkTileCount = glm::max(1u, (unsigned int)(context.settings.pathTracerBudgetMs * 1e6f / _nsPerTile));
+
+        // Chunks are dispatched as a single row of work groups
+        _passChunkTileCount = glm::min(_passChunkTileCount, MAX_CHUNK_TILE_COUNT);
+
+        unsigned int chunkCount = (_tileCount + _passChunkTileCount - 1) / _passChunkTileCount;
+
+        GpuTileDispatchParams dispatchParams = {_passChunkTileCount, chunkCount};
+        resources.get<GpuConstantResource>(
+                    ResourceName(TileDispatchParams)).update({
+                        sizeof(GpuTileDispatchParams),
+                        &dispatchParams});
+
+        // Splits the active tiles into chunks of the pass' budget
+        {
+            GraphicProgramScope programScope(*_tileDispatchProgram);
+
+            _tileDispatchCompiledGpi.bind(context.device, resources);
+
+            context.device.dispatch((chunkCount + 63) / 64);
+        }
+
+        // Every tile is active on a first pass, later passes last as long
+        // as the previous one until their own count is read back
+        tiles.requestRead(sizeof(tileCount));
+
+        if(_frameIndex == 0)
+            _passTileCount = _tileCount;
+
+        _passTileCountKnown = _frameIndex == 0;
+        _tileOffset = 0;
+        _passStarted = true;
+    }
+
+    // Actual tile count is only known to the GPU, chunks past it are empty
+    _chunkTileCount = glm::min(_passChunkTileCount, _passTileCount - _tileOffset);
+
+    GpuPathTracerTileParams tileParams = {_tileOffset};
+    resources.get<GpuConstantResource>(
+                ResourceName(PathTracerTileParams)).update({
+                    sizeof(GpuPathTracerTileParams),
+                    &tileParams});
+
+    stats.clear(0, sizeof(GpuPathTracerStats));
+
+    {
+        ProfileGpu(PathTracerTiles);
+
         GraphicProgramScope programScope(*_pathTracerProgram);
 
-        for(const auto& provider : _pathTracerProviders)
-            provider->bindPathTracerResources(context, compiledGpi);
+        _pathTracerCompiledGpi.bind(context.device, resources);
 
-        context.device.dispatch((_viewport->width + 7) / 8, (_viewport->height + 3) / 4);
+        const auto& dispatchArgs = resources.get<GpuStorageResource>(ResourceName(PathTracerDispatch));
+        context.device.dispatchIndirect(dispatchArgs, (_tileOffset / _passChunkTileCount) * 3 * sizeof(GLuint));
+    }
+
+    // Skipped while every copy slot is in flight
+    stats.requestRead(sizeof(GpuPathTracerStats));
+
+    _tileOffset += _chunkTileCount;
+
+    if(_tileOffset >= _passTileCount)
+    {
+        _passStarted = false;
+        _passCompleted = true;
     }
 }
 
+ResourceId PathTracerTask::aovResource(PathTracerAov aov)
+{
+    switch(aov)
+    {
+    case PathTracerAov::Albedo:
+        return ResourceName(PathTracerAlbedo);
+    case PathTracerAov::NormalDepth:
+        return ResourceName(PathTracerNormalDepth);
+    case PathTracerAov::Ids:
+        return ResourceName(PathTracerIds);
+    case PathTracerAov::Direct:
+        return ResourceName(PathTracerDirect);
+    case PathTracerAov::Indirect:
+        return ResourceName(PathTracerIndirect);
+    case PathTracerAov::SampleCount:
+        return ResourceName(PathTracerMoments);
+    default:
+        return ResourceName(PathTracerResult);
+    }
+}
+
+GpuImageResource::Definition PathTracerTask::aovDefinition(PathTracerAov aov) const
+{
+    bool enabled = _programAovs & aovMask(aov);
+
+    return {
+        .width  = enabled ? _viewport->width : 1,
+        .height = enabled ? _viewport->height : 1,
+        .depth  = 1,
+        .format = TextureFormat::R32G32B32A32_FLOAT};
+}
+
+void PathTracerTask::readAccumulation(GraphicContext& context, Accumulation& accumulation) const
+{
+    GpuResourceManager& resources = context.resources;
+
+    accumulation.width = _viewport->width;
+    accumulation.height = _viewport->height;
+    accumulation.exposure = context.camera.exposure();
+
+    std::size_t pixelCount = std::size_t(accumulation.width) * accumulation.height;
+    accumulation.result.resize(pixelCount);
+    accumulation.moments.resize(pixelCount);
+
+    resources.get<GpuImageResource>(ResourceName(PathTracerResult)).read(accumulation.result.data());
+    resources.get<GpuImageResource>(ResourceName(PathTracerMoments)).read(accumulation.moments.data());
+}
+
+void PathTracerTask::loadBlueNoise(std::vector<unsigned char>& texels)
+{
+    const std::string cacheFileName = "textures/bluenoise64/LDR_RGBA_array.bin";
+
+    std::size_t layerSize = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE * 4;
+    texels.resize(layerSize * BLUE_NOISE_TEX_COUNT);
+
+    std::ifstream cacheFile(cacheFileName, std::ios::binary);
+    if(cacheFile.is_open())
+    {
+        BlueNoiseCacheHeader header;
+        cacheFile.read((char*)&header, sizeof(BlueNoiseCacheHeader));
+
+        if(cacheFile && std::memcmp(header.magic, BLUE_NOISE_CACHE_MAGIC, sizeof(BLUE_NOISE_CACHE_MAGIC)) == 0 &&
+           header.size == BLUE_NOISE_SIZE && header.layerCount == BLUE_NOISE_TEX_COUNT)
+        {
+            cacheFile.read((char*)texels.data(), texels.size());
+
+            if(cacheFile)
+                return;
+        }
+
+        std::cerr << "Ignoring invalid blue noise cache: " << cacheFileName << std::endl;
+    }
+
+    bool isComplete = true;
+
+    for(unsigned int i = 0; i < BLUE_NOISE_TEX_COUNT; ++i)
+    {
+        unsigned char* layer = &texels[layerSize * i];
+
+        std::string blueNoiseName = "LDR_RGBA_" + std::to_string(i) + ".png";
+        std::unique_ptr<Texture> texture(Texture::load("textures/bluenoise64/" + blueNoiseName));
+
+        if(texture && texture->width == BLUE_NOISE_SIZE && texture->height == BLUE_NOISE_SIZE &&
+           texture->numComponents == 4 && texture->data.size() == layerSize)
+        {
+            std::memcpy(layer, texture->data.data(), layerSize);
+            continue;
+        }
+
+        if(isComplete)
+            std::cerr << "Cannot load blue noise texture. Did you install the texture pack?" << std::endl;
+
+        isComplete = false;
+
+        // Layer 'i' holds sample 'i' of each texel's scrambled Sobol sequence
+        for(int j = 0; j < BLUE_NOISE_SIZE * BLUE_NOISE_SIZE; ++j)
+        {
+            glm::vec4 sample = sobolOwen(i, hashUint(j));
+            layer[j*4] = (unsigned char)(sample.x * 256);
+            layer[j*4+1] = (unsigned char)(sample.y * 256);
+            layer[j*4+2] = (unsigned char)(sample.z * 256);
+            layer[j*4+3] = (unsigned char)(sample.w * 256);
+        }
+    }
+
+    // Fallback noise is not cached, installing the texture pack later must take effect
+    if(!isComplete)
+        return;
+
+    std::ofstream cache(cacheFileName, std::ios::binary);
+
+    BlueNoiseCacheHeader header;
+    std::memcpy(header.magic, BLUE_NOISE_CACHE_MAGIC, sizeof(BLUE_NOISE_CACHE_MAGIC));
+    header.size = BLUE_NOISE_SIZE;
+    header.layerCount = BLUE_NOISE_TEX_COUNT;
+
+    cache.write((const char*)&header, sizeof(BlueNoiseCacheHeader));
+    cache.write((const char*)texels.data(), texels.size());
+
+    if(!cache)
+        std::cerr << "Could not write blue noise cache: " << cacheFileName << std::endl;
+}
+
+GpuImageResource::Definition PathTracerTask::historyDefinition() const
+{
+    return {
+        .width  = _historyIsAllocated ? _viewport->width : 1,
+        .height = _historyIsAllocated ? _viewport->height : 1,
+        .depth  = 1,
+        .format = TextureFormat::R32G32B32A32_FLOAT};
+}
+
 void PathTracerTask::setPathTracerTasks(const std::vector<PathTracerProviderTaskPtr>& tasks)
 {
     _pathTracerProviders = tasks;
@@ -289,10 +972,9 @@ void PathTracerTask::setPathTracerTasks(const std::vector<PathTracerProviderTask
 
 uint64_t PathTracerTask::toGpu(
     GraphicContext& context,
-    GpuPathTracerCommonParams& gpuParams)
+    GpuPathTracerCommonParams& gpuParams,
+    uint64_t& cameraHash)
 {
-    GpuResourceManager& resources = context.resources;
-
     const Camera& camera = context.camera;
 
     glm::mat4 view(glm::mat3(camera.view()));
@@ -305,16 +987,28 @@ uint64_t PathTracerTask::toGpu(
     gpuParams.lenseDirection = glm::vec4(camera.direction(), 0);
     gpuParams.focusDistance = camera.focusDistance();
     gpuParams.apertureRadius = camera.dofEnabled() ? camera.focalLength() / camera.fstop() * 0.5f : 0.0f;
-    gpuParams.exposure = camera.exposure();
+    gpuParams.sampleOffset = context.settings.sampleOffset;
     gpuParams.frameIndex = 0; // Must be constant for hasing
 
-    for(unsigned int i = 0; i < BLUE_NOISE_TEX_COUNT; ++i)
-        gpuParams.blueNoise[i] = resources.get<GpuBindlessResource>(_blueNoiseBindlessResourceIds[i]).handle();
-    for(unsigned int i = 0; i < HALTON_SAMPLE_COUNT; ++i)
-        gpuParams.halton[i] = _halton[i];
+    // Camera placement, reprojected rather than restarted when enabled
+    cameraHash = 0;
+    cameraHash = hashVal(gpuParams.rayMatrix, cameraHash);
+    cameraHash = hashVal(gpuParams.lensePosition, cameraHash);
+    cameraHash = hashVal(gpuParams.lenseDirection, cameraHash);
 
     uint64_t hash = 0;
-    hash = hashVal(gpuParams, hash);
+    hash = hashVal(gpuParams.focusDistance, hash);
+    hash = hashVal(gpuParams.apertureRadius, hash);
+    hash = hashVal(gpuParams.sampleOffset, hash);
+    hash = hashVal(context.settings.sampler, hash);
+    hash = hashVal(context.settings.unbiased, hash);
+    hash = hashVal(context.settings.pathLength, hash);
+    hash = hashVal(context.settings.russianRouletteDepth, hash);
+    hash = hashVal(_programAovs, hash);
+    hash = hashVal(_programReprojection, hash);
+
+    if(!_programReprojection)
+        hash = combineHashes(hash, cameraHash);
 
     return hash;
 }
@@ -12,6 +12,10 @@ namespace unisim
 {
 
 struct Viewport;
+struct Accumulation;
+
+
+class Scene;
 
 
 class PathTracerTask : public PathTracerProviderTask
@@ -19,7 +23,7 @@ class PathTracerTask : public PathTracerProviderTask
 public:
     PathTracerTask();
     
-    void registerDynamicResources(GraphicContext& context) override;
+    PathTracerAovMask pathTracerAovs(const GraphicSettings& settings) const override;
     bool defineResources(GraphicContext& context) override;
     bool defineShaders(GraphicContext& context) override;
 
@@ -29,33 +33,116 @@ public:
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
     
     void update(GraphicContext& context) override;
     void render(GraphicContext& context) override;
     
     void setPathTracerTasks(const std::vector<PathTracerProviderTaskPtr>& tasks);
 
+    // Average segment count of the paths of a recent frame, read back a few frames late
+    float averagePathLength() const { return _averagePathLength; }
+
+    // Samples received by every pixel, converged pixels stop before
+    unsigned int sampleCount() const { return _frameIndex + (_passCompleted ? 1 : 0); }
+    bool isConverged() const { return _isConverged; }
+    // Traces nothing until the scene or camera changes
+    bool isIdle() const { return _isConverged || _frameIndex >= MAX_FRAME_COUNT; }
+
+    // Reads back the sums for distributed renders
+    void readAccumulation(GraphicContext& context, Accumulation& accumulation) const;
+
+    // Outputs compiled in on the next shader definition, aovs() are those of the running program
+    void setAovs(PathTracerAovMask aovs) { _aovs = aovs; }
+    PathTracerAovMask aovs() const { return _programAovs; }
+
+    // Scene features compiled in on the next shader definition, features() are those of the running program
+    void setFeatures(PathTracerFeatureMask features) { _features = features; }
+    PathTracerFeatureMask features() const { return _programFeatures; }
+
+    static PathTracerFeatureMask sceneFeatures(const Scene& scene);
+    static std::vector<std::string> featureDefines(PathTracerFeatureMask features);
+
+    // Image holding the output
+    static ResourceId aovResource(PathTracerAov aov);
+
+    // Layers of the blue noise array
     static const unsigned int BLUE_NOISE_TEX_COUNT = 64;
-    static const unsigned int HALTON_SAMPLE_COUNT = 64;
+    static const int BLUE_NOISE_SIZE = 64;
     static const unsigned int MAX_FRAME_COUNT = 4096;
 
+    // Must match the path tracer's work group size
+    static const unsigned int TILE_WIDTH = 8;
+    static const unsigned int TILE_HEIGHT = 4;
+
+    // Tiles dispatched per frame until the GPU cost of a tile is known
+    static const unsigned int INITIAL_TILE_BUDGET = 1024;
+    static const unsigned int MAX_CHUNK_TILE_COUNT = 65535;
+
 private:
     uint64_t toGpu(GraphicContext& context,
-        struct GpuPathTracerCommonParams& gpuParams);
+        struct GpuPathTracerCommonParams& gpuParams,
+        uint64_t& cameraHash);
 
-    ResourceId _blueNoiseTextureResourceIds[BLUE_NOISE_TEX_COUNT];
-    ResourceId _blueNoiseBindlessResourceIds[BLUE_NOISE_TEX_COUNT];
+    bool defineTiles(GraphicContext& context, bool redefine);
 
-    glm::vec4 _halton[HALTON_SAMPLE_COUNT];
+    GpuImageResource::Definition aovDefinition(PathTracerAov aov) const;
+    GpuImageResource::Definition historyDefinition() const;
+
+    // Packed layers, read from a cache file written on the first load of the texture pack
+    static void loadBlueNoise(std::vector<unsigned char>& texels);
 
     GraphicProgramPtr _pathTracerProgram;
+    CompiledGpuProgramInterface _pathTracerCompiledGpi;
+
+    GraphicProgramPtr _convergenceProgram;
+    GpuProgramInterfacePtr _convergenceGpi;
+    CompiledGpuProgramInterface _convergenceCompiledGpi;
 
+    GraphicProgramPtr _tileDispatchProgram;
+    GpuProgramInterfacePtr _tileDispatchGpi;
+    CompiledGpuProgramInterface _tileDispatchCompiledGpi;
+
+    // Index of the pass over all active tiles, a pass can span several frames
     unsigned int _frameIndex;
     uint64_t _pathTracerHash;
 
+    bool _passStarted;
+    bool _passCompleted;
+    bool _passIsStale;
+    bool _isConverged;
+    unsigned int _tileCount;
+    unsigned int _passTileCount;
+    bool _passTileCountKnown;
+    unsigned int _passChunkTileCount;
+    unsigned int _tileOffset;
+    unsigned int _chunkTileCount;
+
+    // Active tile counts read back from passes before '_validPassIndex' are ignored
+    unsigned int _passIndex;
+    unsigned int _validPassIndex;
+    float _nsPerTile;
+    float _averagePathLength;
+
+    // Outputs, scene features and reprojection of the running program, new ones may still be compiling
+    PathTracerAovMask _aovs;
+    PathTracerFeatureMask _features;
+    PathTracerAovMask _programAovs;
+    PathTracerFeatureMask _programFeatures;
+    bool _programReprojection;
+    PathTracerAovMask _aovImageMask;
+
+    // Camera of the current accumulation and of the reprojected one
+    uint64_t _cameraHash;
+    glm::mat4 _accumulationScreenMatrix;
+    glm::vec4 _accumulationLensePosition;
+    glm::mat4 _historyScreenMatrix;
+    glm::vec4 _historyLensePosition;
+    bool _historyIsAllocated;
+    bool _historyIsValid;
+
+    float _convergenceThreshold;
+    unsigned int _convergenceMinSampleCount;
+
     std::unique_ptr<Viewport> _viewport;
 
     std::shared_ptr<PathTracerInterface> _pathTracerInterface;
@@ -731,37 +731,14 @@ bool Model::definePathTracerInterface(
     bool ok = true;
 
     // Bruneton
-    ok = ok && interface.declareTexture({"transmittance_texture"});
-    ok = ok && interface.declareTexture({"scattering_texture"});
+    ok = ok && interface.declareTexture({"transmittance_texture", ResourceName(BrunetonTransmittance)});
+    ok = ok && interface.declareTexture({"scattering_texture", ResourceName(BrunetonScattering)});
     //ok = ok && interface.declareTexture({"irradiance_texture"});
-    ok = ok && interface.declareTexture({"single_mie_scattering_texture"});
+    ok = ok && interface.declareTexture({"single_mie_scattering_texture", ResourceName(BrunetonSingleMieScattering)});
 
     return ok;
 }
 
-void Model::bindPathTracerResources(
-    GraphicContext& context,
-    CompiledGpuProgramInterface& compiledGpi) const
-{
-    GpuResourceManager& resources = context.resources;
-
-    context.device.bindTexture(
-        resources.get<GpuImageResource>(ResourceName(BrunetonTransmittance)),
-        compiledGpi.getTextureBindPoint("transmittance_texture"));
-
-    context.device.bindTexture(
-        resources.get<GpuImageResource>(ResourceName(BrunetonScattering)),
-        compiledGpi.getTextureBindPoint("scattering_texture"));
-
-    //context.device.bindTexture(
-    //    resources.get<GpuImageResource>(ResourceName(BrunetonIrradiance)),
-    //    compiledGpi.getTextureBindPoint("irradiance_texture"));
-
-    context.device.bindTexture(
-        resources.get<GpuImageResource>(ResourceName(BrunetonSingleMieScattering)),
-        compiledGpi.getTextureBindPoint("single_mie_scattering_texture"));
-}
-
 void Model::update(GraphicContext& context)
 {
 }
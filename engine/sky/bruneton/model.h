@@ -201,9 +201,6 @@ public:
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
 
     void update(GraphicContext& context) override;
     void render(GraphicContext& context) override;
@@ -0,0 +1,129 @@
+#include "environment.h"
+
+#include <GLM/glm.hpp>
+#include <GLM/gtc/constants.hpp>
+
+#include "../resource/texture.h"
+
+
+namespace unisim
+{
+
+EnvironmentDistribution::EnvironmentDistribution() :
+    _integral(0)
+{
+    build(std::vector<float>(CELL_COUNT, 0.0f));
+}
+
+double EnvironmentDistribution::cellSolidAngle(int row)
+{
+    double phi0 = (double(row) / HEIGHT - 0.5) * glm::pi<double>();
+    double phi1 = (double(row + 1) / HEIGHT - 0.5) * glm::pi<double>();
+    return 2 * glm::pi<double>() / WIDTH * (glm::sin(phi1) - glm::sin(phi0));
+}
+
+void EnvironmentDistribution::build(const std::vector<float>& luminance)
+{
+    std::vector<double> weights(CELL_COUNT, 0.0);
+
+    double total = 0;
+    for(int j = 0; j < HEIGHT; ++j)
+    {
+        double solidAngle = cellSolidAngle(j);
+        for(int i = 0; i < WIDTH; ++i)
+        {
+            double weight = glm::max(0.0, double(luminance[j * WIDTH + i])) * solidAngle;
+            weights[j * WIDTH + i] = weight;
+            total += weight;
+        }
+    }
+
+    _integral = total;
+    _cells.resize(CELL_COUNT);
+
+    if(total <= 0)
+    {
+        for(int c = 0; c < CELL_COUNT; ++c)
+            _cells[c] = {1.0f, GLuint(c), 0.0f, 0.0f};
+        return;
+    }
+
+    // Vose's alias method
+    std::vector<double> scaled(CELL_COUNT);
+    std::vector<int> small, large;
+    for(int c = 0; c < CELL_COUNT; ++c)
+    {
+        scaled[c] = weights[c] / total * CELL_COUNT;
+        (scaled[c] < 1.0 ? small : large).push_back(c);
+
+        _cells[c].pdf = float(weights[c] / total / cellSolidAngle(c / WIDTH));
+        _cells[c].pad1 = 0;
+    }
+
+    while(!small.empty() && !large.empty())
+    {
+        int s = small.back(); small.pop_back();
+        int l = large.back(); large.pop_back();
+
+        _cells[s].threshold = float(scaled[s]);
+        _cells[s].alias = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+
+    // Leftovers are only off by rounding errors
+    for(int c : large)
+        _cells[c] = {1.0f, GLuint(c), _cells[c].pdf, 0.0f};
+    for(int c : small)
+        _cells[c] = {1.0f, GLuint(c), _cells[c].pdf, 0.0f};
+}
+
+void EnvironmentDistribution::buildFromStarmap(const Texture& starmap)
+{
+    std::vector<float> luminance(CELL_COUNT, 0.0f);
+    std::vector<int> texelCount(CELL_COUNT, 0);
+
+    if(starmap.isDataResident())
+    {
+        const glm::vec3 weights(0.2126f, 0.7152f, 0.0722f);
+
+        for(int y = 0; y < starmap.height; ++y)
+        {
+            // Shaders sample the starmap at (1 - u, 1 - v)
+            float v = 1 - (y + 0.5f) / starmap.height;
+            int j = glm::min(int(v * HEIGHT), HEIGHT - 1);
+
+            for(int x = 0; x < starmap.width; ++x)
+            {
+                float u = 1 - (x + 0.5f) / starmap.width;
+                int i = glm::min(int(u * WIDTH), WIDTH - 1);
+
+                std::size_t texel = (std::size_t(y) * starmap.width + x) * starmap.numComponents;
+
+                glm::vec3 color;
+                if(starmap.format == TextureFormat::R32G32B32A32_FLOAT)
+                {
+                    const float* pixel = reinterpret_cast<const float*>(starmap.data.data()) + texel;
+                    color = glm::vec3(pixel[0], pixel[1], pixel[2]);
+                }
+                else
+                {
+                    const unsigned char* pixel = starmap.data.data() + texel;
+                    color = glm::vec3(pixel[0], pixel[1], pixel[2]) / 255.0f;
+                }
+
+                luminance[j * WIDTH + i] += glm::dot(color, weights);
+                ++texelCount[j * WIDTH + i];
+            }
+        }
+
+        for(int c = 0; c < CELL_COUNT; ++c)
+            if(texelCount[c] != 0)
+                luminance[c] /= texelCount[c];
+    }
+
+    build(luminance);
+}
+
+}
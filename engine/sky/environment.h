@@ -0,0 +1,57 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <vector>
+
+#include "../graphic/graphic.h"
+
+
+namespace unisim
+{
+
+struct Texture;
+
+
+struct GpuEnvironmentCell
+{
+    // Alias table entry
+    GLfloat threshold;
+    GLuint alias;
+
+    // Solid angle density of directions within the cell
+    GLfloat pdf;
+    GLfloat pad1;
+};
+
+
+// Luminance distribution over a lat-long grid using the same mapping as findUV()
+class EnvironmentDistribution
+{
+public:
+    static const int WIDTH = 64;
+    static const int HEIGHT = 32;
+    static const int CELL_COUNT = WIDTH * HEIGHT;
+
+    EnvironmentDistribution();
+
+    // Average luminance per cell, row major
+    void build(const std::vector<float>& luminance);
+
+    // Matches the starmap lookup of the sky shaders
+    void buildFromStarmap(const Texture& starmap);
+
+    // Integral of the luminance over the sphere
+    float integral() const { return _integral; }
+
+    const std::vector<GpuEnvironmentCell>& cells() const { return _cells; }
+
+    static double cellSolidAngle(int row);
+
+private:
+    float _integral;
+    std::vector<GpuEnvironmentCell> _cells;
+};
+
+}
+
+#endif // ENVIRONMENT_H
@@ -38,6 +38,11 @@ DefineResource(MoonLighting);
 
 DefineResource(Stars);
 
+DefineResource(EnvironmentParams);
+DefineResource(SkyDistribution);
+DefineResource(StarsDistribution);
+DefineResource(SkyCapture);
+
 
 struct GpuStarsParams
 {
@@ -62,11 +67,22 @@ struct GpuMoonLightParams
     glm::vec4 sunLi;
 };
 
+struct GpuEnvironmentParams
+{
+    glm::vec4 starsQuaternion;
+    GLuint width;
+    GLuint height;
+    GLfloat skyWeight;
+    GLfloat starsWeight;
+};
+
 
 SkyTask::AtmosphereRenderState::AtmosphereRenderState(GraphicContext& context) :
     _moonTexSize(1024),
     _atmosphereHash(0),
-    _moonIsDirty(true)
+    _moonIsDirty(true),
+    _skyHash(0),
+    _skyIsDirty(true)
 {
     const bool precomputed_luminance = true;
     _model.reset(new Atmosphere::Model(context, precomputed_luminance));
@@ -105,7 +121,19 @@ bool SkyTask::defineResources(GraphicContext& context)
     GpuStarsParams starsParams;
     _hash = toGpu(context, starsParams);
     ok = ok && resources.define<GpuConstantResource>(ResourceName(StarsParams), {sizeof(starsParams), &starsParams});
-    ok = ok && resources.define<GpuTextureResource>(ResourceName(Stars), {*context.scene.sky()->stars()->starsTexture()});
+
+    // Starmap pixels are released once uploaded, build its distribution first
+    Texture& starmap = *context.scene.sky()->stars()->starsTexture();
+    starmap.reloadData();
+    _starsDistribution.buildFromStarmap(starmap);
+
+    ok = ok && resources.define<GpuTextureResource>(ResourceName(Stars), {starmap});
+
+    std::vector<GpuEnvironmentCell> starsCells = _starsDistribution.cells();
+    ok = ok && resources.define<GpuStorageResource>(ResourceName(StarsDistribution), {sizeof(GpuEnvironmentCell), starsCells.size(), starsCells.data()});
+
+    std::vector<GpuEnvironmentCell> skyCells = EnvironmentDistribution().cells();
+    ok = ok && resources.define<GpuStorageResource>(ResourceName(SkyDistribution), {sizeof(GpuEnvironmentCell), skyCells.size(), skyCells.data()});
 
     if (_atmosphereRenderState)
     {
@@ -128,8 +156,16 @@ bool SkyTask::defineResources(GraphicContext& context)
             .depth  = 1,
             .format = TextureFormat::R32G32B32A32_FLOAT});
         ok = ok && _atmosphereRenderState->_model->defineResources(context);
+
+        std::vector<GLfloat> skyCapture(EnvironmentDistribution::CELL_COUNT, 0.0f);
+        ok = ok && resources.define<GpuStorageResource>(ResourceName(SkyCapture), {sizeof(GLfloat), skyCapture.size(), skyCapture.data()});
+        _atmosphereRenderState->_skyIsDirty = true;
     }
 
+    GpuEnvironmentParams environmentParams;
+    toGpu(context, environmentParams);
+    ok = ok && resources.define<GpuConstantResource>(ResourceName(EnvironmentParams), {sizeof(environmentParams), &environmentParams});
+
     return ok;
 }
 
@@ -138,16 +174,45 @@ bool SkyTask::defineShaders(GraphicContext& context)
     if (_atmosphereRenderState)
     {
         _atmosphereRenderState->_moonLightGpi.reset(new GpuProgramInterface());
-        _atmosphereRenderState->_moonLightGpi->declareConstant({"MoonLightParams"});
-        _atmosphereRenderState->_moonLightGpi->declareTexture({"MoonAlbedo"});
-        _atmosphereRenderState->_moonLightGpi->declareImage({"MoonLighting"});
+        _atmosphereRenderState->_moonLightGpi->declareConstant({"MoonLightParams", ResourceName(MoonLightParams)});
+        _atmosphereRenderState->_moonLightGpi->declareTexture({"MoonAlbedo", ResourceName(MoonAlbedo)});
+        _atmosphereRenderState->_moonLightGpi->declareImage({"MoonLighting", ResourceName(MoonLighting)});
 
-        _atmosphereRenderState->_moonLightProgram.reset();
         if(!generateComputeProgram(_atmosphereRenderState->_moonLightProgram, "Moon Light", "shaders/moonlight.glsl"))
             return false;
 
+        if(!_atmosphereRenderState->_moonLightGpi->compile(_atmosphereRenderState->_moonLightCompiledGpi, *_atmosphereRenderState->_moonLightProgram))
+            return false;
+
         if(!_atmosphereRenderState->_model->defineShaders(context))
             return false;
+
+        // Low resolution sky capture used to importance sample the sky
+        _atmosphereRenderState->_skyCaptureGpi.reset(new PathTracerInterface());
+        _atmosphereRenderState->_skyCaptureGpi->declareConstant({"AtmosphereParams", ResourceName(AtmosphereParams)});
+        _atmosphereRenderState->_skyCaptureGpi->declareStorage({"SkyCapture", ResourceName(SkyCapture)});
+        if(!_atmosphereRenderState->_model->definePathTracerInterface(context, *_atmosphereRenderState->_skyCaptureGpi))
+            return false;
+
+        std::vector<std::shared_ptr<PathTracerModule>> skyModelModules;
+        if(!_atmosphereRenderState->_model->definePathTracerModules(context, skyModelModules))
+            return false;
+
+        GraphicShaderPtr skyCaptureShader;
+        if(!generateComputerShader(skyCaptureShader, "shaders/skycapture.glsl", {}))
+            return false;
+
+        std::vector<GraphicShaderPtr> skyCaptureShaders = {skyCaptureShader};
+        for(const auto& module : skyModelModules)
+            skyCaptureShaders.push_back(module->shader());
+
+        if(!generateComputeProgram(_atmosphereRenderState->_skyCaptureProgram, "Sky Capture", skyCaptureShaders))
+            return false;
+
+        if(!_atmosphereRenderState->_skyCaptureGpi->compile(_atmosphereRenderState->_skyCaptureCompiledGpi, *_atmosphereRenderState->_skyCaptureProgram))
+            return false;
+
+        _atmosphereRenderState->_skyIsDirty = true;
     }
 
     return true;
@@ -157,6 +222,9 @@ bool SkyTask::definePathTracerModules(
     GraphicContext& context,
     std::vector<std::shared_ptr<PathTracerModule>>& modules)
 {
+    if(!addPathTracerModule(modules, "Environment", context.settings, "shaders/environment.glsl"))
+        return false;
+
     if (_atmosphereRenderState)
     {
         if(!addPathTracerModule(modules, "Atmospheric Sky", context.settings, "shaders/atmosphericsky.glsl"))
@@ -180,13 +248,17 @@ bool SkyTask::definePathTracerInterface(
 {
     bool ok = true;
 
-    ok = ok && interface.declareConstant({"StarsParams"});
-    ok = ok && interface.declareTexture({"Stars"});
+    ok = ok && interface.declareConstant({"StarsParams", ResourceName(StarsParams)});
+    ok = ok && interface.declareTexture({"Stars", ResourceName(Stars)});
+
+    ok = ok && interface.declareConstant({"EnvironmentParams", ResourceName(EnvironmentParams)});
+    ok = ok && interface.declareStorage({"SkyDistribution", ResourceName(SkyDistribution), GpuResourceAccess::ReadOnly});
+    ok = ok && interface.declareStorage({"StarsDistribution", ResourceName(StarsDistribution), GpuResourceAccess::ReadOnly});
 
     if (_atmosphereRenderState)
     {
-        ok = ok && interface.declareConstant({"AtmosphereParams"});
-        ok = ok && interface.declareTexture({"Moon"});
+        ok = ok && interface.declareConstant({"AtmosphereParams", ResourceName(AtmosphereParams)});
+        ok = ok && interface.declareTexture({"Moon", ResourceName(MoonLighting)});
 
         ok = ok && _atmosphereRenderState->_model->definePathTracerInterface(context, interface);
     }
@@ -194,40 +266,9 @@ bool SkyTask::definePathTracerInterface(
     return ok;
 }
 
-void SkyTask::bindPathTracerResources(
-    GraphicContext& context,
-    CompiledGpuProgramInterface& compiledGpi) const
+void SkyTask::prepare(GraphicContext& context)
 {
-    GpuResourceManager& resources = context.resources;
-
-    context.device.bindBuffer(resources.get<GpuConstantResource>(ResourceName(StarsParams)),
-                              compiledGpi.getConstantBindPoint("StarsParams"));
-
-    context.device.bindTexture(resources.get<GpuTextureResource>(ResourceName(Stars)),
-                               compiledGpi.getTextureBindPoint("Stars"));
-
-    if (_atmosphereRenderState)
-    {
-        context.device.bindBuffer(resources.get<GpuConstantResource>(ResourceName(AtmosphereParams)),
-                                  compiledGpi.getConstantBindPoint("AtmosphereParams"));
-
-        context.device.bindTexture(resources.get<GpuImageResource>(ResourceName(MoonLighting)),
-                                   compiledGpi.getTextureBindPoint("Moon"));
-
-        _atmosphereRenderState->_model->bindPathTracerResources(context, compiledGpi);
-    }
-}
-
-void SkyTask::update(GraphicContext& context)
-{
-    Profile(Sky);
-
-    GpuStarsParams starsParams;
-    _hash = toGpu(context, starsParams);
-
-    GpuResourceManager& resources = context.resources;
-    resources.update<GpuConstantResource>(ResourceName(StarsParams), {sizeof(starsParams), &starsParams});
-
+    // Places the sun and moon packed by the light task
     if (_atmosphereRenderState)
     {
         glm::vec4 starsQuaternion;
@@ -274,7 +315,21 @@ void SkyTask::update(GraphicContext& context)
 
         float moonLuminance = luminanceAvg.x / glm::max(1e-5f, luminanceAvg.y);
         moon.setEmissionLuminance(moonLuminance);
+    }
+}
 
+void SkyTask::update(GraphicContext& context)
+{
+    Profile(Sky);
+
+    GpuStarsParams starsParams;
+    _hash = toGpu(context, starsParams);
+
+    GpuResourceManager& resources = context.resources;
+    resources.update<GpuConstantResource>(ResourceName(StarsParams), {sizeof(starsParams), &starsParams});
+
+    if (_atmosphereRenderState)
+    {
         GpuMoonLightParams moonLightParams;
         GpuAtmosphereParams atmosphereParams;
         uint64_t atmosphereHash = toGpu(context, moonLightParams, atmosphereParams);
@@ -286,10 +341,21 @@ void SkyTask::update(GraphicContext& context)
         _atmosphereRenderState->_model->update(context);
         _hash = combineHashes(_atmosphereRenderState->_model->hash(), _hash);
 
+        uint64_t skyHash = combineHashes(_atmosphereRenderState->_model->hash(), atmosphereHash);
+        if(skyHash != _atmosphereRenderState->_skyHash)
+        {
+            _atmosphereRenderState->_skyHash = skyHash;
+            _atmosphereRenderState->_skyIsDirty = true;
+        }
+
         GpuResourceManager& resources = context.resources;
         resources.update<GpuConstantResource>(ResourceName(AtmosphereParams), {sizeof(atmosphereParams), &atmosphereParams});
         resources.update<GpuConstantResource>(ResourceName(MoonLightParams), {sizeof(moonLightParams), &moonLightParams});
     }
+
+    GpuEnvironmentParams environmentParams;
+    toGpu(context, environmentParams);
+    resources.update<GpuConstantResource>(ResourceName(EnvironmentParams), {sizeof(environmentParams), &environmentParams});
 }
 
 void SkyTask::render(GraphicContext& context)
@@ -301,6 +367,8 @@ void SkyTask::render(GraphicContext& context)
         // Atmosphere
         _atmosphereRenderState->_model->render(context);
 
+        captureSky(context);
+
         // Moon light
         if(!_atmosphereRenderState->_moonLightProgram->isValid())
             return;
@@ -308,20 +376,9 @@ void SkyTask::render(GraphicContext& context)
         if(!_atmosphereRenderState->_moonIsDirty)
             return;
 
-        CompiledGpuProgramInterface compiledGpi;
-        if (!_atmosphereRenderState->_moonLightGpi->compile(compiledGpi, *_atmosphereRenderState->_moonLightProgram))
-            return;
-
         GraphicProgramScope programScope(*_atmosphereRenderState->_moonLightProgram);
 
-        GpuResourceManager& resources = context.resources;
-
-        context.device.bindBuffer(resources.get<GpuConstantResource>(ResourceName(MoonLightParams)),
-                                  compiledGpi.getConstantBindPoint("MoonLightParams"));
-        context.device.bindTexture(resources.get<GpuTextureResource>(ResourceName(MoonAlbedo)),
-                                   compiledGpi.getTextureBindPoint("MoonAlbedo"));
-        context.device.bindImage(resources.get<GpuImageResource>(ResourceName(MoonLighting)),
-                                 compiledGpi.getImageBindPoint("MoonLighting"));
+        _atmosphereRenderState->_moonLightCompiledGpi.bind(context.device, context.resources);
 
         context.device.dispatch(_atmosphereRenderState->_moonTexSize / 8,
                                 _atmosphereRenderState->_moonTexSize / 8);
@@ -330,6 +387,47 @@ void SkyTask::render(GraphicContext& context)
     }
 }
 
+void SkyTask::captureSky(GraphicContext& context)
+{
+    AtmosphereRenderState& state = *_atmosphereRenderState;
+
+    GpuResourceManager& resources = context.resources;
+    const auto& skyCapture = resources.get<GpuStorageResource>(ResourceName(SkyCapture));
+
+    // Captures are read back a frame or more late, the distribution follows the latest one that landed
+    std::vector<float> luminance(EnvironmentDistribution::CELL_COUNT);
+    if(skyCapture.fetchRead(luminance.data(), luminance.size() * sizeof(float)))
+    {
+        state._skyDistribution.build(luminance);
+
+        std::vector<GpuEnvironmentCell> skyCells = state._skyDistribution.cells();
+        resources.get<GpuStorageResource>(ResourceName(SkyDistribution)).update({sizeof(GpuEnvironmentCell), skyCells.size(), skyCells.data()});
+
+        GpuEnvironmentParams environmentParams;
+        toGpu(context, environmentParams);
+        resources.update<GpuConstantResource>(ResourceName(EnvironmentParams), {sizeof(environmentParams), &environmentParams});
+    }
+
+    if(!state._skyIsDirty)
+        return;
+
+    if(!state._skyCaptureProgram || !state._skyCaptureProgram->isValid())
+        return;
+
+    {
+        GraphicProgramScope programScope(*state._skyCaptureProgram);
+
+        state._skyCaptureCompiledGpi.bind(context.device, resources);
+
+        context.device.dispatch(EnvironmentDistribution::WIDTH / 8,
+                                EnvironmentDistribution::HEIGHT / 8);
+    }
+
+    // Captured again next frame while every readback slot is in flight
+    if(skyCapture.requestRead(luminance.size() * sizeof(float)))
+        state._skyIsDirty = false;
+}
+
 uint64_t SkyTask::toGpu(
     const GraphicContext& context,
     GpuStarsParams& gpuParams) const
@@ -371,4 +469,27 @@ uint64_t SkyTask::toGpu(
     return hash;
 }
 
+uint64_t SkyTask::toGpu(
+    const GraphicContext& context,
+    GpuEnvironmentParams& environmentParams) const
+{
+    const Stars& stars = *context.scene.sky()->stars();
+
+    // Pick between sky and stars proportionally to the light they emit
+    float skyIntegral = _atmosphereRenderState ? _atmosphereRenderState->_skyDistribution.integral() : 0.0f;
+    float starsIntegral = _starsDistribution.integral() * stars.starsExposure();
+    float totalIntegral = skyIntegral + starsIntegral;
+
+    environmentParams.starsQuaternion = stars.starsQuaternion();
+    environmentParams.width = EnvironmentDistribution::WIDTH;
+    environmentParams.height = EnvironmentDistribution::HEIGHT;
+    environmentParams.skyWeight = totalIntegral > 0 ? skyIntegral / totalIntegral : 0.0f;
+    environmentParams.starsWeight = totalIntegral > 0 ? starsIntegral / totalIntegral : 0.0f;
+
+    uint64_t hash = 0;
+    hash = hashVal(environmentParams, hash);
+
+    return hash;
+}
+
 }
@@ -5,6 +5,8 @@
 
 #include "../taskgraph/pathtracerprovider.h"
 
+#include "environment.h"
+
 
 namespace unisim
 {
@@ -24,10 +26,8 @@ public:
     bool definePathTracerInterface(
         GraphicContext& context,
         PathTracerInterface& interface) override;
-    void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const override;
 
+    void prepare(GraphicContext& context) override;
     void update(GraphicContext& context) override;
     void render(GraphicContext& context) override;
 
@@ -41,6 +41,13 @@ private:
         struct GpuMoonLightParams& moonLightParams,
         struct GpuAtmosphereParams& atmosphereParams) const;
 
+    uint64_t toGpu(
+        const GraphicContext& context,
+        struct GpuEnvironmentParams& environmentParams) const;
+
+    // Rebuilds the sky distribution from the latest capture read back, captures again when the sky changed
+    void captureSky(GraphicContext& context);
+
     struct AtmosphereRenderState
     {
         AtmosphereRenderState(GraphicContext& context);
@@ -51,6 +58,7 @@ private:
 
         GraphicProgramPtr _moonLightProgram;
         GpuProgramInterfacePtr _moonLightGpi;
+        CompiledGpuProgramInterface _moonLightCompiledGpi;
 
         int _moonTexSize;
         std::unique_ptr<Texture> _moonAlbedo;
@@ -58,10 +66,19 @@ private:
         std::size_t _atmosphereHash;
         bool _moonIsDirty;
 
+        GraphicProgramPtr _skyCaptureProgram;
+        std::shared_ptr<PathTracerInterface> _skyCaptureGpi;
+        CompiledGpuProgramInterface _skyCaptureCompiledGpi;
+        EnvironmentDistribution _skyDistribution;
+        uint64_t _skyHash;
+        bool _skyIsDirty;
+
         std::unique_ptr<Atmosphere::Model> _model;
     };
 
     std::unique_ptr<AtmosphereRenderState> _atmosphereRenderState;
+
+    EnvironmentDistribution _starsDistribution;
 };
 
 }
@@ -1,5 +1,7 @@
 #include "graphictask.h"
 
+#include <algorithm>
+
 #include "../system/profiler.h"
 
 #include "../graphic/gpudevice.h"
@@ -9,7 +11,8 @@ namespace unisim
 {
 
 GraphicTask::GraphicTask(const std::string& name) :
-    _name(name)
+    _name(name),
+    _inputHash(0)
 {
 }
 
@@ -17,6 +20,43 @@ GraphicTask::~GraphicTask()
 {
 }
 
+void GraphicTask::dependsOn(const GraphicTaskPtr& task)
+{
+    _dependencies.push_back(task.get());
+}
+
+bool GraphicTask::inputsChanged(const GraphicContext& context) const
+{
+    for(std::size_t i = 0; i < _inputs.size(); ++i)
+    {
+        if(context.resources.version(_inputs[i]) != _inputVersions[i])
+            return true;
+    }
+
+    return inputHash(context) != _inputHash;
+}
+
+void GraphicTask::consumeInputs(const GraphicContext& context)
+{
+    for(std::size_t i = 0; i < _inputs.size(); ++i)
+        _inputVersions[i] = context.resources.version(_inputs[i]);
+
+    _inputHash = inputHash(context);
+}
+
+void GraphicTask::invalidateInputs()
+{
+    std::fill(_inputVersions.begin(), _inputVersions.end(), 0);
+}
+
+void GraphicTask::addInput(ResourceId resource)
+{
+    _inputs.push_back(resource);
+
+    // Resource versions start at 1, the first render always happens
+    _inputVersions.push_back(0);
+}
+
 
 ClearSwapChain::ClearSwapChain() :
     GraphicTask("Clear")
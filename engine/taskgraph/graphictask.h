@@ -15,9 +15,114 @@ class Camera;
 class GpuDevice;
 class PathTracerTask;
 
+// Optional path tracer outputs, only compiled in when requested
+enum class PathTracerAov
+{
+    // First hit albedo
+    Albedo,
+    // First hit normal and distance
+    NormalDepth,
+    // First hit material and instance indices
+    Ids,
+    // Emission and lights seen from the first hit
+    Direct,
+    // Light gathered by the remaining bounces
+    Indirect,
+    // Sample count stored in the convergence moments
+    SampleCount,
+
+    Count
+};
+
+using PathTracerAovMask = unsigned int;
+
+inline PathTracerAovMask aovMask(PathTracerAov aov)
+{
+    return 1u << (unsigned int)aov;
+}
+
+// Scene content the path tracer is specialized for, absent features are compiled out
+enum class PathTracerFeature
+{
+    Meshes,
+    Spheres,
+    Planes,
+    // Primitives with an emissive material, sampled through the light BVH
+    Emitters,
+    // Sun and moon of the atmosphere
+    DirectionalLights,
+
+    Count
+};
+
+using PathTracerFeatureMask = unsigned int;
+
+inline PathTracerFeatureMask featureMask(PathTracerFeature feature)
+{
+    return 1u << (unsigned int)feature;
+}
+
+// Source of the path tracer's sample dimensions
+enum class SamplerType
+{
+    // Tiled blue noise textures, best looking at low sample counts
+    BlueNoise,
+    // Owen-scrambled Sobol, converges faster
+    Sobol
+};
+
+enum class DenoiserType
+{
+    None,
+    Gpu,
+    Cpu
+};
+
 struct GraphicSettings
 {
     bool unbiased;
+
+    SamplerType sampler;
+
+    // Maximum bounce count and depth after which paths undergo Russian roulette
+    unsigned int pathLength;
+    unsigned int russianRouletteDepth;
+
+    // Bytes of streamed texels copied to the GPU per frame, bounds the frame time spent on uploads.
+    // Bytes stand in for time, the cost of a copy is known before issuing it while its GPU
+    // time is only known once a timer query returns, frames later.
+    std::size_t textureUploadBudget;
+
+    // Relative standard error under which a pixel stops receiving samples (0 disables)
+    float convergenceThreshold;
+    unsigned int convergenceMinSampleCount;
+
+    // GPU time given to path tracing tiles each frame, passes resume on the next frame
+    float pathTracerBudgetMs;
+
+    // Index of the first sample, distributed render workers use disjoint ranges
+    unsigned int sampleOffset;
+
+    // Reuses the accumulation through camera motion, keeping at most 'reprojectionMaxSampleCount' samples
+    bool reprojection;
+    float reprojectionMaxSampleCount;
+
+    // Moved instances and edited materials only restart the pixels they cover.
+    // Their indirect lighting on the rest of the image is kept until the next full restart.
+    bool regionalRestart;
+
+    // Outputs requested on top of the ones needed by other tasks (offline exports)
+    PathTracerAovMask pathTracerAovs;
+
+    // Edge-avoiding a-trous filter guided by the path tracer's first hit buffers
+    DenoiserType denoiser;
+    unsigned int denoiserIterationCount;
+    float denoiserColorPhi;
+    float denoiserNormalPhi;
+    float denoiserDepthPhi;
+
+    // Debug check of the barriers derived from resource bindings, reads back every read-only input
+    bool validateBarriers;
 };
 
 struct GraphicContext
@@ -32,6 +137,9 @@ struct GraphicContext
     const GraphicSettings& settings;
 };
 
+class GraphicTask;
+typedef std::shared_ptr<GraphicTask> GraphicTaskPtr;
+
 class GraphicTask
 {
 public:
@@ -41,17 +149,44 @@ public:
     const std::string& name() const { return _name; }
 
     virtual void registerDynamicResources(GraphicContext& context) {}
+    virtual PathTracerAovMask pathTracerAovs(const GraphicSettings& settings) const { return 0; }
     virtual bool defineShaders(GraphicContext& context) { return true; }
     virtual bool defineResources(GraphicContext& context) { return true; }
 
+    // CPU work run on a worker thread, concurrently with the tasks it does not depend on.
+    // Must not issue GL calls nor modify resources, update() uploads its results.
+    virtual void prepare(GraphicContext& context) {}
     virtual void update(GraphicContext& context) {}
     virtual void render(GraphicContext& context) {}
 
+    // 'task' is prepared before this one
+    void dependsOn(const GraphicTaskPtr& task);
+    const std::vector<GraphicTask*>& dependencies() const { return _dependencies; }
+
+    // Tasks with inputs only render when one of them changed since their last render,
+    // swapchain tasks also render whenever the swapchain is redrawn
+    virtual bool drawsSwapChain() const { return false; }
+    virtual void skipRender(GraphicContext& context) {}
+
+    bool hasInputs() const { return !_inputs.empty(); }
+    bool inputsChanged(const GraphicContext& context) const;
+    void consumeInputs(const GraphicContext& context);
+    void invalidateInputs();
+
+protected:
+    void addInput(ResourceId resource);
+
+    // State other than the input resources render() depends on
+    virtual uint64_t inputHash(const GraphicContext& context) const { return 0; }
+
 private:
     std::string _name;
-};
+    std::vector<GraphicTask*> _dependencies;
 
-typedef std::shared_ptr<GraphicTask> GraphicTaskPtr;
+    std::vector<ResourceId> _inputs;
+    std::vector<uint64_t> _inputVersions;
+    uint64_t _inputHash;
+};
 
 
 class ClearSwapChain : public GraphicTask
@@ -59,6 +194,7 @@ class ClearSwapChain : public GraphicTask
 public:
     ClearSwapChain();
 
+    bool drawsSwapChain() const override { return true; }
     void render(GraphicContext& context) override;
 };
 
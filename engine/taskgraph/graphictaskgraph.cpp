@@ -2,12 +2,18 @@
 
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+
+#include <imgui/imgui.h>
+
+#include <PilsCore/Utils/Assert.h>
 
 #include "../system/profiler.h"
 
 #include "../resource/primitive.h"
 
 #include "../graphic/view.h"
+#include "../graphic/gputexturestreamer.h"
 
 #include "../camera.h"
 #include "../scene.h"
@@ -17,16 +23,44 @@
 #include "../bvh/geometrytask.h"
 #include "../bvh/lighttask.h"
 #include "../bvh/materialtask.h"
+#include "../denoising/denoisingtask.h"
 #include "../grading/gradingtask.h"
+#include "../pathtracer/accumulation.h"
 #include "../pathtracer/pathtracertask.h"
 #include "../terrain/terraintask.h"
 
 namespace unisim
 {
 
-GraphicTaskGraph::GraphicTaskGraph()
+DefineProfilePoint(Prepare);
+DefineProfilePointGpu(TextureStreaming);
+
+
+GraphicTaskGraph::GraphicTaskGraph() :
+    _redrawRequested(true),
+    _hasRedrawn(false),
+    _definedPathTracerAovs(0),
+    _definedPathTracerFeatures(0)
 {
     _settings.unbiased = false;
+    _settings.sampler = SamplerType::Sobol;
+    _settings.pathLength = 5;
+    _settings.russianRouletteDepth = 3;
+    _settings.textureUploadBudget = 16 * 1024 * 1024;
+    _settings.convergenceThreshold = 0.01f;
+    _settings.convergenceMinSampleCount = 16;
+    _settings.pathTracerBudgetMs = 12.0f;
+    _settings.sampleOffset = 0;
+    _settings.reprojection = true;
+    _settings.reprojectionMaxSampleCount = 32.0f;
+    _settings.regionalRestart = true;
+    _settings.pathTracerAovs = 0;
+    _settings.denoiser = DenoiserType::Gpu;
+    _settings.denoiserIterationCount = 5;
+    _settings.denoiserColorPhi = 4.0f;
+    _settings.denoiserNormalPhi = 64.0f;
+    _settings.denoiserDepthPhi = 0.05f;
+    _settings.validateBarriers = false;
 }
 
 bool GraphicTaskGraph::initialize(const View& view, const Scene& scene, const Camera& camera)
@@ -40,6 +74,11 @@ bool GraphicTaskGraph::initialize(const View& view, const Scene& scene, const Ca
         task->registerDynamicResources(context);
     }
 
+    _definedPathTracerAovs = gatherPathTracerAovs();
+    _definedPathTracerFeatures = PathTracerTask::sceneFeatures(scene);
+    _pathTracerTask->setAovs(_definedPathTracerAovs);
+    _pathTracerTask->setFeatures(_definedPathTracerFeatures);
+
     _resources.initialize();
 
     for(const auto& task : _tasks)
@@ -61,15 +100,19 @@ bool GraphicTaskGraph::initialize(const View& view, const Scene& scene, const Ca
     g_PathTracerCommonSrcs.push_back(loadSource("shaders/common/inputs.glsl"));
     g_PathTracerCommonSrcs.push_back(loadSource("shaders/common/signatures.glsl"));
 
-    for(const auto& task : _tasks)
+    // Every task's programs compile in parallel, the tasks waiting for them are defined again once all are done
+    bool ok = defineShaders(context, _tasks);
+
+    while(ok && !_pendingShaderTasks.empty())
     {
-        bool ok = task->defineShaders(context);
+        finishPendingPrograms();
+        ok = defineShaders(context, _pendingShaderTasks);
+    }
 
-        if(!ok)
-        {
-            PILS_ERROR("'", task->name(), "' shader definition failed\n");
-            return false;
-        }
+    if(!ok)
+    {
+        PILS_ERROR("Shader definition failed\n");
+        return false;
     }
 
     return true;
@@ -83,41 +126,236 @@ bool GraphicTaskGraph::reloadShaders(const View& view, const Scene& scene, const
     g_PathTracerCommonSrcs.push_back(loadSource("shaders/common/inputs.glsl"));
     g_PathTracerCommonSrcs.push_back(loadSource("shaders/common/signatures.glsl"));
 
+    _definedPathTracerAovs = gatherPathTracerAovs();
+    _definedPathTracerFeatures = PathTracerTask::sceneFeatures(scene);
+    _pathTracerTask->setAovs(_definedPathTracerAovs);
+    _pathTracerTask->setFeatures(_definedPathTracerFeatures);
+
     GraphicContext context = {_device, view, scene, camera, _resources, _settings};
 
-    for(const auto& task : _tasks)
-    {
-        bool ok = task->defineShaders(context);
+    return defineShaders(context, _tasks);
+}
 
-        if(!ok)
+bool GraphicTaskGraph::defineShaders(GraphicContext& context, std::vector<GraphicTaskPtr> tasks)
+{
+    bool ok = true;
+    _pendingShaderTasks.clear();
+
+    for(const auto& task : tasks)
+    {
+        if(task->defineShaders(context))
+        {
+            // New programs render again even if their inputs did not change
+            task->invalidateInputs();
+        }
+        else if(isProgramPending())
+        {
+            _pendingShaderTasks.push_back(task);
+        }
+        else
         {
             std::cerr << "'" << task->name() << "' shader definition failed\n";
-            return false;
+            ok = false;
         }
     }
 
-    return true;
+    if(_pendingShaderTasks.empty())
+        releaseFinishedPrograms();
+
+    _redrawRequested = true;
+
+    return ok;
+}
+
+void GraphicTaskGraph::release()
+{
+    _device.release();
 }
 
 void GraphicTaskGraph::execute(const View& view, const Scene& scene, const Camera& camera)
 {
+    // Outputs and scene features are compiled in the path tracer
+    PathTracerAovMask aovs = gatherPathTracerAovs();
+    PathTracerFeatureMask features = PathTracerTask::sceneFeatures(scene);
+
+    bool isDefined = aovs == _definedPathTracerAovs && features == _definedPathTracerFeatures;
+    bool isCompiled = aovs == _pathTracerTask->aovs() && features == _pathTracerTask->features();
+
+    if(!isDefined && !isCompiled)
+    {
+        if(!reloadShaders(view, scene, camera))
+            PILS_ERROR("Could not recompile the path tracer\n");
+    }
+
     GraphicContext context = {_device, view, scene, camera, _resources, _settings};
 
+    if(!_pendingShaderTasks.empty() && updatePendingPrograms())
+    {
+        if(!defineShaders(context, _pendingShaderTasks))
+            PILS_ERROR("Could not reload the shaders\n");
+    }
+
+    _device.setBarrierValidation(_settings.validateBarriers);
+
+    {
+        ProfileGpu(TextureStreaming);
+        _device.textureStreamer().process(_settings.textureUploadBudget);
+    }
+
+    prepare(context);
+
     for(const auto& task : _tasks)
     {
         task->update(context);
     }
 
+    // Swapchain tasks come after the passes producing their inputs
+    bool redraw = _redrawRequested;
+    bool isRedrawResolved = false;
+
     for(const auto& task : _tasks)
     {
+        bool isDirty = true;
+
+        if(task->drawsSwapChain())
+        {
+            if(!isRedrawResolved)
+            {
+                for(const auto& swapChainTask : _tasks)
+                    redraw = redraw || (swapChainTask->drawsSwapChain() && swapChainTask->inputsChanged(context));
+
+                isRedrawResolved = true;
+            }
+
+            isDirty = redraw;
+        }
+        else if(task->hasInputs())
+        {
+            isDirty = task->inputsChanged(context);
+        }
+
+        if(!isDirty)
+        {
+            task->skipRender(context);
+            continue;
+        }
+
+        task->consumeInputs(context);
         task->render(context);
     }
+
+    _hasRedrawn = isRedrawResolved && redraw;
+    _redrawRequested = false;
+}
+
+bool GraphicTaskGraph::isIdle() const
+{
+    return !_hasRedrawn && _pathTracerTask->isIdle() && _device.textureStreamer().pendingUploadCount() == 0 &&
+           _pendingShaderTasks.empty();
+}
+
+bool GraphicTaskGraph::ui()
+{
+    bool shadersDirty = false;
+
+    shadersDirty |= ImGui::Checkbox("Unbiased", &_settings.unbiased);
+
+    const char* samplers[] = {"Blue Noise", "Sobol"};
+    int sampler = int(_settings.sampler);
+    if(ImGui::Combo("Sampler", &sampler, samplers, IM_ARRAYSIZE(samplers)))
+    {
+        _settings.sampler = SamplerType(sampler);
+        shadersDirty = true;
+    }
+
+    int pathLength = _settings.pathLength;
+    if(ImGui::SliderInt("Path Length", &pathLength, 1, 32))
+    {
+        _settings.pathLength = pathLength;
+        shadersDirty = true;
+    }
+
+    int rouletteDepth = _settings.russianRouletteDepth;
+    if(ImGui::SliderInt("Russian Roulette Depth", &rouletteDepth, 1, 32))
+    {
+        _settings.russianRouletteDepth = rouletteDepth;
+        shadersDirty = true;
+    }
+
+    ImGui::SliderFloat("Convergence Threshold", &_settings.convergenceThreshold, 0.0f, 0.1f, "%.4f");
+
+    int minSampleCount = _settings.convergenceMinSampleCount;
+    if(ImGui::SliderInt("Min Sample Count", &minSampleCount, 1, 256))
+        _settings.convergenceMinSampleCount = minSampleCount;
+
+    ImGui::SliderFloat("Path Tracer Budget ms", &_settings.pathTracerBudgetMs, 1.0f, 100.0f);
+
+    shadersDirty |= ImGui::Checkbox("Reprojection", &_settings.reprojection);
+    ImGui::SliderFloat("Reprojection Max Samples", &_settings.reprojectionMaxSampleCount, 1.0f, 256.0f);
+    ImGui::Checkbox("Regional Restart", &_settings.regionalRestart);
+
+    if(ImGui::TreeNode("Path Tracer Outputs"))
+    {
+        const char* aovNames[] = {"Albedo", "Normal Depth", "Ids", "Direct", "Indirect", "Sample Count"};
+        static_assert(IM_ARRAYSIZE(aovNames) == int(PathTracerAov::Count), "Missing AOV names");
+
+        for(int a = 0; a < int(PathTracerAov::Count); ++a)
+            ImGui::CheckboxFlags(aovNames[a], &_settings.pathTracerAovs, aovMask(PathTracerAov(a)));
+
+        ImGui::TreePop();
+    }
+
+    ImGui::Separator();
+
+    const char* denoisers[] = {"None", "GPU", "CPU"};
+    int denoiser = int(_settings.denoiser);
+    if(ImGui::Combo("Denoiser", &denoiser, denoisers, IM_ARRAYSIZE(denoisers)))
+        _settings.denoiser = DenoiserType(denoiser);
+
+    int iterationCount = _settings.denoiserIterationCount;
+    if(ImGui::SliderInt("Denoiser Iterations", &iterationCount, 1, 8))
+        _settings.denoiserIterationCount = iterationCount;
+
+    ImGui::SliderFloat("Denoiser Color Phi", &_settings.denoiserColorPhi, 0.0f, 16.0f);
+    ImGui::SliderFloat("Denoiser Normal Phi", &_settings.denoiserNormalPhi, 1.0f, 256.0f);
+    ImGui::SliderFloat("Denoiser Depth Phi", &_settings.denoiserDepthPhi, 0.001f, 1.0f, "%.3f");
+
+    ImGui::Separator();
+
+    ImGui::Checkbox("Validate Barriers", &_settings.validateBarriers);
+
+    ImGui::Separator();
+
+    ImGui::Text("Average Path Length %.3g", _pathTracerTask->averagePathLength());
+
+    return shadersDirty;
+}
+
+unsigned int GraphicTaskGraph::pathTracerSampleCount() const
+{
+    return _pathTracerTask->sampleCount();
+}
+
+bool GraphicTaskGraph::isPathTracerConverged() const
+{
+    return _pathTracerTask->isConverged();
+}
+
+void GraphicTaskGraph::readResult(const View& view, const Scene& scene, const Camera& camera, bool partial, Accumulation& accumulation)
+{
+    GraphicContext context = {_device, view, scene, camera, _resources, _settings};
+
+    if(partial)
+        _pathTracerTask->readAccumulation(context, accumulation);
+    else
+        _gradingTask->readInput(context, accumulation);
 }
 
 void GraphicTaskGraph::createTaskGraph(const Scene& scene)
 {
     // Task declaration
     _pathTracerTask.reset(new PathTracerTask());
+    _gradingTask.reset(new GradingTask());
 
     // Task Graph
     _tasks.clear();
@@ -125,13 +363,34 @@ void GraphicTaskGraph::createTaskGraph(const Scene& scene)
     addTask(GraphicTaskPtr(new TerrainTask()));
     addTask(GraphicTaskPtr(new MaterialTask()));
     addTask(GraphicTaskPtr(new GeometryTask()));
-    addTask(GraphicTaskPtr(new SkyTask()));
-    addTask(GraphicTaskPtr(new LightTask()));
+    GraphicTaskPtr skyTask(new SkyTask());
+    GraphicTaskPtr lightTask(new LightTask());
+
+    addTask(skyTask);
+    addTask(lightTask);
     addTask(_pathTracerTask);
+    addTask(GraphicTaskPtr(new DenoisingTask()));
     addTask(GraphicTaskPtr(new ClearSwapChain()));
-    addTask(GraphicTaskPtr(new GradingTask()));
+    addTask(_gradingTask);
     addTask(GraphicTaskPtr(new Ui()));
 
+    // Sun and moon are placed by the sky before being packed as lights
+    lightTask->dependsOn(skyTask);
+
+    _prepareDependents.assign(_tasks.size(), {});
+    _prepareDependencyCounts.assign(_tasks.size(), 0);
+    for(unsigned int t = 0; t < _tasks.size(); ++t)
+    {
+        for(const GraphicTask* dependency : _tasks[t]->dependencies())
+        {
+            auto it = std::find_if(_tasks.begin(), _tasks.begin() + t, [&](const GraphicTaskPtr& task){ return task.get() == dependency; });
+            PILS_ASSERT(it != _tasks.begin() + t, "Tasks must depend on earlier tasks");
+
+            _prepareDependents[it - _tasks.begin()].push_back(t);
+            ++_prepareDependencyCounts[t];
+        }
+    }
+
     // Path Tracer Providers
     std::vector<PathTracerProviderTaskPtr> pathTracerProviders;
     for(const auto& task : _tasks)
@@ -144,9 +403,86 @@ void GraphicTaskGraph::createTaskGraph(const Scene& scene)
     _pathTracerTask->setPathTracerTasks(pathTracerProviders);
 }
 
+PathTracerAovMask GraphicTaskGraph::gatherPathTracerAovs() const
+{
+    PathTracerAovMask aovs = _settings.pathTracerAovs;
+
+    for(const auto& task : _tasks)
+        aovs |= task->pathTracerAovs(_settings);
+
+    return aovs;
+}
+
 void GraphicTaskGraph::addTask(const GraphicTaskPtr& task)
 {
     _tasks.push_back(task);
 }
 
+void GraphicTaskGraph::prepare(GraphicContext& context)
+{
+    Profile(Prepare);
+
+    std::vector<std::atomic<unsigned int>> remainingDependencies(_tasks.size());
+    std::vector<uint64_t> elapsedNs(_tasks.size(), 0);
+
+    std::function<void(unsigned int)> prepareTask = [&](unsigned int t)
+    {
+        auto start = std::chrono::steady_clock::now();
+        _tasks[t]->prepare(context);
+        elapsedNs[t] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        // Dependents are queued on this worker, idle ones steal them
+        for(unsigned int d : _prepareDependents[t])
+        {
+            if(--remainingDependencies[d] == 0)
+                _threadPool.submit([&prepareTask, d]{ prepareTask(d); });
+        }
+    };
+
+    for(std::size_t t = 0; t < _tasks.size(); ++t)
+        remainingDependencies[t] = _prepareDependencyCounts[t];
+
+    for(unsigned int t = 0; t < _tasks.size(); ++t)
+    {
+        if(_prepareDependencyCounts[t] == 0)
+            _threadPool.submit([&prepareTask, t]{ prepareTask(t); });
+    }
+
+    _threadPool.wait();
+
+    reportCriticalPath(elapsedNs);
+}
+
+void GraphicTaskGraph::reportCriticalPath(const std::vector<uint64_t>& elapsedNs)
+{
+    // Dependencies are declared on earlier tasks, the longest chain ending at each task is known once reached
+    std::vector<uint64_t> pathNs(_tasks.size(), 0);
+    std::vector<int> previous(_tasks.size(), -1);
+
+    int last = -1;
+    for(unsigned int t = 0; t < _tasks.size(); ++t)
+    {
+        for(unsigned int d = 0; d < t; ++d)
+        {
+            const auto& dependents = _prepareDependents[d];
+            if(std::find(dependents.begin(), dependents.end(), t) != dependents.end() && pathNs[d] > pathNs[t])
+            {
+                pathNs[t] = pathNs[d];
+                previous[t] = d;
+            }
+        }
+
+        pathNs[t] += elapsedNs[t];
+
+        if(last < 0 || pathNs[t] > pathNs[last])
+            last = t;
+    }
+
+    std::string path;
+    for(int t = last; t >= 0; t = previous[t])
+        path = path.empty() ? _tasks[t]->name() : _tasks[t]->name() + " > " + path;
+
+    Profiler::GetInstance().reportCriticalPath("Prepare", path, last >= 0 ? pathNs[last] : 0);
+}
+
 }
@@ -1,6 +1,8 @@
 #ifndef GRAPHICTASKGRAPH_H
 #define GRAPHICTASKGRAPH_H
 
+#include "../system/threadpool.h"
+
 #include "../graphic/gpudevice.h"
 
 #include "graphictask.h"
@@ -10,6 +12,9 @@
 namespace unisim
 {
 
+struct Accumulation;
+class GradingTask;
+
 class GraphicTaskGraph
 {
 public:
@@ -21,18 +26,63 @@ public:
 
     void execute(const View& view, const Scene& scene, const Camera& camera);
 
+    // Must be called before the GL context is destroyed
+    void release();
+
+    // The swapchain is otherwise only redrawn when the graded image changes
+    void requestRedraw() { _redrawRequested = true; }
+    // False when the last execute left the swapchain untouched, it must not be presented
+    bool hasRedrawn() const { return _hasRedrawn; }
+    // Nothing was rendered and nothing will be until the scene, camera or settings change
+    bool isIdle() const;
+
+    // Returns true when shaders must be reloaded to apply the new settings
+    bool ui();
+
     const GpuResourceManager& resources() const { return _resources; }
 
+    GraphicSettings& settings() { return _settings; }
+
+    // Offline rendering
+    unsigned int pathTracerSampleCount() const;
+    bool isPathTracerConverged() const;
+    // Partial results keep the path tracer's sums and moments for distributed renders
+    void readResult(const View& view, const Scene& scene, const Camera& camera, bool partial, Accumulation& accumulation);
+
 private:
     void createTaskGraph(const Scene& scene);
     void addTask(const GraphicTaskPtr& task);
 
+    // Runs every task's prepare() on the thread pool, as soon as its dependencies are prepared
+    void prepare(GraphicContext& context);
+    void reportCriticalPath(const std::vector<uint64_t>& elapsedNs);
+
+    PathTracerAovMask gatherPathTracerAovs() const;
+
+    // Returns false on errors, tasks waiting for their programs are kept to be defined again
+    bool defineShaders(GraphicContext& context, std::vector<GraphicTaskPtr> tasks);
+
     GpuDevice _device;
     GraphicSettings _settings;
     GpuResourceManager _resources;
     std::vector<GraphicTaskPtr> _tasks;
 
+    // Keep rendering with their previous programs until the new ones are compiled
+    std::vector<GraphicTaskPtr> _pendingShaderTasks;
+
+    bool _redrawRequested;
+    bool _hasRedrawn;
+
+    ThreadPool _threadPool;
+    std::vector<std::vector<unsigned int>> _prepareDependents;
+    std::vector<unsigned int> _prepareDependencyCounts;
+
     std::shared_ptr<PathTracerTask> _pathTracerTask;
+    std::shared_ptr<GradingTask> _gradingTask;
+
+    // Masks of the last path tracer definition, a failed one is not attempted again until they change
+    PathTracerAovMask _definedPathTracerAovs;
+    PathTracerFeatureMask _definedPathTracerFeatures;
 };
 
 }
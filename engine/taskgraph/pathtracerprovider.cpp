@@ -16,10 +16,59 @@ std::vector<std::string> g_PathTracerCommonSrcs;
 // PATH TRACER INTERFACE //
 
 PathTracerInterface::PathTracerInterface() :
-    GpuProgramInterface()
+    GpuProgramInterface(),
+    _aovs(0)
 {
 }
 
+bool PathTracerInterface::declareAov(PathTracerAov aov, ResourceId resource)
+{
+    _aovs |= aovMask(aov);
+
+    if(const char* imageName = aovImageName(aov))
+        return declareImage({imageName, resource});
+
+    return true;
+}
+
+const char* PathTracerInterface::aovImageName(PathTracerAov aov)
+{
+    switch(aov)
+    {
+    case PathTracerAov::Albedo:
+        return "aovAlbedo";
+    case PathTracerAov::NormalDepth:
+        return "aovNormalDepth";
+    case PathTracerAov::Ids:
+        return "aovIds";
+    case PathTracerAov::Direct:
+        return "aovDirect";
+    case PathTracerAov::Indirect:
+        return "aovIndirect";
+    default:
+        return nullptr;
+    }
+}
+
+std::vector<std::string> PathTracerInterface::aovDefines(PathTracerAovMask aovs)
+{
+    const char* defines[] = {
+        "AOV_ALBEDO",
+        "AOV_NORMAL_DEPTH",
+        "AOV_IDS",
+        "AOV_DIRECT",
+        "AOV_INDIRECT",
+        "AOV_SAMPLE_COUNT"};
+    static_assert(sizeof(defines) / sizeof(defines[0]) == (int)PathTracerAov::Count, "Missing AOV defines");
+
+    std::vector<std::string> aovDefines;
+    for(int a = 0; a < (int)PathTracerAov::Count; ++a)
+        if(aovs & aovMask(PathTracerAov(a)))
+            aovDefines.push_back(defines[a]);
+
+    return aovDefines;
+}
+
 
 // PATH TRACER MODULE //
 PathTracerModule::PathTracerModule(const std::string& name, const std::shared_ptr<GraphicShader>& shader) :
@@ -61,12 +110,6 @@ bool PathTracerProviderTask::definePathTracerInterface(
     return true;
 }
 
-void PathTracerProviderTask::bindPathTracerResources(
-    GraphicContext& context,
-    CompiledGpuProgramInterface& compiledGpi) const
-{
-}
-
 bool PathTracerProviderTask::addPathTracerModule(
     std::vector<std::shared_ptr<PathTracerModule>>& modules,
     const std::string& name,
@@ -79,6 +122,12 @@ bool PathTracerProviderTask::addPathTracerModule(
     if(settings.unbiased)
         allDefines.push_back("IS_UNBIASED");
 
+    if(settings.sampler == SamplerType::Sobol)
+        allDefines.push_back("SOBOL_SAMPLER");
+
+    allDefines.push_back("PATH_LENGTH " + std::to_string(settings.pathLength) + "u");
+    allDefines.push_back("RUSSIAN_ROULETTE_DEPTH " + std::to_string(settings.russianRouletteDepth) + "u");
+
     for(int t = 0; t < Primitive::Type_Count; ++t)
     {
         std::string upperName = Primitive::Type_Names[t];
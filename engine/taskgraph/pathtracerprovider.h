@@ -5,6 +5,8 @@
 #include <memory>
 #include <string>
 
+#include <GLM/glm.hpp>
+
 #include "../graphic/graphic.h"
 #include "../graphic/gpuprograminterface.h"
 
@@ -26,7 +28,19 @@ class PathTracerInterface : public GpuProgramInterface
 public:
     PathTracerInterface();
 
+    // Declares the AOV's image, if it is not stored with another output
+    bool declareAov(PathTracerAov aov, ResourceId resource);
+
+    PathTracerAovMask aovs() const { return _aovs; }
+
+    // Image name in the path tracer, null for AOVs without their own image
+    static const char* aovImageName(PathTracerAov aov);
+
+    // Compiles the AOVs' writes in the path tracer
+    static std::vector<std::string> aovDefines(PathTracerAovMask aovs);
+
 private:
+    PathTracerAovMask _aovs;
 };
 
 
@@ -39,6 +53,7 @@ public:
     ~PathTracerModule();
 
     std::shared_ptr<GraphicShader> shader() const { return _shader; }
+    uint64_t sourceHash() const { return _shader->sourceHash(); }
 
     std::string name() const { return _name; }
 
@@ -50,6 +65,14 @@ private:
 using PathTracerModulePtr = std::shared_ptr<PathTracerModule>;
 
 
+// World space sphere whose pixels must restart their accumulation
+struct PathTracerDirtyRegion
+{
+    glm::dvec3 center;
+    double radius;
+};
+
+
 class PathTracerProviderTask : public GraphicTask
 {
 public:
@@ -64,12 +87,12 @@ public:
         GraphicContext& context,
         PathTracerInterface& interface);
 
-    virtual void bindPathTracerResources(
-        GraphicContext& context,
-        CompiledGpuProgramInterface& compiledGpi) const;
-
+    // Changes requiring a full restart of the accumulation
     uint64_t hash() const { return _hash; }
 
+    // Changes of the last update only affecting the pixels covering these regions
+    const std::vector<PathTracerDirtyRegion>& dirtyRegions() const { return _dirtyRegions; }
+
     template<typename T>
     static uint64_t hashVal(const T& data, uint64_t seed)
     {
@@ -99,6 +122,7 @@ protected:
 
     std::string _name;
     uint64_t _hash;
+    std::vector<PathTracerDirtyRegion> _dirtyRegions;
 };
 
 using PathTracerProviderTaskPtr = std::shared_ptr<PathTracerProviderTask>;
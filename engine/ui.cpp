@@ -29,4 +29,10 @@ void Ui::render(GraphicContext& context)
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+void Ui::skipRender(GraphicContext& context)
+{
+    // Closes the frame started by ImGuiNewFrame
+    ImGui::EndFrame();
+}
+
 }
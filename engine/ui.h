@@ -12,7 +12,9 @@ class Ui : public GraphicTask
 public:
     Ui();
     
+    bool drawsSwapChain() const override { return true; }
     void render(GraphicContext& context) override;
+    void skipRender(GraphicContext& context) override;
 };
 
 }
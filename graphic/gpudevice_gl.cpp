@@ -1,15 +1,23 @@
 #include "gpudevice.h"
 
+#include <functional>
+#include <string_view>
+
 #include "PilsCore/Utils/Assert.h"
+#include "PilsCore/Utils/Logger.h"
 
 #include "gpuresource.h"
 #include "gpuprograminterface.h"
+#include "gputexturestreamer.h"
 
 
 namespace unisim
 {
 
-GpuDevice::GpuDevice()
+GpuDevice::GpuDevice() :
+    _textureStreamer(new GpuTextureStreamer()),
+    _barriers(0),
+    _validateBarriers(false)
 {
 
 }
@@ -19,6 +27,11 @@ GpuDevice::~GpuDevice()
 
 }
 
+void GpuDevice::release()
+{
+    _textureStreamer->release();
+}
+
 void GpuDevice::bindBuffer(const GpuConstantResource& resource, const GpuProgramConstantBindPoint& bindPoint)
 {
     PILS_ASSERT(resource.handle().bufferId > 0, "Invalid constant buffer index");
@@ -26,10 +39,12 @@ void GpuDevice::bindBuffer(const GpuConstantResource& resource, const GpuProgram
     glBindBufferBase(GL_UNIFORM_BUFFER, bindPoint.bindPoint, resource.handle().bufferId);
 }
 
-void GpuDevice::bindBuffer(const GpuStorageResource& resource, const GpuProgramStorageBindPoint& bindPoint)
+void GpuDevice::bindBuffer(const GpuStorageResource& resource, const GpuProgramStorageBindPoint& bindPoint, GpuResourceAccess access)
 {
     PILS_ASSERT(resource.handle().bufferId > 0, "Invalid storage buffer index");
 
+    trackBinding(resource, GL_SHADER_STORAGE_BARRIER_BIT, access);
+
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindPoint.bindPoint, resource.handle().bufferId);
 }
 
@@ -45,27 +60,142 @@ void GpuDevice::bindTexture(const GpuImageResource& resource, const GpuProgramTe
 {
     PILS_ASSERT(resource.handle().texId > 0, "Invalid texture index");
 
+    trackBinding(resource, GL_TEXTURE_FETCH_BARRIER_BIT, GpuResourceAccess::ReadOnly);
+
     glActiveTexture(GL_TEXTURE0 + unit.bindPoint);
     glBindTexture(resource.handle().dimension, resource.handle().texId);
 }
 
-void GpuDevice::bindImage(const GpuImageResource& resource, const GpuProgramImageBindPoint& unit)
+void GpuDevice::bindImage(const GpuImageResource& resource, const GpuProgramImageBindPoint& unit, GpuResourceAccess access)
 {
     PILS_ASSERT(resource.handle().texId > 0, "Invalid image index");
 
-    glBindImageTexture(unit.bindPoint, resource.handle().texId, 0, resource.handle().dimension == GL_TEXTURE_3D, 0, GL_WRITE_ONLY, resource.handle().internalFormat);
+    trackBinding(resource, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT, access);
+
+    GLboolean layered = resource.handle().dimension == GL_TEXTURE_3D || resource.handle().dimension == GL_TEXTURE_2D_ARRAY;
+    GLenum glAccess = access == GpuResourceAccess::ReadOnly ? GL_READ_ONLY : GL_READ_WRITE;
+    glBindImageTexture(unit.bindPoint, resource.handle().texId, 0, layered, 0, glAccess, resource.handle().internalFormat);
 }
 
 void GpuDevice::dispatch(unsigned int workGroupCountX, unsigned int workGroupCountY, unsigned int workGroupCountZ)
 {
+    beginDispatch();
     glDispatchCompute(workGroupCountX, workGroupCountY, workGroupCountZ);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    endDispatch();
+}
+
+void GpuDevice::dispatchIndirect(const GpuStorageResource& args, std::size_t offset)
+{
+    PILS_ASSERT(args.handle().bufferId > 0, "Invalid indirect dispatch buffer index");
+
+    // Arguments written by a previous pass
+    trackBinding(args, GL_COMMAND_BARRIER_BIT, GpuResourceAccess::ReadOnly);
+
+    beginDispatch();
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, args.handle().bufferId);
+    glDispatchComputeIndirect(offset);
+    endDispatch();
+}
+
+void GpuDevice::beginDispatch()
+{
+    flushBarriers();
+
+    if(_validateBarriers)
+    {
+        if(_writtenResources.empty())
+            PILS_ERROR("Barrier validation: dispatch without writable bindings, its writes are not tracked\n");
+
+        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        for(auto& readOnly : _readOnlyHashes)
+            readOnly.second = contentHash(*readOnly.first);
+    }
+}
+
+void GpuDevice::endDispatch()
+{
+    if(_validateBarriers)
+    {
+        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        for(const auto& readOnly : _readOnlyHashes)
+        {
+            if(contentHash(*readOnly.first) != readOnly.second)
+                PILS_ERROR("Barrier validation: resource ", readOnly.first->id,
+                           " was written while bound read-only, later passes miss its barrier\n");
+        }
+    }
+
+    endPass();
 }
 
 void GpuDevice::draw(const GpuGeometryResource& resource)
 {
+    flushBarriers();
+
     glBindVertexArray(resource.handle().vao);
     glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    endPass();
+}
+
+void GpuDevice::trackBinding(const GpuResource& resource, GpuBarrierMask barrier, GpuResourceAccess access)
+{
+    // Shader writes of a previous pass
+    if(resource.pendingBarriers & barrier)
+    {
+        _barriers |= barrier;
+        resource.pendingBarriers &= ~barrier;
+    }
+
+    // Reads of previous passes complete before later commands write, only writes need barriers
+    if(access == GpuResourceAccess::ReadWrite)
+        _writtenResources.push_back(&resource);
+    else if(_validateBarriers && barrier != GL_TEXTURE_FETCH_BARRIER_BIT)
+        _readOnlyHashes.emplace_back(&resource, 0);
+}
+
+void GpuDevice::flushBarriers()
+{
+    // Independent passes are not serialized
+    if(_barriers != 0)
+        glMemoryBarrier(_barriers);
+
+    _barriers = 0;
+}
+
+void GpuDevice::endPass()
+{
+    for(const GpuResource* resource : _writtenResources)
+    {
+        resource->pendingBarriers = GL_ALL_BARRIER_BITS;
+        ++resource->version;
+    }
+
+    _writtenResources.clear();
+    _readOnlyHashes.clear();
+}
+
+std::size_t GpuDevice::contentHash(const GpuResource& resource) const
+{
+    std::vector<char> content;
+
+    if(const GpuImageResource* image = dynamic_cast<const GpuImageResource*>(&resource))
+    {
+        const GpuImageResourceHandle& handle = image->handle();
+        std::size_t texelSize = handle.internalFormat == GL_RGBA32F ? 16 : 4;
+        content.resize(std::size_t(handle.width) * handle.height * handle.depth * texelSize);
+        image->read(content.data());
+    }
+    else if(const GpuStorageResource* storage = dynamic_cast<const GpuStorageResource*>(&resource))
+    {
+        GLint size = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, storage->handle().bufferId);
+        glGetBufferParameteriv(GL_SHADER_STORAGE_BUFFER, GL_BUFFER_SIZE, &size);
+        content.resize(size);
+        storage->read(content.data(), content.size());
+    }
+
+    return std::hash<std::string_view>()(std::string_view(content.data(), content.size()));
 }
 
 void GpuDevice::clearSwapChain()
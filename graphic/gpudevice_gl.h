@@ -1,7 +1,11 @@
 #ifndef GPUDEVICE_GL_H
 #define GPUDEVICE_GL_H
 
+#include <memory>
+#include <vector>
+
 #include "gpuprograminterface_gl.h"
+#include "gpuresource.h"
 
 
 namespace unisim
@@ -12,6 +16,7 @@ class GpuStorageResource;
 class GpuTextureResource;
 class GpuImageResource;
 class GpuGeometryResource;
+class GpuTextureStreamer;
 
 struct GpuProgramConstantBindPoint;
 struct GpuProgramStorageBindPoint;
@@ -24,19 +29,50 @@ class GpuDevice
 public:
     GpuDevice();
     ~GpuDevice();
+
+    // Deletes the GL objects owned by the device, the context must still be current
+    void release();
     
     void bindBuffer(const GpuConstantResource& resource, const GpuProgramConstantBindPoint& bindPoint);
-    void bindBuffer(const GpuStorageResource& resource, const GpuProgramStorageBindPoint& bindPoint);
+    void bindBuffer(const GpuStorageResource& resource, const GpuProgramStorageBindPoint& bindPoint,
+                    GpuResourceAccess access = GpuResourceAccess::ReadWrite);
     void bindTexture(const GpuTextureResource& resource, const GpuProgramTextureBindPoint& unit);
     void bindTexture(const GpuImageResource& resource, const GpuProgramTextureBindPoint& unit);
-    void bindImage(const GpuImageResource& resource, const GpuProgramImageBindPoint& unit);
+    void bindImage(const GpuImageResource& resource, const GpuProgramImageBindPoint& unit,
+                   GpuResourceAccess access = GpuResourceAccess::ReadWrite);
 
+    // Only waits on the resources bound since the previous dispatch, which must all be rebound
     void dispatch(unsigned int workGroupCountX, unsigned int workGroupCountY = 1, unsigned int workGroupCountZ = 1);
+    void dispatchIndirect(const GpuStorageResource& args, std::size_t offset = 0);
     void draw(const GpuGeometryResource& resource);
 
     void clearSwapChain();
+
+    // Checks that read-only bindings are left untouched and that dispatches write tracked resources
+    void setBarrierValidation(bool enabled) { _validateBarriers = enabled; }
+
+    GpuTextureStreamer& textureStreamer() { return *_textureStreamer; }
+    const GpuTextureStreamer& textureStreamer() const { return *_textureStreamer; }
+
 private:
+    void trackBinding(const GpuResource& resource, GpuBarrierMask barrier, GpuResourceAccess access);
+    void flushBarriers();
+    void endPass();
+
+    // Barriers and validation around a compute dispatch
+    void beginDispatch();
+    void endDispatch();
+
+    std::size_t contentHash(const GpuResource& resource) const;
+
+    std::unique_ptr<GpuTextureStreamer> _textureStreamer;
+
+    // Barriers owed by the resources bound since the previous pass, issued once before the next one
+    GpuBarrierMask _barriers;
+    std::vector<const GpuResource*> _writtenResources;
 
+    bool _validateBarriers;
+    std::vector<std::pair<const GpuResource*, std::size_t>> _readOnlyHashes;
 };
 
 }
@@ -4,6 +4,7 @@
 #include <PilsCore/Utils/Logger.h>
 
 #include "graphic.h"
+#include "gpudevice.h"
 
 
 namespace unisim
@@ -49,6 +50,27 @@ GpuProgramImageBindPoint CompiledGpuProgramInterface::getImageBindPoint(const st
     return GpuProgramImageBindPoint::invalid();
 }
 
+void CompiledGpuProgramInterface::bind(GpuDevice& device, const GpuResourceManager& resources) const
+{
+    for(const auto& binding : _constantBindings)
+        device.bindBuffer(resources.get<GpuConstantResource>(binding.resource), binding.bindPoint);
+
+    for(const auto& binding : _storageBindings)
+        device.bindBuffer(resources.get<GpuStorageResource>(binding.resource), binding.bindPoint, binding.access);
+
+    // Textures are sampled from texture or image resources
+    for(const auto& binding : _textureBindings)
+    {
+        if(const GpuTextureResource* texture = resources.find<GpuTextureResource>(binding.resource))
+            device.bindTexture(*texture, binding.bindPoint);
+        else
+            device.bindTexture(resources.get<GpuImageResource>(binding.resource), binding.bindPoint);
+    }
+
+    for(const auto& binding : _imageBindings)
+        device.bindImage(resources.get<GpuImageResource>(binding.resource), binding.bindPoint, binding.access);
+}
+
 
 GpuProgramInterface::GpuProgramInterface()
 {
@@ -82,6 +104,8 @@ bool GpuProgramInterface::compile(CompiledGpuProgramInterface& compiledGpi, cons
 {
     bool ok = true;
 
+    compiledGpi = CompiledGpuProgramInterface();
+
     GpuProgramConstantBindPoint nextConstantBindPoint = GpuProgramConstantBindPoint::first();
     for(const auto& input : _constants)
     {
@@ -6,6 +6,8 @@
 #include <vector>
 #include <string>
 
+#include "gpuresource.h"
+
 
 #ifdef UNISIM_GRAPHIC_BACKEND_GL
 #include "gpuprograminterface_gl.h"
@@ -20,25 +22,33 @@ namespace unisim
 {
 
 class GraphicProgram;
+class GpuDevice;
 
+// Inputs declared with a resource are bound by CompiledGpuProgramInterface::bind
 struct GpuProgramConstantInput
 {
     std::string name;
+    ResourceId resource = Invalid_ResourceId;
 };
 
 struct GpuProgramStorageInput
 {
     std::string name;
+    ResourceId resource = Invalid_ResourceId;
+    GpuResourceAccess access = GpuResourceAccess::ReadWrite;
 };
 
 struct GpuProgramTextureInput
 {
     std::string name;
+    ResourceId resource = Invalid_ResourceId;
 };
 
 struct GpuProgramImageInput
 {
     std::string name;
+    ResourceId resource = Invalid_ResourceId;
+    GpuResourceAccess access = GpuResourceAccess::ReadWrite;
 };
 
 
@@ -54,9 +64,20 @@ public:
     GpuProgramTextureBindPoint  getTextureBindPoint(const std::string& name) const;
     GpuProgramImageBindPoint    getImageBindPoint(const std::string& name) const;
 
+    // Binds every input declared with a resource, names were resolved when compiled
+    void bind(GpuDevice& device, const GpuResourceManager& resources) const;
+
 private:
     friend class GpuProgramInterface;
 
+    template<typename BindPoint>
+    struct Binding
+    {
+        BindPoint bindPoint;
+        ResourceId resource;
+        GpuResourceAccess access;
+    };
+
     bool set(const GraphicProgram& program, const GpuProgramConstantBindPoint& bindPoint, const GpuProgramConstantInput& input);
     bool set(const GraphicProgram& program, const GpuProgramStorageBindPoint& bindPoint, const GpuProgramStorageInput& input);
     bool set(const GraphicProgram& program, const GpuProgramTextureBindPoint& bindPoint, const GpuProgramTextureInput& input);
@@ -67,6 +88,11 @@ private:
     std::map<std::string, GpuProgramStorageBindPoint> _storageBindPoints;
     std::map<std::string, GpuProgramTextureBindPoint> _textureBindPoints;
     std::map<std::string, GpuProgramImageBindPoint> _imageBindPoints;
+
+    std::vector<Binding<GpuProgramConstantBindPoint>> _constantBindings;
+    std::vector<Binding<GpuProgramStorageBindPoint>> _storageBindings;
+    std::vector<Binding<GpuProgramTextureBindPoint>> _textureBindings;
+    std::vector<Binding<GpuProgramImageBindPoint>> _imageBindings;
 };
 
 class GpuProgramInterface
@@ -79,6 +105,7 @@ public:
     bool declareTexture(const GpuProgramTextureInput& input);
     bool declareImage(const GpuProgramImageInput& input);
 
+    // Program bindings are set once per link, tasks keep the compiled interface with their program
     bool compile(CompiledGpuProgramInterface& compiledGpi, const GraphicProgram& program);
 
 private:
@@ -111,6 +111,9 @@ bool CompiledGpuProgramInterface::set(const GraphicProgram& program, const GpuPr
     glUniformBlockBinding(program.handle(), location, bindPoint.bindPoint);
     _constantBindPoints[input.name] = bindPoint;
 
+    if(input.resource != Invalid_ResourceId)
+        _constantBindings.push_back({bindPoint, input.resource, GpuResourceAccess::ReadOnly});
+
     return true;
 }
 
@@ -140,6 +143,9 @@ bool CompiledGpuProgramInterface::set(const GraphicProgram& program, const GpuPr
     glShaderStorageBlockBinding(program.handle(), location, bindPoint.bindPoint);
     _storageBindPoints[input.name] = bindPoint;
 
+    if(input.resource != Invalid_ResourceId)
+        _storageBindings.push_back({bindPoint, input.resource, input.access});
+
     return true;
 }
 
@@ -169,6 +175,9 @@ bool CompiledGpuProgramInterface::set(const GraphicProgram& program, const GpuPr
     glProgramUniform1i(program.handle(), location, bindPoint.bindPoint);
     _textureBindPoints[input.name] = bindPoint;
 
+    if(input.resource != Invalid_ResourceId)
+        _textureBindings.push_back({bindPoint, input.resource, GpuResourceAccess::ReadOnly});
+
     return true;
 }
 
@@ -198,6 +207,9 @@ bool CompiledGpuProgramInterface::set(const GraphicProgram& program, const GpuPr
     glProgramUniform1i(program.handle(), location, bindPoint.bindPoint);
     _imageBindPoints[input.name] = bindPoint;
 
+    if(input.resource != Invalid_ResourceId)
+        _imageBindings.push_back({bindPoint, input.resource, input.access});
+
     return true;
 }
 
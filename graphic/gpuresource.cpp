@@ -8,7 +8,9 @@ DefineResource(FullScreenTriangle);
 
 
 GpuResource::GpuResource(ResourceId id) :
-    id(id)
+    id(id),
+    pendingBarriers(0),
+    version(1)
 {
 }
 
@@ -42,6 +44,13 @@ ResourceId GpuResourceManager::registerDynamicResource(const std::string& name)
     return _resourceCount++;
 }
 
+uint64_t GpuResourceManager::version(ResourceId id) const
+{
+    PILS_ASSERT(id < _resourceCount, "Invalid resource ID");
+
+    return _resources[id] ? _resources[id]->version : 0;
+}
+
 void GpuResourceManager::initialize()
 {
     _resources.resize(_resourceCount);
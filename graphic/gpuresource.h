@@ -24,11 +24,23 @@ namespace unisim
 
 class GraphicContext;
 class CompiledGpuProgramInterface;
+class GpuTextureStreamer;
+struct GpuTextureUpload;
 
 
 typedef unsigned int ResourceId;
 const ResourceId Invalid_ResourceId = ~0x0;
 
+// Backend memory barrier bits
+typedef unsigned int GpuBarrierMask;
+
+// How a dispatch uses a bound image or storage buffer, read-only bindings are not waited on by later passes
+enum class GpuResourceAccess
+{
+    ReadOnly,
+    ReadWrite
+};
+
 #define ResourceName(name) ResourceId_##name
 #define DeclareResource(name) extern ResourceId ResourceName(name)
 #define DefineResource(name) ResourceId ResourceName(name) = GpuResourceManager::registerStaticResource(#name)
@@ -40,7 +52,16 @@ public:
     GpuResource(ResourceId id);
     virtual ~GpuResource();
 
+    // Issues the barriers among 'barriers' that the last shader write still requires
+    void waitShaderWrites(GpuBarrierMask barriers) const;
+
     ResourceId id;
+
+    // Barriers still owed to later accesses since the last dispatch that could write the resource
+    mutable GpuBarrierMask pendingBarriers;
+
+    // Incremented by every write, readers compare it to the version they last consumed
+    mutable uint64_t version;
 };
 
 class GpuTextureResource : public GpuResource
@@ -49,16 +70,23 @@ public:
     struct Definition
     {
         const Texture& texture;
+        // Uploads synchronously when null
+        GpuTextureStreamer* streamer = nullptr;
     };
 
     GpuTextureResource(ResourceId id, Definition def);
     GpuTextureResource(GpuTextureResourceHandle&& handle);
     ~GpuTextureResource();
 
+    // False while texels are still being streamed in
+    bool isReady() const;
+
     const GpuTextureResourceHandle& handle() const { return *_handle; }
 
 private:
     std::unique_ptr<GpuTextureResourceHandle> _handle;
+    std::shared_ptr<GpuTextureUpload> _upload;
+    GpuTextureStreamer* _streamer;
 };
 
 
@@ -71,6 +99,8 @@ public:
         int height;
         int depth;
         TextureFormat format;
+        // Depth is a layer count of a 2D array rather than 3D slices
+        bool layered = false;
     };
 
     GpuImageResource(ResourceId id, Definition def);
@@ -78,6 +108,21 @@ public:
 
     void update(const Definition& def) const;
 
+    // Whole image as RGBA texels of the image's format
+    void read(void* data) const;
+    void write(const void* data) const;
+
+    // Fenced copies of the whole image, see GpuStorageResource, resizing drops the copies in flight
+    bool requestRead() const;
+    bool fetchRead(void* data) const;
+    bool isReadInFlight() const;
+
+    // Images must have the same size and format
+    void copy(const GpuImageResource& source) const;
+
+    // Zeroes a rectangle of the image's first layer
+    void clear(int x, int y, int width, int height) const;
+
     const GpuImageResourceHandle& handle() const { return *_handle; }
 
 private:
@@ -119,6 +164,18 @@ public:
 
     void update(const Definition& def) const;
 
+    // Blocks until the GPU is done writing to the buffer
+    void read(void* data, std::size_t size) const;
+
+    // Queues a copy of the first 'size' bytes for a later fetchRead, false while every copy slot is in flight
+    bool requestRead(std::size_t size) const;
+
+    // Never blocks, false until a requested copy landed, 'data' then holds the latest one
+    bool fetchRead(void* data, std::size_t size) const;
+
+    // Zeroes 'size' bytes starting at 'offset' without a CPU round-trip
+    void clear(std::size_t offset, std::size_t size) const;
+
     const GpuStorageResourceHandle& handle() const { return *_handle; }
 
 private:
@@ -186,6 +243,13 @@ public:
     template<typename Resource>
     const Resource& get(ResourceId id) const;
 
+    // Null when the resource is not defined or of another type
+    template<typename Resource>
+    const Resource* find(ResourceId id) const;
+
+    // 0 while the resource is not defined
+    uint64_t version(ResourceId id) const;
+
 private:
     static unsigned int _staticResourceCount;
     static std::vector<std::string> _staticNames;
@@ -230,6 +294,14 @@ const Resource& GpuResourceManager::get(ResourceId id) const
     return *resource;
 }
 
+template<typename Resource>
+const Resource* GpuResourceManager::find(ResourceId id) const
+{
+    PILS_ASSERT(id < _resourceCount, "Invalid resource ID");
+
+    return dynamic_cast<const Resource*>(_resources[id].get());
+}
+
 }
 
 #endif // GPURESOURCE_H
@@ -1,15 +1,102 @@
 #include "gpuresource.h"
 
+#include <cstring>
+
+#include "gputexturestreamer.h"
+
 #include "../resource/texture.h"
 
 
 namespace unisim
 {
 
+namespace
+{
+
+void releaseReadback(GpuReadbackRing& ring)
+{
+    for(unsigned int i = 0; i < ring.count; ++i)
+        glDeleteSync(ring.fences[(ring.head + i) % GpuReadbackRing::SLOT_COUNT]);
+
+    ring.count = 0;
+
+    if(ring.bufferId != 0)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ring.bufferId);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glDeleteBuffers(1, &ring.bufferId);
+        ring.bufferId = 0;
+    }
+}
+
+// Slot of the next copy, -1 while every slot is in flight
+int reserveReadback(GpuReadbackRing& ring, std::size_t size)
+{
+    const unsigned int slotCount = GpuReadbackRing::SLOT_COUNT;
+
+    if(ring.count == slotCount)
+        return -1;
+
+    if(size > ring.slotSize)
+    {
+        // Slots can only be resized once their copies landed
+        if(ring.count > 0)
+            return -1;
+
+        releaseReadback(ring);
+
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &ring.bufferId);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ring.bufferId);
+        // Client storage keeps the slots in cached system memory
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size * slotCount, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+        ring.data = (const unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size * slotCount, flags);
+        ring.slotSize = size;
+        ring.head = 0;
+    }
+
+    return (ring.head + ring.count) % slotCount;
+}
+
+// Fences the copy issued into 'slot'
+void commitReadback(GpuReadbackRing& ring, int slot)
+{
+    ring.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++ring.count;
+}
+
+// Latest slot whose copy landed, -1 if none did
+int fetchReadback(GpuReadbackRing& ring)
+{
+    // Fences signal in submission order
+    int landedSlot = -1;
+    while(ring.count > 0)
+    {
+        GLsync fence = ring.fences[ring.head];
+
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(fence);
+        landedSlot = ring.head;
+
+        ring.head = (ring.head + 1) % GpuReadbackRing::SLOT_COUNT;
+        --ring.count;
+    }
+
+    return landedSlot;
+}
+
+}
+
+
 // TEXTURE //
 
 GpuTextureResource::GpuTextureResource(ResourceId id, Definition def) :
-    GpuResource(id)
+    GpuResource(id),
+    _streamer(def.streamer)
 {
     _handle.reset(new GpuTextureResourceHandle());
     _handle->dimension = GL_TEXTURE_2D;
@@ -23,7 +110,7 @@ GpuTextureResource::GpuTextureResource(ResourceId id, Definition def) :
     glTexParameteri(_handle->dimension, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(_handle->dimension, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    GLint internalFormat = 0;
+    GLenum internalFormat = 0;
     GLenum type = 0;
     switch(def.texture.format)
     {
@@ -39,6 +126,24 @@ GpuTextureResource::GpuTextureResource(ResourceId id, Definition def) :
 
     GLenum format = def.texture.numComponents == 3 ? GL_RGB : GL_RGBA;
 
+    // CPU copy may have been released after a previous upload
+    Texture& texNoConst = const_cast<Texture&>(def.texture);
+    if(!texNoConst.reloadData())
+        PILS_ERROR("Uploading texture without pixel data: ", def.texture.fileName);
+
+    // For ImGui
+    texNoConst.handle = _handle->texId;
+
+    if(_streamer != nullptr && texNoConst.isDataResident())
+    {
+        // Texels are copied later on, a few rows at a time
+        glTexStorage2D(_handle->dimension, 1, internalFormat, def.texture.width, def.texture.height);
+        glBindTexture(_handle->dimension, 0);
+
+        _upload = _streamer->enqueue(texNoConst, _handle->texId, format, type);
+        return;
+    }
+
     glTexImage2D(
         _handle->dimension,
         0, // mip level
@@ -48,32 +153,63 @@ GpuTextureResource::GpuTextureResource(ResourceId id, Definition def) :
         0, // border
         format,
         type,
-        &def.texture.data.front());
+        def.texture.isDataResident() ? &def.texture.data.front() : nullptr);
 
-    // For ImGui
-    Texture& texNoConst = const_cast<Texture&>(def.texture);
-    texNoConst.handle = _handle->texId;
+    texNoConst.releaseData();
 
     glBindTexture(_handle->dimension, 0);
 }
 
 GpuTextureResource::GpuTextureResource(GpuTextureResourceHandle&& handle) :
     GpuResource(0),
-    _handle(new GpuTextureResourceHandle(std::move(handle)))
+    _handle(new GpuTextureResourceHandle(std::move(handle))),
+    _streamer(nullptr)
 {
 }
 
 GpuTextureResource::~GpuTextureResource()
 {
+    if(_upload && !_upload->ready)
+        _streamer->cancel(_upload);
+
     glDeleteTextures(1, &_handle->texId);
 }
 
+bool GpuTextureResource::isReady() const
+{
+    return !_upload || _upload->ready;
+}
+
+
+// RESOURCE //
+void GpuResource::waitShaderWrites(GpuBarrierMask barriers) const
+{
+    barriers &= pendingBarriers;
+    if(barriers == 0)
+        return;
+
+    glMemoryBarrier(barriers);
+    pendingBarriers &= ~barriers;
+}
+
 
 // IMAGE //
 GpuImageResource::GpuImageResource(ResourceId id, Definition def) :
     GpuResource(id)
 {
     _handle.reset(new GpuImageResourceHandle());
+    update(def);
+}
+
+GpuImageResource::~GpuImageResource()
+{
+    releaseReadback(_handle->readback);
+    glDeleteTextures(1, &_handle->texId);
+}
+
+void GpuImageResource::update(const Definition& def) const
+{
+    ++version;
 
     switch(def.format)
     {
@@ -88,7 +224,20 @@ GpuImageResource::GpuImageResource(ResourceId id, Definition def) :
         _handle->internalFormat = GL_RGBA8;
     }
 
-    _handle->dimension = def.depth > 1 ? GL_TEXTURE_3D : GL_TEXTURE_2D;
+    if (def.layered)
+        _handle->dimension = GL_TEXTURE_2D_ARRAY;
+    else
+        _handle->dimension = def.depth > 1 ? GL_TEXTURE_3D : GL_TEXTURE_2D;
+    _handle->width = def.width;
+    _handle->height = def.height;
+    _handle->depth = def.depth;
+
+    // Copies in flight hold texels of the previous size
+    releaseReadback(_handle->readback);
+
+    // Immutable storage cannot be respecified, resizing requires a new texture
+    if(_handle->texId != 0)
+        glDeleteTextures(1, &_handle->texId);
 
     glGenTextures(1, &_handle->texId);
     glBindTexture(_handle->dimension, _handle->texId);
@@ -104,7 +253,7 @@ GpuImageResource::GpuImageResource(ResourceId id, Definition def) :
 
     if (_handle->dimension == GL_TEXTURE_2D)
         glTexStorage2D(_handle->dimension, 1, _handle->internalFormat, def.width, def.height);
-    else if (_handle->dimension == GL_TEXTURE_3D)
+    else if (_handle->dimension == GL_TEXTURE_3D || _handle->dimension == GL_TEXTURE_2D_ARRAY)
         glTexStorage3D(_handle->dimension, 1, _handle->internalFormat, def.width, def.height, def.depth);
     else
         PILS_FATAL("Unexpected texture dimension");
@@ -112,38 +261,97 @@ GpuImageResource::GpuImageResource(ResourceId id, Definition def) :
     glBindTexture(_handle->dimension, 0);
 }
 
-GpuImageResource::~GpuImageResource()
+void GpuImageResource::read(void* data) const
 {
-    glDeleteTextures(1, &_handle->texId);
+    waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    GLenum type = _handle->internalFormat == GL_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindTexture(_handle->dimension, _handle->texId);
+    glGetTexImage(_handle->dimension, 0, GL_RGBA, type, data);
+    glBindTexture(_handle->dimension, 0);
 }
 
-void GpuImageResource::update(const Definition& def) const
+bool GpuImageResource::requestRead() const
 {
-    switch(def.format)
-    {
-    case TextureFormat::R8G8B8A8_UNORM:
-        _handle->internalFormat = GL_RGBA8;
-        break;
-    case TextureFormat::R32G32B32A32_FLOAT:
-        _handle->internalFormat = GL_RGBA32F;
-        break;
-    default:
-        PILS_FATAL("Texture format not supported");
-        _handle->internalFormat = GL_RGBA8;
-    }
+    GLenum type = _handle->internalFormat == GL_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
+    std::size_t texelSize = type == GL_FLOAT ? 4 * sizeof(GLfloat) : 4;
+    std::size_t size = texelSize * _handle->width * _handle->height * _handle->depth;
+
+    int slot = reserveReadback(_handle->readback, size);
+    if(slot < 0)
+        return false;
+
+    waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _handle->readback.bufferId);
+    glBindTexture(_handle->dimension, _handle->texId);
+    glGetTexImage(_handle->dimension, 0, GL_RGBA, type, (void*)(slot * _handle->readback.slotSize));
+    glBindTexture(_handle->dimension, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    commitReadback(_handle->readback, slot);
+
+    return true;
+}
+
+bool GpuImageResource::fetchRead(void* data) const
+{
+    int slot = fetchReadback(_handle->readback);
+    if(slot < 0)
+        return false;
+
+    std::memcpy(data, _handle->readback.data + slot * _handle->readback.slotSize, _handle->readback.slotSize);
+
+    return true;
+}
+
+bool GpuImageResource::isReadInFlight() const
+{
+    return _handle->readback.count > 0;
+}
+
+void GpuImageResource::write(const void* data) const
+{
+    waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    ++version;
+
+    GLenum type = _handle->internalFormat == GL_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
 
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     glBindTexture(_handle->dimension, _handle->texId);
 
     if (_handle->dimension == GL_TEXTURE_2D)
-        glTexStorage2D(_handle->dimension, 1, _handle->internalFormat, def.width, def.height);
-    else if (_handle->dimension == GL_TEXTURE_3D)
-        glTexStorage3D(_handle->dimension, 1, _handle->internalFormat, def.width, def.height, def.depth);
+        glTexSubImage2D(_handle->dimension, 0, 0, 0, _handle->width, _handle->height, GL_RGBA, type, data);
     else
-        PILS_FATAL("Unexpected texture dimension");
+        glTexSubImage3D(_handle->dimension, 0, 0, 0, 0, _handle->width, _handle->height, _handle->depth, GL_RGBA, type, data);
 
     glBindTexture(_handle->dimension, 0);
 }
 
+void GpuImageResource::copy(const GpuImageResource& source) const
+{
+    source.waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    ++version;
+
+    glCopyImageSubData(
+        source._handle->texId, source._handle->dimension, 0, 0, 0, 0,
+        _handle->texId, _handle->dimension, 0, 0, 0, 0,
+        _handle->width, _handle->height, _handle->depth);
+}
+
+void GpuImageResource::clear(int x, int y, int width, int height) const
+{
+    waitShaderWrites(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    ++version;
+
+    GLenum type = _handle->internalFormat == GL_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+    glClearTexSubImage(_handle->texId, 0, x, y, 0, width, height, 1, GL_RGBA, type, nullptr);
+}
+
 
 // BINDLESS //
 GpuBindlessResource::GpuBindlessResource(ResourceId id, Definition def) :
@@ -198,16 +406,67 @@ GpuStorageResource::GpuStorageResource(ResourceId id, Definition def) :
 
 GpuStorageResource::~GpuStorageResource()
 {
+    releaseReadback(_handle->readback);
     glDeleteBuffers(1, &_handle->bufferId);
 }
 
 void GpuStorageResource::update(const Definition& def) const
 {
+    waitShaderWrites(GL_BUFFER_UPDATE_BARRIER_BIT);
+    ++version;
+
     GLsizei dataSize = def.elemSize * def.elemCount;
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, _handle->bufferId);
     glBufferData(GL_SHADER_STORAGE_BUFFER, dataSize, def.data, GL_STATIC_DRAW);
 }
 
+void GpuStorageResource::read(void* data, std::size_t size) const
+{
+    waitShaderWrites(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _handle->bufferId);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+}
+
+bool GpuStorageResource::requestRead(std::size_t size) const
+{
+    int slot = reserveReadback(_handle->readback, size);
+    if(slot < 0)
+        return false;
+
+    waitShaderWrites(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, _handle->bufferId);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _handle->readback.bufferId);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, slot * _handle->readback.slotSize, size);
+
+    commitReadback(_handle->readback, slot);
+
+    return true;
+}
+
+bool GpuStorageResource::fetchRead(void* data, std::size_t size) const
+{
+    PILS_ASSERT(_handle->readback.count == 0 || size <= _handle->readback.slotSize, "Fetching more than was requested");
+
+    int slot = fetchReadback(_handle->readback);
+    if(slot < 0)
+        return false;
+
+    std::memcpy(data, _handle->readback.data + slot * _handle->readback.slotSize, size);
+
+    return true;
+}
+
+void GpuStorageResource::clear(std::size_t offset, std::size_t size) const
+{
+    waitShaderWrites(GL_BUFFER_UPDATE_BARRIER_BIT);
+    ++version;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _handle->bufferId);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, offset, size, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
 
 // CONSTANT //
 GpuConstantResource::GpuConstantResource(ResourceId id, Definition def) :
@@ -226,6 +485,8 @@ GpuConstantResource::~GpuConstantResource()
 
 void GpuConstantResource::update(const Definition& def) const
 {
+    ++version;
+
     glBindBuffer(GL_UNIFORM_BUFFER, _handle->bufferId);
     glBufferData(GL_UNIFORM_BUFFER, def.size, def.data, GL_STREAM_DRAW);
 }
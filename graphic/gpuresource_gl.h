@@ -16,14 +16,42 @@ public:
     GLenum dimension;
 };
 
+// Persistently mapped ring of fenced copies, allocated on the first requested read
+class GpuReadbackRing
+{
+public:
+    static const unsigned int SLOT_COUNT = 3;
+
+    GpuReadbackRing() :
+        bufferId(0),
+        data(nullptr),
+        slotSize(0),
+        fences{},
+        head(0),
+        count(0)
+    {}
+
+    GLuint bufferId;
+    const unsigned char* data;
+    std::size_t slotSize;
+    GLsync fences[SLOT_COUNT];
+    unsigned int head;
+    unsigned int count;
+};
+
 class GpuImageResourceHandle
 {
 public:
-    GpuImageResourceHandle() : texId(0), internalFormat(-1) {}
+    GpuImageResourceHandle() : texId(0), internalFormat(-1), width(0), height(0), depth(0) {}
 
     GLuint texId;
     GLenum internalFormat;
     GLenum dimension;
+    int width;
+    int height;
+    int depth;
+
+    GpuReadbackRing readback;
 };
 
 class GpuBindlessResourceHandle
@@ -50,6 +78,8 @@ public:
     GpuStorageResourceHandle() : bufferId(0) {}
 
     GLuint bufferId;
+
+    GpuReadbackRing readback;
 };
 
 class GpuConstantResourceHandle
@@ -0,0 +1,120 @@
+#ifndef GPUTEXTURESTREAMER_H
+#define GPUTEXTURESTREAMER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "graphic.h"
+
+
+namespace unisim
+{
+
+struct Texture;
+
+
+struct GpuTextureUpload
+{
+    Texture* texture;
+
+    GLuint texId;
+    GLenum format;
+    GLenum type;
+    int width;
+    int height;
+    std::size_t rowSize;
+
+    // Rows handed out to workers (guarded by the streamer's mutex)
+    int stagedRows;
+    // Rows whose copy to the texture has been fenced (render thread only)
+    int completedRows;
+    // Workers currently copying rows of this upload
+    int activeCopies;
+
+    std::atomic<bool> ready;
+    std::atomic<bool> cancelled;
+};
+
+using GpuTextureUploadPtr = std::shared_ptr<GpuTextureUpload>;
+
+
+class GpuTextureStreamer
+{
+    GpuTextureStreamer(const GpuTextureStreamer&) = delete;
+
+public:
+    GpuTextureStreamer();
+    ~GpuTextureStreamer();
+
+    // Stops the workers and deletes the ring and its fences, the GL context must still be current
+    void release();
+
+    // Texture storage must already be allocated
+    GpuTextureUploadPtr enqueue(Texture& texture, GLuint texId, GLenum format, GLenum type);
+    void cancel(const GpuTextureUploadPtr& upload);
+
+    // Render thread only, issues at most 'byteBudget' bytes of copies.
+    // A single row goes through when it is larger than the budget, so uploads always progress.
+    void process(std::size_t byteBudget);
+
+    std::size_t pendingUploadCount() const;
+
+private:
+    struct StagedChunk
+    {
+        GpuTextureUploadPtr upload;
+        unsigned int slot;
+        int firstRow;
+        int rowCount;
+
+        // Bytes of the slot already copied by previous frames
+        std::size_t slotOffset;
+    };
+
+    struct InFlightChunk
+    {
+        GpuTextureUploadPtr upload;
+        unsigned int slot;
+        int rowCount;
+        GLsync fence;
+
+        // Set on the last copy out of the slot
+        bool releasesSlot;
+    };
+
+    void initialize();
+    void stopWorkers();
+    void workerLoop();
+
+    static const std::size_t SLOT_SIZE;
+    static const unsigned int SLOT_COUNT;
+    static const unsigned int WORKER_COUNT;
+
+    bool _initialized;
+
+    GLuint _pixelBuffer;
+    unsigned char* _mappedRing;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _copyDone;
+    bool _stopping;
+
+    std::deque<GpuTextureUploadPtr> _pendingUploads;
+    std::vector<unsigned int> _freeSlots;
+    std::deque<StagedChunk> _stagedChunks;
+
+    // Render thread only
+    std::deque<InFlightChunk> _inFlightChunks;
+
+    std::vector<std::thread> _workers;
+};
+
+}
+
+#endif // GPUTEXTURESTREAMER_H
@@ -0,0 +1,317 @@
+#include "gputexturestreamer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <PilsCore/Utils/Assert.h>
+
+#include "../resource/texture.h"
+
+
+namespace unisim
+{
+
+const std::size_t GpuTextureStreamer::SLOT_SIZE = 4 * 1024 * 1024;
+const unsigned int GpuTextureStreamer::SLOT_COUNT = 16;
+const unsigned int GpuTextureStreamer::WORKER_COUNT = 2;
+
+
+GpuTextureStreamer::GpuTextureStreamer() :
+    _initialized(false),
+    _pixelBuffer(0),
+    _mappedRing(nullptr),
+    _stopping(false)
+{
+}
+
+GpuTextureStreamer::~GpuTextureStreamer()
+{
+    // GL objects cannot be deleted anymore once the context is gone, see release()
+    stopWorkers();
+}
+
+void GpuTextureStreamer::release()
+{
+    if(!_initialized)
+        return;
+
+    stopWorkers();
+
+    for(const InFlightChunk& chunk : _inFlightChunks)
+        glDeleteSync(chunk.fence);
+
+    _inFlightChunks.clear();
+    _stagedChunks.clear();
+    _pendingUploads.clear();
+    _freeSlots.clear();
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &_pixelBuffer);
+
+    _pixelBuffer = 0;
+    _mappedRing = nullptr;
+    _initialized = false;
+}
+
+void GpuTextureStreamer::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+
+    for(std::thread& worker : _workers)
+        worker.join();
+
+    _workers.clear();
+}
+
+void GpuTextureStreamer::initialize()
+{
+    GLsizeiptr ringSize = SLOT_SIZE * SLOT_COUNT;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &_pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ringSize, nullptr, flags);
+    _mappedRing = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringSize, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    PILS_ASSERT(_mappedRing != nullptr, "Could not map texture streaming ring");
+
+    for(unsigned int i = 0; i < SLOT_COUNT; ++i)
+        _freeSlots.push_back(i);
+
+    _stopping = false;
+
+    for(unsigned int i = 0; i < WORKER_COUNT; ++i)
+        _workers.emplace_back(&GpuTextureStreamer::workerLoop, this);
+
+    _initialized = true;
+}
+
+GpuTextureUploadPtr GpuTextureStreamer::enqueue(Texture& texture, GLuint texId, GLenum format, GLenum type)
+{
+    if(!_initialized)
+        initialize();
+
+    PILS_ASSERT(texture.isDataResident(), "Streaming a texture without pixel data");
+
+    GpuTextureUploadPtr upload(new GpuTextureUpload());
+    upload->texture = &texture;
+    upload->texId = texId;
+    upload->format = format;
+    upload->type = type;
+    upload->width = texture.width;
+    upload->height = texture.height;
+    upload->rowSize = texture.data.size() / texture.height;
+    upload->stagedRows = 0;
+    upload->completedRows = 0;
+    upload->activeCopies = 0;
+    upload->ready = false;
+    upload->cancelled = false;
+
+    PILS_ASSERT(upload->rowSize <= SLOT_SIZE, "Texture rows do not fit in a streaming slot");
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pendingUploads.push_back(upload);
+    }
+    _workAvailable.notify_one();
+
+    return upload;
+}
+
+void GpuTextureStreamer::cancel(const GpuTextureUploadPtr& upload)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    upload->cancelled = true;
+
+    auto it = std::find(_pendingUploads.begin(), _pendingUploads.end(), upload);
+    if(it != _pendingUploads.end())
+        _pendingUploads.erase(it);
+
+    // Workers may still be reading the texture's pixels
+    _copyDone.wait(lock, [&]{ return upload->activeCopies == 0; });
+}
+
+void GpuTextureStreamer::process(std::size_t byteBudget)
+{
+    if(!_initialized)
+        return;
+
+    // Fences signal in submission order
+    std::vector<unsigned int> retiredSlots;
+    while(!_inFlightChunks.empty())
+    {
+        InFlightChunk& chunk = _inFlightChunks.front();
+
+        GLenum status = glClientWaitSync(chunk.fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(chunk.fence);
+        if(chunk.releasesSlot)
+            retiredSlots.push_back(chunk.slot);
+
+        GpuTextureUpload& upload = *chunk.upload;
+        upload.completedRows += chunk.rowCount;
+
+        if(!upload.cancelled && upload.completedRows == upload.height)
+        {
+            upload.texture->releaseData();
+            upload.ready = true;
+        }
+
+        _inFlightChunks.pop_front();
+    }
+
+    // Rows of a staged chunk copied this frame
+    struct ChunkCopy
+    {
+        StagedChunk rows;
+        bool releasesSlot;
+    };
+
+    std::vector<ChunkCopy> copies;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for(unsigned int slot : retiredSlots)
+            _freeSlots.push_back(slot);
+
+        std::size_t byteCount = 0;
+        while(!_stagedChunks.empty())
+        {
+            StagedChunk& chunk = _stagedChunks.front();
+
+            if(chunk.upload->cancelled)
+            {
+                // Copies of earlier rows may still read the slot, it is released behind a fence
+                if(chunk.slotOffset > 0)
+                    copies.push_back({{chunk.upload, chunk.slot, chunk.firstRow, 0, chunk.slotOffset}, true});
+                else
+                    _freeSlots.push_back(chunk.slot);
+
+                _stagedChunks.pop_front();
+                continue;
+            }
+
+            // Stop before the rows that would exceed the budget, the rest of the chunk waits for the next frames
+            std::size_t rowSize = chunk.upload->rowSize;
+            std::size_t remainingBytes = byteCount < byteBudget ? byteBudget - byteCount : 0;
+            int rowCount = int(std::min(std::size_t(chunk.rowCount), remainingBytes / rowSize));
+            if(rowCount == 0 && byteCount == 0)
+                rowCount = 1;
+
+            if(rowCount == 0)
+                break;
+
+            bool releasesSlot = rowCount == chunk.rowCount;
+
+            byteCount += rowCount * rowSize;
+            copies.push_back({{chunk.upload, chunk.slot, chunk.firstRow, rowCount, chunk.slotOffset}, releasesSlot});
+
+            if(releasesSlot)
+            {
+                _stagedChunks.pop_front();
+            }
+            else
+            {
+                chunk.firstRow += rowCount;
+                chunk.rowCount -= rowCount;
+                chunk.slotOffset += rowCount * rowSize;
+            }
+        }
+    }
+
+    if(!retiredSlots.empty())
+        _workAvailable.notify_all();
+
+    if(copies.empty())
+        return;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffer);
+
+    for(const ChunkCopy& copy : copies)
+    {
+        const StagedChunk& chunk = copy.rows;
+        const GpuTextureUpload& upload = *chunk.upload;
+
+        if(chunk.rowCount > 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, upload.texId);
+            glTexSubImage2D(
+                GL_TEXTURE_2D,
+                0, // mip level
+                0, chunk.firstRow,
+                upload.width, chunk.rowCount,
+                upload.format,
+                upload.type,
+                (void*)(chunk.slot * SLOT_SIZE + chunk.slotOffset));
+        }
+
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _inFlightChunks.push_back({chunk.upload, chunk.slot, chunk.rowCount, fence, copy.releasesSlot});
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+std::size_t GpuTextureStreamer::pendingUploadCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pendingUploads.size() + _stagedChunks.size() + _inFlightChunks.size();
+}
+
+void GpuTextureStreamer::workerLoop()
+{
+    while(true)
+    {
+        GpuTextureUploadPtr upload;
+        unsigned int slot = 0;
+        int firstRow = 0;
+        int rowCount = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workAvailable.wait(lock, [&]{
+                return _stopping || (!_pendingUploads.empty() && !_freeSlots.empty()); });
+
+            if(_stopping)
+                return;
+
+            upload = _pendingUploads.front();
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+
+            int rowsPerSlot = std::max(1, int(SLOT_SIZE / upload->rowSize));
+            firstRow = upload->stagedRows;
+            rowCount = std::min(rowsPerSlot, upload->height - firstRow);
+
+            upload->stagedRows += rowCount;
+            ++upload->activeCopies;
+
+            if(upload->stagedRows == upload->height)
+                _pendingUploads.pop_front();
+        }
+
+        std::memcpy(_mappedRing + slot * SLOT_SIZE,
+                    &upload->texture->data[firstRow * upload->rowSize],
+                    rowCount * upload->rowSize);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --upload->activeCopies;
+            _stagedChunks.push_back({upload, slot, firstRow, rowCount, 0});
+        }
+        _copyDone.notify_all();
+    }
+}
+
+}
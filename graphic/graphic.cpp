@@ -9,6 +9,7 @@ namespace unisim
 
 const std::string GLSL_VERSION__HEADER = "#version 440\n";
 std::string g_GlslExtensions;
+std::string g_ProgramCacheDirectory = "cache/programs/";
 
 
 std::string loadSource(const std::string& fileName)
@@ -26,4 +27,11 @@ std::string loadSource(const std::string& fileName)
     return str;
 }
 
+bool isSpirvFile(const std::string& fileName)
+{
+    const std::string extension = ".spv";
+    return fileName.size() >= extension.size() &&
+           fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+}
+
 }
@@ -1,6 +1,7 @@
 #ifndef GRAPHIC_H
 #define GRAPHIC_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
@@ -19,20 +20,36 @@ namespace unisim
 enum class ShaderType {Vertex, Fragment, Compute};
 
 
+// GLSL shaders are only compiled when their program is missing from the program cache
 class GraphicShader
 {
     GraphicShader(const GraphicShader&) = delete;
 
 public:
-    GraphicShader(const std::string& name, GraphicShaderHandle&& handle);
+    GraphicShader(const std::string& name, ShaderType type, std::string&& source, uint64_t sourceHash);
+    GraphicShader(const std::string& name, uint64_t sourceHash, GraphicShaderHandle&& handle);
     ~GraphicShader();
 
     std::string name() const { return _name; }
 
+    // Identifies the source text, including version, extensions and defines
+    uint64_t sourceHash() const { return _sourceHash; }
+
+    bool isCompiled() const { return _isCompiled; }
+
+    // Returns right away when the driver compiles in parallel, compile() waits for the result
+    void beginCompile();
+    bool isCompileComplete() const;
+    bool compile();
+
     const GraphicShaderHandle& handle() const { return *_handle; }
 
 private:
     std::string _name;
+    ShaderType _type;
+    std::string _source;
+    uint64_t _sourceHash;
+    bool _isCompiled;
     std::unique_ptr<GraphicShaderHandle> _handle;
 };
 
@@ -75,8 +92,14 @@ public:
 extern const std::string GLSL_VERSION__HEADER;
 extern std::string g_GlslExtensions;
 
+// Linked program binaries are stored in this directory, caching is disabled when empty
+extern std::string g_ProgramCacheDirectory;
+
 std::string loadSource(const std::string& fileName);
 
+// Offline compiled SPIR-V files (.spv) are ingested as is, they take no defines
+bool isSpirvFile(const std::string& fileName);
+
 bool generateShader(
     std::shared_ptr<GraphicShader>& shader,
     ShaderType shaderType,
@@ -117,6 +140,18 @@ bool generateComputeProgram(
     const std::string& name,
     const std::vector<std::shared_ptr<GraphicShader>>& shaders);
 
+// Programs missing from the caches compile and link on the driver's threads.
+// Their generation fails until they are ready and leaves the previous program in place,
+// isProgramPending() tells it apart from an error for the last generation that failed.
+bool isProgramPending();
+
+// Polls the compiles and links in flight without waiting, true once none is left
+bool updatePendingPrograms();
+void finishPendingPrograms();
+
+// Drops the ready and failed programs held for the generations to retry
+void releaseFinishedPrograms();
+
 }
 
 #endif // GRAPHIC_H
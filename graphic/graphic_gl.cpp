@@ -1,6 +1,13 @@
 #ifdef UNISIM_GRAPHIC_BACKEND_GL
 
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include "graphic.h"
 
@@ -8,6 +15,27 @@
 namespace unisim
 {
 
+// Shaders and programs still referenced by a task, keyed by source hash and program cache key
+std::unordered_map<uint64_t, std::weak_ptr<GraphicShader>> g_LiveShaders;
+std::unordered_map<uint64_t, std::weak_ptr<GraphicProgram>> g_LivePrograms;
+
+// Programs compiling or linking, keyed by program cache key
+struct PendingProgram
+{
+    std::string name;
+    std::vector<std::shared_ptr<GraphicShader>> shaders;
+
+    // Non zero once the shaders are compiled and the link started
+    GLuint programId;
+
+    // Set when ready, held until the generation that started it is retried
+    GraphicProgramPtr program;
+    bool hasFailed;
+};
+
+std::unordered_map<uint64_t, PendingProgram> g_PendingPrograms;
+bool g_IsProgramPending = false;
+
 GraphicShaderHandle::GraphicShaderHandle(GraphicShaderHandle&& other) :
     _shaderId(other._shaderId),
     _releaseOnDestroy(other._releaseOnDestroy)
@@ -32,8 +60,21 @@ GraphicShaderHandle::~GraphicShaderHandle()
     }
 }
 
-GraphicShader::GraphicShader(const std::string& name, GraphicShaderHandle&& handle) :
+GraphicShader::GraphicShader(const std::string& name, ShaderType type, std::string&& source, uint64_t sourceHash) :
     _name(name),
+    _type(type),
+    _source(std::move(source)),
+    _sourceHash(sourceHash),
+    _isCompiled(false)
+{
+
+}
+
+GraphicShader::GraphicShader(const std::string& name, uint64_t sourceHash, GraphicShaderHandle&& handle) :
+    _name(name),
+    _type(ShaderType::Compute),
+    _sourceHash(sourceHash),
+    _isCompiled(true),
     _handle(new GraphicShaderHandle(std::move(handle)))
 {
 
@@ -44,6 +85,75 @@ GraphicShader::~GraphicShader()
 
 }
 
+bool checkCompileStatus(GLuint shaderId);
+
+GLuint createShader(ShaderType shaderType)
+{
+    switch(shaderType)
+    {
+    case ShaderType::Vertex:   return glCreateShader(GL_VERTEX_SHADER);
+    case ShaderType::Fragment: return glCreateShader(GL_FRAGMENT_SHADER);
+    case ShaderType::Compute:  return glCreateShader(GL_COMPUTE_SHADER);
+    default: std::cerr << "Invalid shader type" << std::endl; return 0;
+    }
+}
+
+void GraphicShader::beginCompile()
+{
+    if(_handle)
+        return;
+
+    GLuint shaderId = createShader(_type);
+    if(shaderId == 0)
+        return;
+
+    const GLchar* source = _source.c_str();
+    glShaderSource(shaderId, 1, &source, NULL);
+
+    std::cout << "Compiling shader '" << _name << "'" << std::endl;
+    glCompileShader(shaderId);
+
+    _handle.reset(new GraphicShaderHandle(shaderId));
+}
+
+bool GraphicShader::isCompileComplete() const
+{
+    if(_isCompiled || !_handle)
+        return true;
+
+    // Without the extension the status query is what waits for the compile
+    if(!GLEW_KHR_parallel_shader_compile)
+        return true;
+
+    GLint isComplete = GL_FALSE;
+    glGetShaderiv(*_handle, GL_COMPLETION_STATUS_KHR, &isComplete);
+    return isComplete == GL_TRUE;
+}
+
+bool GraphicShader::compile()
+{
+    if(_isCompiled)
+        return true;
+
+    beginCompile();
+    if(!_handle)
+        return false;
+
+    // Waits for the driver's compiler threads
+    if(!checkCompileStatus(*_handle))
+    {
+        _handle.reset();
+        return false;
+    }
+
+    _isCompiled = true;
+
+    // The source is not needed anymore once compiled
+    std::string().swap(_source);
+
+    return true;
+}
+
 
 GraphicProgramHandle::GraphicProgramHandle(GraphicProgramHandle&& other) :
     _programId(other._programId)
@@ -106,12 +216,8 @@ void printShaderInfoLog(GLuint shaderId)
     std::cout << shader_log << std::endl;
 }
 
-bool compileShader(GLuint shaderId, const std::string& name)
+bool checkCompileStatus(GLuint shaderId)
 {
-    std::cout << "Compiling shader '" << name.c_str() << "'" << std::endl;
-
-    glCompileShader(shaderId);
-
     // check for compile errors
     int params = -1;
     glGetShaderiv(shaderId, GL_COMPILE_STATUS, &params);
@@ -177,55 +283,102 @@ bool generateShader(
     const std::vector<std::string>& srcs,
     const std::vector<std::string>& defines)
 {
-    std::vector<std::string> srcUris;
-
     std::vector<std::string> lineDirectives;
     lineDirectives.reserve(1 + srcs.size());
 
-    std::vector<const GLchar*> shaderSrc;
-    shaderSrc.push_back(GLSL_VERSION__HEADER.c_str());
-    shaderSrc.push_back(g_GlslExtensions.c_str());
+    std::string source = GLSL_VERSION__HEADER + g_GlslExtensions;
 
-    std::string definitionBloc;
     if(!defines.empty())
     {
+        source += defineLine(lineDirectives, 1);
         for(const auto& define : defines)
-            definitionBloc += "#define " + define + "\n";
-        srcUris.push_back("DEFINES");
-        shaderSrc.push_back(defineLine(lineDirectives, 1));
-        shaderSrc.push_back(definitionBloc.c_str());
+            source += "#define " + define + "\n";
     }
 
-    const char* LINE_RETURN = "\n";
     for(std::size_t s = 0; s < srcs.size(); ++s)
     {
-        const std::string& src = srcs[s];
-        srcUris.push_back("srcs " + std::to_string(s));
-        shaderSrc.push_back(defineLine(lineDirectives, 1));
-        shaderSrc.push_back(src.c_str());
-        shaderSrc.push_back(LINE_RETURN);
+        source += defineLine(lineDirectives, 1);
+        source += srcs[s];
+        source += "\n";
     }
 
-    GLuint shaderId = 0;
-    switch(shaderType)
+    uint64_t sourceHash = std::hash<std::string>()(source);
+
+    // Unchanged sources reuse the shader compiled by their previous definition
+    if(std::shared_ptr<GraphicShader> liveShader = g_LiveShaders[sourceHash].lock())
+    {
+        shader = liveShader;
+        return true;
+    }
+
+    // Compilation is deferred to the program generation, on program cache misses
+    shader.reset(new GraphicShader(shaderName, shaderType, std::move(source), sourceHash));
+    g_LiveShaders[sourceHash] = shader;
+
+    return true;
+}
+
+bool generateSpirvShader(
+    std::shared_ptr<GraphicShader>& shader,
+    ShaderType shaderType,
+    const std::string& fileName)
+{
+    if(!GLEW_ARB_gl_spirv)
     {
-    case ShaderType::Vertex:   shaderId = glCreateShader(GL_VERTEX_SHADER);   break;
-    case ShaderType::Fragment: shaderId = glCreateShader(GL_FRAGMENT_SHADER); break;
-    case ShaderType::Compute:  shaderId = glCreateShader(GL_COMPUTE_SHADER);  break;
-    default: std::cerr << "Invalid shader type" << std::endl; return false;
+        std::cerr << "GL_ARB_gl_spirv is not supported, cannot load " << fileName << std::endl;
+        return false;
     }
 
-    glShaderSource(shaderId, shaderSrc.size(), &shaderSrc[0], NULL);
-    if(!compileShader(shaderId, shaderName))
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file)
     {
+        std::cerr << "SPIR-V file not found: " << fileName << std::endl;
+        return false;
+    }
+
+    std::string binary((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+
+    GLuint shaderId = createShader(shaderType);
+    if(shaderId == 0)
+        return false;
+
+    std::cout << "Specializing SPIR-V shader '" << fileName << "'" << std::endl;
+
+    glShaderBinary(1, &shaderId, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, binary.data(), GLsizei(binary.size()));
+    glSpecializeShaderARB(shaderId, "main", 0, nullptr, nullptr);
+
+    int params = -1;
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &params);
+
+    if (GL_TRUE != params)
+    {
+        std::cerr << "ERROR: SPIR-V shader " << fileName << " could not be specialized" << std::endl;
+        printShaderInfoLog(shaderId);
         glDeleteShader(shaderId);
         return false;
     }
-    else
+
+    shader.reset(new GraphicShader(fileName, std::hash<std::string>()(binary), GraphicShaderHandle(shaderId)));
+    return true;
+}
+
+bool generateShader(
+    std::shared_ptr<GraphicShader>& shader,
+    ShaderType shaderType,
+    const std::string& fileName,
+    const std::vector<std::string>& defines)
+{
+    if(isSpirvFile(fileName))
     {
-        shader.reset(new GraphicShader(shaderName, GraphicShaderHandle(shaderId)));
-        return true;
+        if(!defines.empty())
+            std::cerr << "Defines are ignored by SPIR-V shader " << fileName << std::endl;
+
+        return generateSpirvShader(shader, shaderType, fileName);
     }
+
+    std::string src = loadSource(fileName);
+    return generateShader(shader, shaderType, fileName, {src}, defines);
 }
 
 bool generateVertexShader(
@@ -233,8 +386,7 @@ bool generateVertexShader(
     const std::string& fileName,
     const std::vector<std::string>& defines)
 {
-    std::string src = loadSource(fileName);
-    return generateShader(shader, ShaderType::Vertex, fileName, {src}, defines);
+    return generateShader(shader, ShaderType::Vertex, fileName, defines);
 }
 
 bool generateFragmentShader(
@@ -242,8 +394,7 @@ bool generateFragmentShader(
     const std::string& fileName,
     const std::vector<std::string>& defines)
 {
-    std::string src = loadSource(fileName);
-    return generateShader(shader, ShaderType::Fragment, fileName, {src}, defines);
+    return generateShader(shader, ShaderType::Fragment, fileName, defines);
 }
 
 bool generateComputerShader(
@@ -251,111 +402,301 @@ bool generateComputerShader(
     const std::string& fileName,
     const std::vector<std::string>& defines)
 {
-    std::string src = loadSource(fileName);
-    return generateShader(shader, ShaderType::Compute, fileName, {src}, defines);
+    return generateShader(shader, ShaderType::Compute, fileName, defines);
 }
 
-bool generateGraphicProgram(
-    GraphicProgramPtr& program,
-    const std::string& name,
-    const std::string& vertexFileName,
-    const std::string& fragmentFileName,
-    const std::vector<std::string>& defines)
+struct ProgramBinaryHeader
 {
-    std::shared_ptr<GraphicShader> vertex;
-    if(!generateVertexShader(vertex, vertexFileName, defines))
+    char magic[8];
+    uint64_t key;
+    GLenum format;
+    GLint length;
+};
+
+const char PROGRAM_BINARY_MAGIC[8] = {'U', 'N', 'I', 'P', 'R', 'G', '0', '1'};
+
+// Binaries are only valid for the driver that produced them
+uint64_t programCacheKey(const std::vector<std::shared_ptr<GraphicShader>>& shaders)
+{
+    static const std::string driver =
+        std::string((const char*)glGetString(GL_VENDOR)) + "\n" +
+        std::string((const char*)glGetString(GL_RENDERER)) + "\n" +
+        std::string((const char*)glGetString(GL_VERSION));
+
+    uint64_t key = std::hash<std::string>()(driver);
+    for(const auto& shader : shaders)
+        key = key ^ (shader->sourceHash() + 0x9e3779b9 + (key<<6) + (key>>2));
+
+    return key;
+}
+
+std::string programCacheFileName(uint64_t key)
+{
+    std::stringstream fileName;
+    fileName << g_ProgramCacheDirectory << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+    return fileName.str();
+}
+
+bool loadProgramBinary(GLuint programId, uint64_t key)
+{
+    if(g_ProgramCacheDirectory.empty())
         return false;
 
-    std::shared_ptr<GraphicShader> fragment;
-    if(!generateFragmentShader(fragment, fragmentFileName, defines))
+    std::ifstream file(programCacheFileName(key), std::ios::binary);
+    if(!file)
         return false;
 
-    GLuint programId = glCreateProgram();
-    glAttachShader(programId, vertex->handle());
-    glAttachShader(programId, fragment->handle());
-    glLinkProgram(programId);
+    ProgramBinaryHeader header;
+    file.read((char*)&header, sizeof(ProgramBinaryHeader));
 
-    if(!validateProgram(programId, vertexFileName + " - " + fragmentFileName))
-    {
-        glDeleteProgram(programId);
-        vertex.reset();
-        fragment.reset();
+    if(!file || std::memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC)) != 0 ||
+       header.key != key || header.length <= 0)
+        return false;
 
+    std::vector<char> binary(header.length);
+    file.read(binary.data(), binary.size());
+    if(!file)
         return false;
+
+    glProgramBinary(programId, header.format, binary.data(), header.length);
+
+    // Drivers reject binaries of other driver versions
+    int linkStatus = -1;
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
+
+    return linkStatus == GL_TRUE;
+}
+
+void saveProgramBinary(GLuint programId, uint64_t key)
+{
+    if(g_ProgramCacheDirectory.empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+
+    ProgramBinaryHeader header;
+    std::memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC));
+    header.key = key;
+
+    std::vector<char> binary(length);
+    glGetProgramBinary(programId, length, &header.length, &header.format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(g_ProgramCacheDirectory, error);
+
+    std::ofstream file(programCacheFileName(key), std::ios::binary);
+    file.write((const char*)&header, sizeof(ProgramBinaryHeader));
+    file.write(binary.data(), header.length);
+
+    if(!file)
+        std::cerr << "Could not write program binary " << programCacheFileName(key) << std::endl;
+}
+
+// Returns true once the program is ready or has failed
+bool advancePendingProgram(uint64_t key, PendingProgram& pending)
+{
+    if(pending.program || pending.hasFailed)
+        return true;
+
+    if(pending.programId == 0)
+    {
+        for(const auto& shader : pending.shaders)
+        {
+            if(!shader->isCompileComplete())
+                return false;
+        }
+
+        GLuint programId = glCreateProgram();
+
+        for(const auto& shader : pending.shaders)
+        {
+            if(!shader->compile())
+            {
+                glDeleteProgram(programId);
+                pending.hasFailed = true;
+                return true;
+            }
+
+            glAttachShader(programId, shader->handle());
+        }
+
+        glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(programId);
+
+        pending.programId = programId;
+    }
+
+    if(GLEW_KHR_parallel_shader_compile)
+    {
+        GLint isComplete = GL_FALSE;
+        glGetProgramiv(pending.programId, GL_COMPLETION_STATUS_KHR, &isComplete);
+        if(isComplete != GL_TRUE)
+            return false;
+    }
+
+    GLuint programId = pending.programId;
+    pending.programId = 0;
+
+    if(!validateProgram(programId, pending.name))
+    {
+        glDeleteProgram(programId);
+        pending.hasFailed = true;
+        return true;
     }
 
-    program.reset(
+    saveProgramBinary(programId, key);
+
+    pending.program.reset(
         new GraphicProgram(
-            name,
+            pending.name,
             std::move(GraphicProgramHandle(programId)),
-            {vertex, fragment}
+            pending.shaders
         )
     );
 
+    g_LivePrograms[key] = pending.program;
+
     return true;
 }
 
-bool generateComputeProgram(
+bool linkProgram(
     GraphicProgramPtr& program,
     const std::string& name,
-    const std::string& computeFileName,
-    const std::vector<std::string>& defines)
+    const std::vector<std::shared_ptr<GraphicShader>>& shaders)
 {
-    std::shared_ptr<GraphicShader> compute;
-    if(!generateComputerShader(compute, computeFileName, defines))
-        return false;
+    g_IsProgramPending = false;
 
-    GLuint programId = glCreateProgram();
+    uint64_t key = programCacheKey(shaders);
 
-    glAttachShader(programId, compute->handle());
-    glLinkProgram(programId);
+    // Programs whose shaders did not change are kept as is
+    if(GraphicProgramPtr liveProgram = g_LivePrograms[key].lock())
+    {
+        program = liveProgram;
+        return true;
+    }
 
-    if(!validateProgram(programId, computeFileName))
+    auto pending = g_PendingPrograms.find(key);
+
+    if(pending == g_PendingPrograms.end())
     {
+        GLuint programId = glCreateProgram();
+
+        if(loadProgramBinary(programId, key))
+        {
+            std::cout << "Loaded program '" << name << "' from the program cache" << std::endl;
+
+            program.reset(
+                new GraphicProgram(
+                    name,
+                    std::move(GraphicProgramHandle(programId)),
+                    shaders
+                )
+            );
+
+            g_LivePrograms[key] = program;
+
+            return true;
+        }
+
+        // Failed binary loads leave the program unusable
         glDeleteProgram(programId);
-        compute.reset();
 
+        // Compiles run in parallel on the driver's threads when GL_KHR_parallel_shader_compile is supported
+        for(const auto& shader : shaders)
+            shader->beginCompile();
+
+        pending = g_PendingPrograms.emplace(key, PendingProgram{name, shaders, 0, nullptr, false}).first;
+    }
+
+    if(!advancePendingProgram(key, pending->second))
+    {
+        g_IsProgramPending = true;
         return false;
     }
 
-    program.reset(
-        new GraphicProgram(
-            name,
-            std::move(GraphicProgramHandle(programId)),
-            {compute}
-        )
-    );
+    if(pending->second.hasFailed)
+        return false;
+
+    program = pending->second.program;
 
     return true;
 }
 
-bool generateComputeProgram(
+bool isProgramPending()
+{
+    return g_IsProgramPending;
+}
+
+bool updatePendingPrograms()
+{
+    bool isDone = true;
+
+    for(auto& pending : g_PendingPrograms)
+    {
+        if(!advancePendingProgram(pending.first, pending.second))
+            isDone = false;
+    }
+
+    return isDone;
+}
+
+void finishPendingPrograms()
+{
+    while(!updatePendingPrograms())
+        std::this_thread::yield();
+}
+
+void releaseFinishedPrograms()
+{
+    for(auto it = g_PendingPrograms.begin(); it != g_PendingPrograms.end();)
+    {
+        if(it->second.program || it->second.hasFailed)
+            it = g_PendingPrograms.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool generateGraphicProgram(
     GraphicProgramPtr& program,
     const std::string& name,
-    const std::vector<std::shared_ptr<GraphicShader>>& shaders)
+    const std::string& vertexFileName,
+    const std::string& fragmentFileName,
+    const std::vector<std::string>& defines)
 {
-    GLuint programId = glCreateProgram();
+    std::shared_ptr<GraphicShader> vertex;
+    if(!generateVertexShader(vertex, vertexFileName, defines))
+        return false;
 
-    for(const auto& shader : shaders)
-        glAttachShader(programId, shader->handle());
+    std::shared_ptr<GraphicShader> fragment;
+    if(!generateFragmentShader(fragment, fragmentFileName, defines))
+        return false;
 
-    glLinkProgram(programId);
+    return linkProgram(program, name, {vertex, fragment});
+}
 
-    if(!validateProgram(programId, name))
-    {
-        glDeleteProgram(programId);
+bool generateComputeProgram(
+    GraphicProgramPtr& program,
+    const std::string& name,
+    const std::string& computeFileName,
+    const std::vector<std::string>& defines)
+{
+    std::shared_ptr<GraphicShader> compute;
+    if(!generateComputerShader(compute, computeFileName, defines))
         return false;
-    }
 
-    program.reset(
-        new GraphicProgram(
-            name,
-            std::move(GraphicProgramHandle(programId)),
-            shaders
-        )
-    );
+    return linkProgram(program, name, {compute});
+}
 
-    return true;
+bool generateComputeProgram(
+    GraphicProgramPtr& program,
+    const std::string& name,
+    const std::vector<std::shared_ptr<GraphicShader>>& shaders)
+{
+    return linkProgram(program, name, shaders);
 }
 
 }
@@ -126,7 +126,7 @@ Window::Window() :
 {
 }
 
-Window::Window(int requestedWidth, int requestedHeight) :
+Window::Window(int requestedWidth, int requestedHeight, bool headless) :
     _glfwWindow(nullptr),
     _width(-1),
     _height(-1)
@@ -151,6 +151,10 @@ Window::Window(int requestedWidth, int requestedHeight) :
     int viewportX = 0, viewportY = 0;
     GLFWmonitor* chosenMonitor = nullptr;
 
+    // Offscreen contexts (e.g. GLFW built with OSMesa) have no monitors
+    if(headless)
+        monitorCount = 0;
+
     for(int i = 0; i < monitorCount; ++i)
     {
         int xpos, ypos, width, height;
@@ -184,7 +188,7 @@ Window::Window(int requestedWidth, int requestedHeight) :
         }
     }
 
-    if(!chosenMonitor)
+    if(!chosenMonitor && !headless)
     {
         return;
     }
@@ -193,6 +197,7 @@ Window::Window(int requestedWidth, int requestedHeight) :
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_ANY_PROFILE);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_VISIBLE, headless ? GLFW_FALSE : GLFW_TRUE);
 
     _width = viewportW;
     _height = viewportH;
@@ -207,13 +212,20 @@ Window::Window(int requestedWidth, int requestedHeight) :
 
     WindowRegistry::getInstance().registerWindow(this, handle());
 
-    glfwSetWindowPos(_glfwWindow, viewportX, viewportY);
+    if(!headless)
+        glfwSetWindowPos(_glfwWindow, viewportX, viewportY);
+
     glfwMakeContextCurrent(_glfwWindow);
 
     glewExperimental = GL_TRUE;
     glewInit();
 
-    glfwSwapInterval(1);
+    // Let the driver compile the shaders of a program in parallel
+    if(GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+    // Offline renders are not paced by the display
+    glfwSwapInterval(headless ? 0 : 1);
 
     glfwSetWindowSizeCallback(_glfwWindow, glfWHandleResize);
     glfwSetKeyCallback(_glfwWindow, glfWHandleKeyboard);
@@ -305,6 +317,11 @@ void Window::pollEvents()
     glfwPollEvents();
 }
 
+void Window::waitEvents(double timeout)
+{
+    glfwWaitEventsTimeout(timeout);
+}
+
 void Window::present()
 {
     PILS_ASSERT(_glfwWindow != nullptr, "GLFW window pointer is null");
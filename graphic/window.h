@@ -52,7 +52,8 @@ class Window
 {
 public:
     Window();
-    Window(int requestedWidth, int requestedHeight);
+    // Headless windows are hidden and keep the requested size whatever the monitors
+    Window(int requestedWidth, int requestedHeight, bool headless = false);
     ~Window();
 
     bool isValid() const;
@@ -73,6 +74,8 @@ public:
 
     bool shouldClose();
     void pollEvents();
+    // Blocks until an event arrives or 'timeout' seconds elapsed
+    void waitEvents(double timeout);
     void present();
     void close();
 
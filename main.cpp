@@ -1,5 +1,16 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
 #include "universe.h"
 
+#include "engine/grading/imagewriter.h"
+#include "engine/pathtracer/accumulation.h"
+
 #include "PilsCore/test/tests.h"
 
 void initPilsLogger()
@@ -17,8 +28,137 @@ void initPilsLogger()
     pils::Logger::getInstance().initialize(logSettings);
 }
 
+void printUsage()
+{
+    std::cout << "Usage: unisim [--project pathtracer|solar]\n"
+              << "              [--out <file.exr|file.png|file.acc> [--camera <file>] [--spp <count>] [--size <width>x<height>]\n"
+              << "               [--denoise] [--worker <index>]\n"
+              << "               [--frames <count> [--sim-step <seconds>] [--time-step <hours>]]]\n"
+              << "       unisim --merge <file.acc|directory> [--merge ...] --out <file.exr|file.png|file.acc>\n"
+              << "Renders offscreen until the sample count is reached when an output file is given.\n"
+              << "Workers write partial accumulations (.acc) of disjoint samples, merging sums them up.\n"
+              << "Sequences advance the simulation and the time of day between frames,\n"
+              << "their output file is a printf pattern of the frame index, e.g. frame_%04d.png.\n";
+}
+
+bool parseArguments(int argc, char ** argv,
+                    std::string& projectName,
+                    unisim::OfflineRenderSettings& settings,
+                    std::vector<std::string>& mergeInputs)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if(arg == "--project" && hasValue)
+            projectName = argv[++i];
+        else if(arg == "--camera" && hasValue)
+            settings.cameraFile = argv[++i];
+        else if(arg == "--spp" && hasValue)
+            settings.sampleCount = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--out" && hasValue)
+            settings.outputFile = argv[++i];
+        else if(arg == "--size" && hasValue)
+        {
+            if(std::sscanf(argv[++i], "%dx%d", &settings.width, &settings.height) != 2 ||
+               settings.width <= 0 || settings.height <= 0)
+            {
+                std::cerr << "Invalid size '" << argv[i] << "', expected <width>x<height>" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--denoise")
+            settings.denoise = true;
+        else if(arg == "--worker" && hasValue)
+            settings.workerIndex = std::max(0, std::atoi(argv[++i]));
+        else if(arg == "--frames" && hasValue)
+            settings.frameCount = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--sim-step" && hasValue)
+            settings.simulationStep = std::atof(argv[++i]);
+        else if(arg == "--time-step" && hasValue)
+            settings.timeOfDayStep = float(std::atof(argv[++i]));
+        else if(arg == "--merge" && hasValue)
+            mergeInputs.push_back(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown argument '" << arg << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if(settings.frameCount > 1 && settings.outputFile.find('%') == std::string::npos)
+    {
+        std::cerr << "Sequence output file '" << settings.outputFile << "' has no frame index pattern" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int mergeAccumulations(const std::vector<std::string>& inputs, const std::string& output)
+{
+    // Directories shared by the workers are merged whole
+    std::vector<std::string> fileNames;
+    for(const std::string& input : inputs)
+    {
+        if(std::filesystem::is_directory(input))
+        {
+            for(const auto& entry : std::filesystem::directory_iterator(input))
+                if(entry.path().extension() == ".acc")
+                    fileNames.push_back(entry.path().string());
+        }
+        else
+        {
+            fileNames.push_back(input);
+        }
+    }
+
+    std::sort(fileNames.begin(), fileNames.end());
+
+    unisim::Accumulation merged;
+    for(const std::string& fileName : fileNames)
+    {
+        unisim::Accumulation accumulation;
+        if(!accumulation.load(fileName) || !merged.merge(accumulation))
+            return -1;
+
+        std::cout << "Merged " << fileName << std::endl;
+    }
+
+    if(fileNames.empty())
+    {
+        std::cerr << "No accumulation to merge" << std::endl;
+        return -1;
+    }
+
+    return unisim::ImageWriter::save(merged, output) ? 0 : -1;
+}
+
 int main(int argc, char ** argv)
 {
+    std::string projectName = "pathtracer";
+    unisim::OfflineRenderSettings offlineSettings = {"", 1024, "", 1920, 1080, false, 0, 1, 0.0, 0.0f};
+    std::vector<std::string> mergeInputs;
+
+    if(!parseArguments(argc, argv, projectName, offlineSettings, mergeInputs))
+    {
+        printUsage();
+        return -1;
+    }
+
+    // Merging needs no GPU
+    if(!mergeInputs.empty())
+    {
+        if(offlineSettings.outputFile.empty())
+        {
+            printUsage();
+            return -1;
+        }
+
+        return mergeAccumulations(mergeInputs, offlineSettings.outputFile);
+    }
+
     initPilsLogger();
     bool allTestsPassed = runPilsCoreTests();
 
@@ -28,6 +168,10 @@ int main(int argc, char ** argv)
         return -1;
     }
 
-    unisim::Universe universe;
+    unisim::Universe universe(projectName);
+
+    if(!offlineSettings.outputFile.empty())
+        return universe.render(offlineSettings);
+
     return universe.launch();
 }
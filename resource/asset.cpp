@@ -0,0 +1,157 @@
+#include "asset.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <imgui/imgui.h>
+
+#include "texture.h"
+
+
+namespace unisim
+{
+
+// TEXTURE ASSET //
+
+TextureAsset::TextureAsset(const std::string& fileName) :
+    _fileName(fileName),
+    _state(State::Unloaded),
+    _priority(0.0f)
+{
+}
+
+TextureAsset::~TextureAsset()
+{
+    if(_state == State::Requested)
+        AssetLoader::GetInstance().cancel(this);
+}
+
+Texture* TextureAsset::texture() const
+{
+    return _state == State::Loaded ? _texture.get() : nullptr;
+}
+
+void TextureAsset::request(float priority)
+{
+    // Requests are cheap enough to be issued every frame
+    float current = _priority;
+    while(priority > current && !_priority.compare_exchange_weak(current, priority))
+        ;
+
+    State expected = State::Unloaded;
+    if(_state.compare_exchange_strong(expected, State::Requested))
+        AssetLoader::GetInstance().enqueue(this);
+}
+
+void TextureAsset::ui()
+{
+    ImGui::Text("File %s", _fileName.c_str());
+
+    switch(_state)
+    {
+    case State::Unloaded:
+        ImGui::Text("Not Loaded");
+        break;
+    case State::Requested:
+        ImGui::Text("Loading (priority %g)", float(_priority));
+        break;
+    case State::Loaded:
+        _texture->ui();
+        break;
+    case State::Failed:
+        ImGui::Text("Failed to load");
+        break;
+    }
+}
+
+
+// ASSET LOADER //
+
+AssetLoader::AssetLoader() :
+    _stopping(false),
+    _loading(nullptr)
+{
+    _worker = std::thread(&AssetLoader::workerLoop, this);
+}
+
+AssetLoader::~AssetLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+
+    _worker.join();
+}
+
+AssetLoader& AssetLoader::GetInstance()
+{
+    static AssetLoader g_Instance;
+    return g_Instance;
+}
+
+void AssetLoader::enqueue(TextureAsset* asset)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(asset);
+    }
+    _workAvailable.notify_one();
+}
+
+void AssetLoader::cancel(TextureAsset* asset)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto it = std::find(_queue.begin(), _queue.end(), asset);
+    if(it != _queue.end())
+        _queue.erase(it);
+
+    _loadDone.wait(lock, [&]{ return _loading != asset; });
+}
+
+std::size_t AssetLoader::pendingCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queue.size();
+}
+
+void AssetLoader::workerLoop()
+{
+    while(true)
+    {
+        TextureAsset* asset = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workAvailable.wait(lock, [&]{ return _stopping || !_queue.empty(); });
+
+            if(_stopping)
+                return;
+
+            // Priorities keep changing while assets wait in the queue
+            auto it = std::max_element(_queue.begin(), _queue.end(), [](TextureAsset* a, TextureAsset* b){
+                return a->_priority < b->_priority; });
+
+            asset = *it;
+            _queue.erase(it);
+            _loading = asset;
+        }
+
+        asset->_texture.reset(Texture::load(asset->_fileName));
+        asset->_state = asset->_texture ? TextureAsset::State::Loaded : TextureAsset::State::Failed;
+
+        // Missing, corrupt and unsupported files are only known once decoded
+        if(!asset->_texture)
+            std::cerr << "Could not load texture " << asset->_fileName << std::endl;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _loading = nullptr;
+        }
+        _loadDone.notify_all();
+    }
+}
+
+}
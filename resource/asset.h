@@ -0,0 +1,83 @@
+#ifndef ASSET_H
+#define ASSET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace unisim
+{
+
+struct Texture;
+
+
+class TextureAsset
+{
+    TextureAsset(const TextureAsset&) = delete;
+
+public:
+    enum class State {Unloaded, Requested, Loaded, Failed};
+
+    TextureAsset(const std::string& fileName);
+    ~TextureAsset();
+
+    const std::string& fileName() const { return _fileName; }
+
+    State state() const { return _state; }
+
+    // Null until the background loader is done with it
+    Texture* texture() const;
+
+    // Larger priorities are loaded first
+    void request(float priority);
+
+    void ui();
+
+private:
+    friend class AssetLoader;
+
+    std::string _fileName;
+    std::atomic<State> _state;
+    std::atomic<float> _priority;
+    std::unique_ptr<Texture> _texture;
+};
+
+using TextureAssetPtr = std::shared_ptr<TextureAsset>;
+
+
+class AssetLoader
+{
+    AssetLoader();
+
+public:
+    ~AssetLoader();
+
+    static AssetLoader& GetInstance();
+
+    void enqueue(TextureAsset* asset);
+    void cancel(TextureAsset* asset);
+
+    std::size_t pendingCount() const;
+
+private:
+    void workerLoop();
+
+    mutable std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _loadDone;
+    bool _stopping;
+
+    std::vector<TextureAsset*> _queue;
+    TextureAsset* _loading;
+
+    std::thread _worker;
+};
+
+}
+
+#endif // ASSET_H
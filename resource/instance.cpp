@@ -1,5 +1,7 @@
 #include "instance.h"
 
+#include <limits>
+
 #include <imgui/imgui.h>
 
 #include "../resource/body.h"
@@ -32,6 +34,31 @@ void Instance::setBody(const std::shared_ptr<Body>& body)
     _body = body;
 }
 
+double Instance::boundingRadius() const
+{
+    double radius = 0.0;
+
+    for(const auto& primitive : _primitives)
+    {
+        switch(primitive->type())
+        {
+        case Primitive::Mesh :
+            for(const Vertex& vertex : static_cast<const Mesh&>(*primitive).vertices())
+                radius = glm::max(radius, double(glm::length(vertex.position)));
+            break;
+        case Primitive::Sphere :
+            radius = glm::max(radius, double(static_cast<const Sphere&>(*primitive).radius()));
+            break;
+        case Primitive::Plane :
+            return std::numeric_limits<double>::infinity();
+        default:
+            break;
+        }
+    }
+
+    return radius;
+}
+
 void Instance::ui()
 {
     if(ImGui::TreeNode("Body"))
@@ -34,6 +34,9 @@ public:
     void setPrimitives(const std::vector<std::shared_ptr<Primitive>>& primitives) { _primitives = primitives; }
     void addPrimitives(const std::shared_ptr<Primitive>& primitive) { _primitives.push_back(primitive); }
 
+    // Radius of a sphere centered on the body containing all primitives
+    double boundingRadius() const;
+
     void ui();
 
 private:
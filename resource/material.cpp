@@ -2,6 +2,7 @@
 
 #include <imgui/imgui.h>
 
+#include "../resource/asset.h"
 #include "../resource/texture.h"
 
 namespace unisim
@@ -9,8 +10,6 @@ namespace unisim
 
 Material::Material(const std::string& name) :
     _name(name),
-    _albedo(nullptr),
-    _specular(nullptr),
     _defaultAlbedo(1, 1, 1),
     _defaultEmissionColor(0, 0, 0),
     _defaultEmissionLuminance(0),
@@ -23,7 +22,16 @@ Material::Material(const std::string& name) :
 
 Material::~Material()
 {
-    delete _albedo;
+}
+
+Texture* Material::albedo() const
+{
+    return _albedo ? _albedo->texture() : nullptr;
+}
+
+Texture* Material::specular() const
+{
+    return _specular ? _specular->texture() : nullptr;
 }
 
 
@@ -57,30 +65,15 @@ void Material::setDefaultReflectance(float reflectance)
     _defaultReflectance = reflectance;
 }
 
-bool Material::loadAlbedo(const std::string& fileName)
+void Material::loadAlbedo(const std::string& fileName)
 {
-    if(_albedo)
-    {
-        delete _albedo;
-        _albedo = nullptr;
-    }
-
-    _albedo = Texture::load(fileName);
-
-    return _albedo != nullptr;
+    // Actual loading is deferred until the material is seen
+    _albedo.reset(new TextureAsset(fileName));
 }
 
-bool Material::loadSpecular(const std::string &fileName)
+void Material::loadSpecular(const std::string &fileName)
 {
-    if(_specular)
-    {
-        delete _specular;
-        _specular = nullptr;
-    }
-
-    _specular = Texture::load(fileName);
-
-    return _specular != nullptr;
+    _specular.reset(new TextureAsset(fileName));
 }
 
 void Material::ui()
@@ -13,6 +13,7 @@ namespace unisim
 {
 
 struct Texture;
+class TextureAsset;
 
 
 using MaterialId = uint32_t;
@@ -27,11 +28,14 @@ public:
 
     const std::string& name() const { return _name;}
 
-    Texture* albedo() const { return _albedo; }
-    bool loadAlbedo(const std::string& fileName);
+    // Textures are loaded lazily, null until then. Loading failures are reported by their asset.
+    Texture* albedo() const;
+    TextureAsset* albedoAsset() const { return _albedo.get(); }
+    void loadAlbedo(const std::string& fileName);
 
-    Texture* specular() const { return _specular; }
-    bool loadSpecular(const std::string& fileName);
+    Texture* specular() const;
+    TextureAsset* specularAsset() const { return _specular.get(); }
+    void loadSpecular(const std::string& fileName);
 
     glm::vec3 defaultAlbedo() const { return _defaultAlbedo; }
     void setDefaultAlbedo(const glm::vec3& albedo);
@@ -55,8 +59,8 @@ public:
 
 private:
     std::string _name;
-    Texture* _albedo;
-    Texture* _specular;
+    std::shared_ptr<TextureAsset> _albedo;
+    std::shared_ptr<TextureAsset> _specular;
 
     glm::vec3 _defaultAlbedo;
     glm::vec3 _defaultEmissionColor;
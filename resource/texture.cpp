@@ -1,6 +1,7 @@
 #include "texture.h"
 
 #include <iostream>
+#include <memory>
 
 #include <stdio.h>
 #include <setjmp.h>
@@ -48,6 +49,7 @@ Texture::Texture() :
     depth(1),
     format(TextureFormat::R8G8B8A8_UNORM),
     numComponents(4),
+    residency(TextureResidency::Resident),
     handle(0)
 {
 
@@ -64,6 +66,7 @@ Texture::Texture(TextureFormat format, unsigned char* pixelData) :
     depth(1),
     format(format),
     numComponents(4),
+    residency(TextureResidency::Resident),
     handle(0)
 {
     data.resize(4);
@@ -75,16 +78,26 @@ Texture::Texture(TextureFormat format, unsigned char* pixelData) :
 
 Texture* Texture::load(const std::string& fileName)
 {
+    Texture* texture = nullptr;
+
     if(fileName.find(".jpg") != std::string::npos)
-        return loadJpeg(fileName);
+        texture = loadJpeg(fileName);
     else if(fileName.find(".png") != std::string::npos)
-        return loadPng(fileName);
+        texture = loadPng(fileName);
     else if(fileName.find(".exr") != std::string::npos)
-        return loadExr(fileName);
+        texture = loadExr(fileName);
     else
         std::cerr << "Unknow file type: " << fileName << std::endl;
 
-    return nullptr;
+    // Textures backed by a file can always be reloaded,
+    // no need to keep their pixels around once on the GPU
+    if(texture)
+    {
+        texture->fileName = fileName;
+        texture->residency = TextureResidency::Released;
+    }
+
+    return texture;
 }
 
 Texture* Texture::loadJpeg(const std::string& fileName)
@@ -295,12 +308,133 @@ Texture* Texture::loadExr(const std::string& fileName)
     }
 }
 
+bool Texture::save(const std::string& fileName) const
+{
+    if(fileName.find(".png") != std::string::npos)
+        return savePng(fileName);
+    else if(fileName.find(".exr") != std::string::npos)
+        return saveExr(fileName);
+
+    std::cerr << "Unknow file type: " << fileName << std::endl;
+    return false;
+}
+
+bool Texture::savePng(const std::string& fileName) const
+{
+    if(format != TextureFormat::R8G8B8A8_UNORM)
+    {
+        std::cerr << "PNG files only support 8 bit textures: " << fileName << std::endl;
+        return false;
+    }
+
+    FILE* fp = fopen(fileName.c_str(), "wb");
+    if(!fp)
+        return false;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if(!png)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    png_infop info = png_create_info_struct(png);
+    if(!info || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        fclose(fp);
+        return false;
+    }
+
+    png_init_io(png, fp);
+
+    png_set_IHDR(png, info, width, height, 8,
+                 PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    std::size_t lineStride = std::size_t(width) * numComponents;
+    for(int y = 0; y < height; y++)
+        png_write_row(png, const_cast<png_bytep>(&data.at(lineStride * y)));
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    fclose(fp);
+
+    return true;
+}
+
+bool Texture::saveExr(const std::string& fileName) const
+{
+    if(format != TextureFormat::R32G32B32A32_FLOAT)
+    {
+        std::cerr << "EXR files only support float textures: " << fileName << std::endl;
+        return false;
+    }
+
+    const char* err = nullptr;
+    int ret = SaveEXR((const float*)data.data(), width, height, numComponents, 0, fileName.c_str(), &err);
+
+    if (ret != TINYEXR_SUCCESS)
+    {
+        if (err)
+        {
+            std::cerr << "TinyEXR error :" << err << std::endl;
+            FreeEXRErrorMessage(err);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool Texture::releaseData()
+{
+    if(residency != TextureResidency::Released || fileName.empty())
+        return false;
+
+    // Swap with an empty vector to actually give the memory back
+    std::vector<unsigned char>().swap(data);
+
+    return true;
+}
+
+bool Texture::reloadData()
+{
+    if(isDataResident())
+        return true;
+
+    if(fileName.empty())
+        return false;
+
+    std::unique_ptr<Texture> reloaded(load(fileName));
+    if(!reloaded)
+    {
+        std::cerr << "Could not reload texture: " << fileName << std::endl;
+        return false;
+    }
+
+    if(reloaded->width != width || reloaded->height != height || reloaded->format != format)
+    {
+        std::cerr << "Texture changed on disk since it was first loaded: " << fileName << std::endl;
+        return false;
+    }
+
+    data.swap(reloaded->data);
+
+    return true;
+}
+
 void Texture::ui()
 {
     int dimensions[2] = {width, height};
     ImGui::InputInt2("Dimensions", &dimensions[0], ImGuiInputTextFlags_ReadOnly);
     ImGui::Text("Format %s", format == TextureFormat::R8G8B8A8_UNORM ? "UNORM8" : "Float32");
     ImGui::Text("Num Components %d", numComponents);
+    ImGui::Text("CPU Copy %s", isDataResident() ? "Resident" : "Released");
+    // Preview is read from the GPU copy, CPU pixels are not needed
     uint64_t handle64 = handle;
     ImGui::Image((void*)handle64, ImVec2(512, (512.0f / dimensions[0]) * dimensions[1]));
 }
@@ -14,6 +14,14 @@ enum class TextureFormat
     R32G32B32A32_FLOAT
 };
 
+enum class TextureResidency
+{
+    // CPU pixels are kept for the whole lifetime of the texture
+    Resident,
+    // CPU pixels are released once uploaded and reloaded from file on demand
+    Released
+};
+
 struct Texture
 {
     Texture();
@@ -28,6 +36,15 @@ struct Texture
     static Texture* loadPng(const std::string& fileName);
     static Texture* loadExr(const std::string& fileName);
 
+    // Rows are stored top to bottom, PNGs need R8G8B8A8_UNORM and EXRs R32G32B32A32_FLOAT textures
+    bool save(const std::string& fileName) const;
+    bool savePng(const std::string& fileName) const;
+    bool saveExr(const std::string& fileName) const;
+
+    bool isDataResident() const { return !data.empty(); }
+    bool releaseData();
+    bool reloadData();
+
     void ui();
 
     int width;
@@ -37,6 +54,9 @@ struct Texture
     int numComponents;
     std::vector<unsigned char> data;
 
+    std::string fileName;
+    TextureResidency residency;
+
     // ImGui image ID
     unsigned int handle;
 
@@ -1,3 +1,8 @@
+layout (std140) uniform GradingParams
+{
+    float exposure;
+};
+
 layout (binding = 0) uniform sampler2D Input;
 
 out vec4 frag_colour;
@@ -5,7 +10,7 @@ out vec4 frag_colour;
 
 float sRGB(float x)
 {
-    if (x <= 0.00031308)
+    if (x <= 0.0031308)
         return 12.92 * x;
     else
         return 1.055*pow(x,(1.0 / 2.4) ) - 0.055;
@@ -16,15 +21,6 @@ vec3 sRGB(vec3 c)
     return vec3(sRGB(c.x),sRGB(c.y),sRGB(c.z));
 }
 
-vec3 toLinear(const vec3 sRGB)
-{
-    bvec3 cutoff = lessThan(sRGB, vec3(0.04045));
-    vec3 higher = pow((sRGB + vec3(0.055))/vec3(1.055), vec3(2.4));
-    vec3 lower = sRGB/vec3(12.92);
-
-    return mix(higher, lower, cutoff);
-}
-
 vec3 ACESFilm(vec3 x)
 {
     float a = 2.51f;
@@ -37,8 +33,9 @@ vec3 ACESFilm(vec3 x)
 
 void main()
 {
-    vec3 inputSRGB = texelFetch(Input, ivec2(gl_FragCoord), 0).rgb;
-    vec3 inputLinear = toLinear(inputSRGB);
+    // Linear color sum and sample count
+    vec4 accumulation = texelFetch(Input, ivec2(gl_FragCoord), 0);
+    vec3 inputLinear = exposure * accumulation.rgb / max(accumulation.a, 1);
     vec3 finalAces = ACESFilm(inputLinear);
     vec3 finalSRGB = sRGB(finalAces);
 
@@ -4,5 +4,11 @@
 #define DELTA (1 / 0.0)
 #define INFINITY (1 / 0.0)
 
-// Path-tracer settings
-const uint PATH_LENGTH = 5;
+// Material texture indices
+#define TEXTURE_NONE -1
+#define TEXTURE_PENDING -2
+
+// Primitive emitter index
+#define NO_EMITTER 0xffffffffu
+
+// Path-tracer settings (PATH_LENGTH and RUSSIAN_ROULETTE_DEPTH are injected from GraphicSettings)
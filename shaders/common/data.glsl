@@ -67,6 +67,28 @@ struct Emitter
 {
     uint instance;
     uint primitive;
+    uint bvhTrail;
+    uint bvhDepth;
+};
+
+struct LightBvhNode
+{
+    float aabbMinX;
+    float aabbMinY;
+    float aabbMinZ;
+    float power;
+    float aabbMaxX;
+    float aabbMaxY;
+    float aabbMaxZ;
+    uint leftFirst;
+    float axisX;
+    float axisY;
+    float axisZ;
+    float cosThetaO;
+    float cosThetaE;
+    uint isLeaf;
+    uint pad1;
+    uint pad2;
 };
 
 struct DirectionalLight
@@ -110,6 +132,8 @@ struct Intersection
 {
     float t;
     uint materialId;
+    uint primitiveId;
+    uint instanceId;
     vec3 normal;
     vec2 uv;
     float primitiveAreaPdf;
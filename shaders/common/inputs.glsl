@@ -5,12 +5,9 @@ layout (std140) uniform PathTracerCommonParams
     vec4 lenseDirection;
     float focusDistance;
     float apertureRadius;
-    float exposure;
+    uint sampleOffset;
 
     uint frameIndex;
-
-    layout(rgba8) readonly image2D blueNoise[64];
-    vec4 halton[64];
 };
 
 layout (std430) buffer Primitives
@@ -63,6 +60,16 @@ layout (std430) buffer Emitters
     Emitter emitters[];
 };
 
+layout (std430) buffer LightBvhNodes
+{
+    LightBvhNode lightBvhNodes[];
+};
+
+layout (std430) buffer PrimitiveEmitters
+{
+    uint primitiveEmitters[];
+};
+
 layout (std430) buffer DirectionalLights
 {
     DirectionalLight directionalLights[];
@@ -78,4 +85,29 @@ layout (std430) buffer Materials
     Material materials[];
 };
 
+layout (std430) buffer MaterialFeedback
+{
+    uint materialFeedback[];
+};
+
+layout (std430) buffer PathTracerTiles
+{
+    uvec4 activeTileCount;
+    uint activeTiles[];
+};
+
+layout (std140) uniform PathTracerTileParams
+{
+    uint tileOffset;
+};
+
+layout (std430) buffer PathTracerStats
+{
+    uint statsPathCount;
+    uint statsSegmentCount;
+};
+
 uniform layout(rgba32f) image2D result;
+uniform layout(rgba32f) image2D moments;
+
+uniform sampler2DArray blueNoise;
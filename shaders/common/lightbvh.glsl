@@ -0,0 +1,120 @@
+float lightBvhImportance(uint nodeId, vec3 position)
+{
+    LightBvhNode node = lightBvhNodes[nodeId];
+
+    vec3 aabbMin = vec3(node.aabbMinX, node.aabbMinY, node.aabbMinZ);
+    vec3 aabbMax = vec3(node.aabbMaxX, node.aabbMaxY, node.aabbMaxZ);
+
+    vec3 centerToPoint = position - (aabbMin + aabbMax) * 0.5;
+    float distSqr = dot(centerToPoint, centerToPoint);
+    float radiusSqr = 0.25 * distanceSqr(aabbMin, aabbMax);
+
+    // Inside the bounds, any emitter could face the point
+    if(distSqr <= radiusSqr)
+        return node.power / max(radiusSqr, 1e-12);
+
+    float importance = node.power / distSqr;
+
+    if(node.cosThetaO > -1)
+    {
+        vec3 axis = vec3(node.axisX, node.axisY, node.axisZ);
+        float cosTheta = dot(axis, centerToPoint) * inversesqrt(distSqr);
+        float theta = acos(clamp(cosTheta, -1, 1));
+        float thetaO = acos(node.cosThetaO);
+        float thetaB = asin(sqrt(radiusSqr / distSqr));
+        float thetaPrime = max(0, theta - thetaO - thetaB);
+
+        if(thetaPrime >= acos(node.cosThetaE))
+            return 0;
+
+        importance *= cos(thetaPrime);
+    }
+
+    return importance;
+}
+
+int sampleLightBvh(vec3 position, float u, out float pdf)
+{
+    pdf = 0;
+
+    if(lightBvhNodes.length() == 0)
+        return -1;
+
+    uint nodeId = 0;
+    float nodePdf = 1;
+
+    while(lightBvhNodes[nodeId].isLeaf == 0)
+    {
+        uint left = lightBvhNodes[nodeId].leftFirst;
+        float leftImportance = lightBvhImportance(left, position);
+        float rightImportance = lightBvhImportance(left + 1, position);
+        float totalImportance = leftImportance + rightImportance;
+
+        if(totalImportance <= 0)
+            return -1;
+
+        // Reuse the random number at every level
+        float leftProb = leftImportance / totalImportance;
+        if(u < leftProb)
+        {
+            nodeId = left;
+            nodePdf *= leftProb;
+            u = min(u / leftProb, 0.99999994);
+        }
+        else
+        {
+            nodeId = left + 1;
+            nodePdf *= 1 - leftProb;
+            u = min((u - leftProb) / (1 - leftProb), 0.99999994);
+        }
+    }
+
+    pdf = nodePdf;
+
+    return int(lightBvhNodes[nodeId].leftFirst);
+}
+
+float lightBvhPdf(uint emitterId, vec3 position)
+{
+    Emitter emitter = emitters[emitterId];
+
+    uint nodeId = 0;
+    float pdf = 1;
+
+    for(uint d = 0; d < emitter.bvhDepth; ++d)
+    {
+        uint left = lightBvhNodes[nodeId].leftFirst;
+        float leftImportance = lightBvhImportance(left, position);
+        float rightImportance = lightBvhImportance(left + 1, position);
+        float totalImportance = leftImportance + rightImportance;
+
+        if(totalImportance <= 0)
+            return 0;
+
+        if(((emitter.bvhTrail >> d) & 1) != 0)
+        {
+            nodeId = left + 1;
+            pdf *= rightImportance / totalImportance;
+        }
+        else
+        {
+            nodeId = left;
+            pdf *= leftImportance / totalImportance;
+        }
+    }
+
+    return pdf;
+}
+
+float emitterSelectionPdf(uint primitiveId, vec3 position)
+{
+    if(primitiveId >= primitiveEmitters.length())
+        return 0;
+
+    uint emitterId = primitiveEmitters[primitiveId];
+
+    if(emitterId == NO_EMITTER)
+        return 0;
+
+    return lightBvhPdf(emitterId, position);
+}
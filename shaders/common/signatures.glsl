@@ -41,7 +41,10 @@ vec2 findUV(vec4 quat, vec3 N);
 
 void makeOrthBase(in vec3 N, out vec3 T, out vec3 B);
 
-vec4 sampleBlueNoise(uint depth);
+// Four decorrelated dimensions per depth
+vec4 sampleNoise(uint depth);
+
+uvec2 getPixelPos();
 
 // MIS heuristics
 float balanceHeuristic(int nf, float fPdf, int ng, float gPdf);
@@ -82,6 +85,12 @@ bool intersectSphere(   inout Intersection intersection, Probe probe, uint spher
 bool intersectPlane(    inout Intersection intersection, Probe probe, uint planeId, uint materialId);
 
 
+// Light BVH
+int sampleLightBvh(vec3 position, float u, out float pdf);
+float lightBvhPdf(uint emitterId, vec3 position);
+float emitterSelectionPdf(uint primitiveId, vec3 position);
+
+
 // SYSTEMS //
 
 // Sky
@@ -100,3 +109,7 @@ void SampleSkyLuminanceToPoint(
 vec3 SampleDirectionalLightLuminance(
         vec3 viewDir,
         uint lightId);
+
+// Environment
+bool sampleEnvironment(vec4 noise, out vec3 direction, out float pdf);
+float environmentPdf(vec3 direction);
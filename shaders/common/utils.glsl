@@ -64,7 +64,7 @@ float distanceSqr(vec3 a, vec3 b)
 
 float sRGB(float x)
 {
-    if (x <= 0.00031308)
+    if (x <= 0.0031308)
         return 12.92 * x;
     else
         return 1.055*pow(x,(1.0 / 2.4) ) - 0.055;
@@ -117,24 +117,127 @@ void makeOrthBase(in vec3 N, out vec3 T, out vec3 B)
     B = normalize(cross(N, T));
 }
 
+uint hashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Burley's hash-based Owen scrambling, must match system/random.cpp
+uint nestedUniformScramble(uint x, uint seed)
+{
+    x = bitfieldReverse(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return bitfieldReverse(x);
+}
+
+// Joe and Kuo's direction numbers of the first four dimensions, must match system/random.cpp
+const uvec4 SOBOL_DIRECTIONS[32] = uvec4[](
+    uvec4(0x80000000u, 0x80000000u, 0x80000000u, 0x80000000u),
+    uvec4(0x40000000u, 0xc0000000u, 0xc0000000u, 0xc0000000u),
+    uvec4(0x20000000u, 0xa0000000u, 0x60000000u, 0x20000000u),
+    uvec4(0x10000000u, 0xf0000000u, 0x90000000u, 0x50000000u),
+    uvec4(0x08000000u, 0x88000000u, 0xe8000000u, 0xf8000000u),
+    uvec4(0x04000000u, 0xcc000000u, 0x5c000000u, 0x74000000u),
+    uvec4(0x02000000u, 0xaa000000u, 0x8e000000u, 0xa2000000u),
+    uvec4(0x01000000u, 0xff000000u, 0xc5000000u, 0x93000000u),
+    uvec4(0x00800000u, 0x80800000u, 0x68800000u, 0xd8800000u),
+    uvec4(0x00400000u, 0xc0c00000u, 0x9cc00000u, 0x25400000u),
+    uvec4(0x00200000u, 0xa0a00000u, 0xee600000u, 0x59e00000u),
+    uvec4(0x00100000u, 0xf0f00000u, 0x55900000u, 0xe6d00000u),
+    uvec4(0x00080000u, 0x88880000u, 0x80680000u, 0x78080000u),
+    uvec4(0x00040000u, 0xcccc0000u, 0xc09c0000u, 0xb40c0000u),
+    uvec4(0x00020000u, 0xaaaa0000u, 0x60ee0000u, 0x82020000u),
+    uvec4(0x00010000u, 0xffff0000u, 0x90550000u, 0xc3050000u),
+    uvec4(0x00008000u, 0x80008000u, 0xe8808000u, 0x208f8000u),
+    uvec4(0x00004000u, 0xc000c000u, 0x5cc0c000u, 0x51474000u),
+    uvec4(0x00002000u, 0xa000a000u, 0x8e606000u, 0xfbea2000u),
+    uvec4(0x00001000u, 0xf000f000u, 0xc5909000u, 0x75d93000u),
+    uvec4(0x00000800u, 0x88008800u, 0x6868e800u, 0xa0858800u),
+    uvec4(0x00000400u, 0xcc00cc00u, 0x9c9c5c00u, 0x914e5400u),
+    uvec4(0x00000200u, 0xaa00aa00u, 0xeeee8e00u, 0xdbe79e00u),
+    uvec4(0x00000100u, 0xff00ff00u, 0x5555c500u, 0x25db6d00u),
+    uvec4(0x00000080u, 0x80808080u, 0x8000e880u, 0x58800080u),
+    uvec4(0x00000040u, 0xc0c0c0c0u, 0xc0005cc0u, 0xe54000c0u),
+    uvec4(0x00000020u, 0xa0a0a0a0u, 0x60008e60u, 0x79e00020u),
+    uvec4(0x00000010u, 0xf0f0f0f0u, 0x9000c590u, 0xb6d00050u),
+    uvec4(0x00000008u, 0x88888888u, 0xe8006868u, 0x800800f8u),
+    uvec4(0x00000004u, 0xccccccccu, 0x5c009c9cu, 0xc00c0074u),
+    uvec4(0x00000002u, 0xaaaaaaaau, 0x8e00eeeeu, 0x200200a2u),
+    uvec4(0x00000001u, 0xffffffffu, 0xc5005555u, 0x50050093u));
+
+uvec4 sobol(uint index)
+{
+    uvec4 x = uvec4(0);
+    for(uint bit = 0; index != 0; ++bit, index >>= 1)
+    {
+        if((index & 1) != 0)
+            x ^= SOBOL_DIRECTIONS[bit];
+    }
+
+    return x;
+}
+
+vec4 sobolOwen(uint index, uint seed)
+{
+    // Shuffling the index keeps the points stratified in any power of two range
+    index = nestedUniformScramble(index, seed);
+
+    uvec4 x = sobol(index);
+    x.x = nestedUniformScramble(x.x, hashUint(seed ^ 0x3c6ef372u));
+    x.y = nestedUniformScramble(x.y, hashUint(seed ^ 0xa54ff53au));
+    x.z = nestedUniformScramble(x.z, hashUint(seed ^ 0x510e527fu));
+    x.w = nestedUniformScramble(x.w, hashUint(seed ^ 0x9b05688cu));
+
+    // 24 bits fit a float's mantissa, keeping samples below 1
+    return vec4(x >> 8) * (1.0 / 16777216.0);
+}
+
+vec4 sampleSobol(uint depth)
+{
+    // Each pixel and bounce traces its own scrambled sequence
+    uvec2 pixelPos = getPixelPos();
+    uint seed = hashUint(pixelPos.x ^ hashUint(pixelPos.y ^ hashUint(depth)));
+
+    return sobolOwen(frameIndex + sampleOffset, seed);
+}
+
 vec4 sampleBlueNoise(uint depth)
 {
-    uint cycle = frameIndex / 64;
+    // Distributed render workers each start at their own sample index
+    uint sampleIndex = frameIndex + sampleOffset;
+    uint cycle = sampleIndex / 64;
 
-    uint haltonIndex = cycle % 64;
-    vec2 haltonSample = vec2(halton[haltonIndex]);
-    ivec2 haltonOffset = ivec2(haltonSample * 64);
-    ivec2 blueNoiseXY = (ivec2(gl_GlobalInvocationID.xy) + haltonOffset) % 64;
+    // Tiles are offset by an unscrambled Sobol sequence, every cycle gets its own offset
+    ivec2 cycleOffset = ivec2(vec2(sobol(cycle).xy >> 8) * (64.0 / 16777216.0));
+    ivec2 blueNoiseXY = (ivec2(getPixelPos()) + cycleOffset) % 64;
 
-    uint bluenNoiseIndex = (frameIndex + depth) % 64;
-    vec4 blueNoise = imageLoad(blueNoise[bluenNoiseIndex], blueNoiseXY);
+    int blueNoiseLayer = int((sampleIndex + depth) % 64);
+    vec4 blueNoiseTexel = texelFetch(blueNoise, ivec3(blueNoiseXY, blueNoiseLayer), 0);
 
     vec4 goldenScramble = GOLDEN_RATIO * vec4(1, 2, 3, 4) * cycle;
-    vec4 noise = fract(blueNoise + goldenScramble);
+    vec4 noise = fract(blueNoiseTexel + goldenScramble);
 
     return noise;
 }
 
+vec4 sampleNoise(uint depth)
+{
+#ifdef SOBOL_SAMPLER
+    return sampleSobol(depth);
+#else
+    return sampleBlueNoise(depth);
+#endif
+}
+
 // MIS heuristics
 float balanceHeuristic(int nf, float fPdf, int ng, float gPdf)
 {
@@ -0,0 +1,64 @@
+layout (std140) uniform ConvergenceParams
+{
+    float errorThreshold;
+    uint minSampleCount;
+    uint frameIndex;
+    uint passIndex;
+};
+
+uniform layout(rgba32f) readonly image2D moments;
+
+layout (std430) buffer PathTracerTiles
+{
+    uvec4 activeTileCount;
+    uint activeTiles[];
+};
+
+shared uint tileIsActive;
+
+
+// Must match the path tracer's work group size
+layout(local_size_x = 8, local_size_y = 4, local_size_z = 1) in;
+
+void main()
+{
+    if(gl_LocalInvocationIndex == 0)
+        tileIsActive = 0;
+
+    // Tells the count read back on the CPU apart from the ones of previous passes
+    if(gl_GlobalInvocationID.xy == uvec2(0))
+        activeTileCount.y = passIndex;
+
+    barrier();
+
+    ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
+
+    if(all(lessThan(pixelPos, imageSize(moments))))
+    {
+        vec4 pixelMoments = imageLoad(moments, pixelPos);
+        float sampleCount = pixelMoments.b;
+
+        bool isActive = frameIndex == 0 || errorThreshold <= 0 || sampleCount < max(minSampleCount, 1);
+
+        if(!isActive)
+        {
+            // Relative standard error of the pixel's mean luminance
+            float mean = pixelMoments.r / sampleCount;
+            float variance = max(0, pixelMoments.g / sampleCount - mean * mean);
+            float error = sqrt(variance / sampleCount) / max(mean, 1e-3);
+
+            isActive = error > errorThreshold;
+        }
+
+        if(isActive)
+            atomicOr(tileIsActive, 1);
+    }
+
+    barrier();
+
+    if(gl_LocalInvocationIndex == 0 && tileIsActive != 0)
+    {
+        uint slot = atomicAdd(activeTileCount.x, 1);
+        activeTiles[slot] = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    }
+}
@@ -0,0 +1,112 @@
+layout (std140) uniform DenoiseParams
+{
+    int stepSize;
+    uint isFirstIteration;
+    uint isLastIteration;
+    float colorPhi;
+    float normalPhi;
+    float depthPhi;
+};
+
+uniform layout(rgba32f) readonly image2D source;
+uniform layout(rgba32f) writeonly image2D destination;
+
+uniform layout(rgba32f) readonly image2D albedo;
+uniform layout(rgba32f) readonly image2D normalDepth;
+uniform layout(rgba32f) readonly image2D moments;
+
+// Must match CpuDenoiser
+const float ALBEDO_EPSILON = 1e-3;
+
+// B3 spline a-trous kernel
+const float KERNEL[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+
+float toLuminance(const vec3 c)
+{
+    return sqrt( 0.299*c.r*c.r + 0.587*c.g*c.g + 0.114*c.b*c.b);
+}
+
+vec3 loadAlbedo(ivec2 pos)
+{
+    return max(imageLoad(albedo, pos).rgb, vec3(ALBEDO_EPSILON));
+}
+
+// Demodulated linear color, the first iteration reads the path tracer's color sum
+vec3 loadColor(ivec2 pos)
+{
+    vec4 color = imageLoad(source, pos);
+
+    if(isFirstIteration != 0)
+        return color.rgb / max(color.a, 1) / loadAlbedo(pos);
+
+    return color.rgb;
+}
+
+vec4 loadGuide(ivec2 pos)
+{
+    vec4 guide = imageLoad(normalDepth, pos);
+    float normalLength = length(guide.xyz);
+    guide.xyz = normalLength > 0 ? guide.xyz / normalLength : guide.xyz;
+    return guide;
+}
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+void main()
+{
+    ivec2 size = imageSize(destination);
+    ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
+
+    if(any(greaterThanEqual(pixelPos, size)))
+        return;
+
+    vec4 pixelMoments = imageLoad(moments, pixelPos);
+    float count = max(1, pixelMoments.b);
+    float mean = pixelMoments.r / count;
+    float variance = max(0, pixelMoments.g / count - mean * mean);
+    float relativeError = sqrt(variance / count) / max(mean, 1e-3);
+
+    vec3 centerColor = loadColor(pixelPos);
+    vec4 centerGuide = loadGuide(pixelPos);
+    float centerLuminance = toLuminance(centerColor);
+    float luminanceSigma = colorPhi / float(stepSize) * relativeError * centerLuminance + 1e-4;
+
+    vec3 colorSum = vec3(0, 0, 0);
+    float weightSum = 0;
+
+    for(int dy = -2; dy <= 2; ++dy)
+    {
+        for(int dx = -2; dx <= 2; ++dx)
+        {
+            ivec2 q = pixelPos + ivec2(dx, dy) * stepSize;
+            if(any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size)))
+                continue;
+
+            vec3 color = loadColor(q);
+            vec4 guide = loadGuide(q);
+
+            float luminanceWeight = exp(-abs(centerLuminance - toLuminance(color)) / luminanceSigma);
+
+            float normalWeight = pow(max(0, dot(centerGuide.xyz, guide.xyz)), normalPhi);
+
+            float depthRange = depthPhi * stepSize * max(centerGuide.w, guide.w) + 1e-6;
+            float depthWeight = exp(-abs(centerGuide.w - guide.w) / depthRange);
+
+            float weight = KERNEL[abs(dx)] * KERNEL[abs(dy)]
+                    * luminanceWeight * normalWeight * depthWeight;
+
+            colorSum += weight * color;
+            weightSum += weight;
+        }
+    }
+
+    // The center tap always has a positive weight unless its normal is degenerate
+    vec3 filtered = weightSum > 0 ? colorSum / weightSum : centerColor;
+
+    // Remodulated result is stored as a single sample for the grading pass
+    if(isLastIteration != 0)
+        filtered *= loadAlbedo(pixelPos);
+
+    imageStore(destination, pixelPos, vec4(filtered, 1));
+}
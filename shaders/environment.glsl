@@ -0,0 +1,96 @@
+layout (std140) uniform EnvironmentParams
+{
+    vec4 envStarsQuaternion;
+    uint envWidth;
+    uint envHeight;
+    float envSkyWeight;
+    float envStarsWeight;
+};
+
+struct EnvironmentCell
+{
+    float threshold;
+    uint alias;
+    float pdf;
+    float pad1;
+};
+
+layout (std430) buffer SkyDistribution
+{
+    EnvironmentCell skyCells[];
+};
+
+layout (std430) buffer StarsDistribution
+{
+    EnvironmentCell starsCells[];
+};
+
+
+uint environmentCell(vec3 direction)
+{
+    vec2 uv = findUV(direction);
+    uint i = min(uint(uv.x * envWidth), envWidth - 1);
+    uint j = min(uint(uv.y * envHeight), envHeight - 1);
+    return j * envWidth + i;
+}
+
+vec3 environmentCellDirection(uint cell, vec2 noise)
+{
+    uint i = cell % envWidth;
+    uint j = cell / envWidth;
+
+    // Uniform in solid angle within the cell
+    float sinPhi0 = sin((float(j) / envHeight - 0.5) * PI);
+    float sinPhi1 = sin((float(j + 1) / envHeight - 0.5) * PI);
+    float z = mix(sinPhi0, sinPhi1, noise.y);
+    float r = sqrt(max(0, 1 - z * z));
+    float theta = ((float(i) + noise.x) / envWidth - 0.5) * 2 * PI;
+
+    return vec3(r * cos(theta), r * sin(theta), z);
+}
+
+float environmentPdf(vec3 direction)
+{
+    float pdf = 0;
+
+    if(envSkyWeight > 0)
+        pdf += envSkyWeight * skyCells[environmentCell(direction)].pdf;
+
+    if(envStarsWeight > 0)
+        pdf += envStarsWeight * starsCells[environmentCell(rotate(envStarsQuaternion, direction))].pdf;
+
+    return pdf;
+}
+
+bool sampleEnvironment(vec4 noise, out vec3 direction, out float pdf)
+{
+    direction = vec3(0, 0, 1);
+    pdf = 0;
+
+    if(envSkyWeight + envStarsWeight <= 0)
+        return false;
+
+    uint cellCount = envWidth * envHeight;
+    float scaled = noise.y * cellCount;
+    uint cell = min(uint(scaled), cellCount - 1);
+    float remainder = scaled - cell;
+
+    if(noise.x < envSkyWeight)
+    {
+        if(remainder >= skyCells[cell].threshold)
+            cell = skyCells[cell].alias;
+
+        direction = environmentCellDirection(cell, noise.zw);
+    }
+    else
+    {
+        if(remainder >= starsCells[cell].threshold)
+            cell = starsCells[cell].alias;
+
+        direction = rotate(quatConj(envStarsQuaternion), environmentCellDirection(cell, noise.zw));
+    }
+
+    pdf = environmentPdf(direction);
+
+    return pdf > 0;
+}
@@ -1,7 +1,14 @@
+// Scene specialization, see PathTracerTask::featureDefines
+#ifdef SINGLE_PRIMITIVE_TYPE
+#define IS_PRIMITIVE_TYPE(primitive, TYPE) true
+#else
+#define IS_PRIMITIVE_TYPE(primitive, TYPE) (primitive.type == TYPE)
+#endif
+
 Ray genRay(uvec2 pixelPos)
 {
     const uint rayDepth = 0;
-    vec4 noise = sampleBlueNoise(rayDepth);
+    vec4 noise = sampleNoise(rayDepth);
 
     vec4 pixelClip = vec4(
         float(pixelPos.x) + noise.x,
@@ -53,21 +60,29 @@ Intersection raycast(in Ray ray)
             Primitive primitive = primitives[p];
 
             bool intersected = false;
-            if(primitive.type == PRIMITIVE_TYPE_MESH)
+#ifdef HAS_MESHES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_MESH))
             {
                 intersected = intersectMesh(intersection, probe, primitive.index, primitive.material);
             }
-            else if(primitive.type == PRIMITIVE_TYPE_SPHERE)
+#endif
+#ifdef HAS_SPHERES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_SPHERE))
             {
                 intersected = intersectSphere(intersection, probe, primitive.index, primitive.material);
             }
-            else if(primitive.type == PRIMITIVE_TYPE_PLANE)
+#endif
+#ifdef HAS_PLANES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_PLANE))
             {
                 intersected = intersectPlane(intersection, probe, primitive.index, primitive.material);
             }
+#endif
 
             if(intersected)
             {
+                intersection.primitiveId = p;
+                intersection.instanceId = i;
                 intersection.normal = rotate(
                     quatConj(instance.quaternion),
                     intersection.normal);
@@ -96,18 +111,24 @@ bool shadowcast(in Ray ray, float tMax)
         {
             Primitive primitive = primitives[p];
 
-            if(primitive.type == PRIMITIVE_TYPE_MESH)
+#ifdef HAS_MESHES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_MESH))
             {
                 intersectMesh(intersection, probe, primitive.index, primitive.material);
             }
-            else if(primitive.type == PRIMITIVE_TYPE_SPHERE)
+#endif
+#ifdef HAS_SPHERES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_SPHERE))
             {
                 intersectSphere(intersection, probe, primitive.index, primitive.material);
             }
-            else if(primitive.type == PRIMITIVE_TYPE_PLANE)
+#endif
+#ifdef HAS_PLANES
+            if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_PLANE))
             {
                 intersectPlane(intersection, probe, primitive.index, primitive.material);
             }
+#endif
 
             if(intersection.t < tMax * 0.99999)
             {
@@ -132,8 +153,12 @@ HitInfo resolveHit(in Ray ray, in Intersection intersection)
 
     vec2 uv = fract(vec2(intersection.uv.x, 1 - intersection.uv.y));
 
+    // Let the CPU know textures are needed
+    if(material.albedoTexture == TEXTURE_PENDING || material.specularTexture == TEXTURE_PENDING)
+        materialFeedback[intersection.materialId] = 1;
+
     vec3 albedo = material.albedo.rgb;
-    if(material.albedoTexture != -1)
+    if(material.albedoTexture >= 0)
     {
         layout(rgba8) image2D img = textures[material.albedoTexture];
         ivec2 imgSize = imageSize(img);
@@ -143,7 +168,7 @@ HitInfo resolveHit(in Ray ray, in Intersection intersection)
     }
 
     vec3 specular = material.specular.rgb;
-    if(material.specularTexture != -1)
+    if(material.specularTexture >= 0)
     {
         layout(rgba8) image2D img = textures[material.specularTexture];
         ivec2 imgSize = imageSize(img);
@@ -164,7 +189,12 @@ HitInfo resolveHit(in Ray ray, in Intersection intersection)
 
     hitInfo.NdotV = max(0.0f, -dot(hitInfo.normal, ray.direction));
 
-    hitInfo.primitiveAreaPdf = intersection.primitiveAreaPdf;
+    // Account for the light BVH picking this emitter from the previous vertex
+    hitInfo.primitiveAreaPdf = 0;
+#ifdef HAS_EMITTERS
+    if(any(greaterThan(hitInfo.emission, vec3(0))))
+        hitInfo.primitiveAreaPdf = intersection.primitiveAreaPdf * emitterSelectionPdf(intersection.primitiveId, ray.origin);
+#endif
 
     return hitInfo;
 }
@@ -306,11 +336,16 @@ vec3 shadeHit(Ray ray, HitInfo hitInfo)
 {
     vec3 L_out = vec3(0);
 
-    vec4 noise = sampleBlueNoise(ray.depth + PATH_LENGTH);
+    vec4 noise = sampleNoise(ray.depth + PATH_LENGTH);
+
+#ifdef HAS_EMITTERS
+    // A single emitter per bounce, picked by the light BVH
+    float emitterPdf;
+    int emitterId = sampleLightBvh(hitInfo.position, noise.r, emitterPdf);
 
-    for(uint e = 0; e < emitters.length(); ++e)
+    if(emitterId >= 0)
     {
-        Emitter emitter = emitters[e];
+        Emitter emitter = emitters[emitterId];
         Instance instance = instances[emitter.instance];
         uint primitiveId = instance.primitiveBegin + emitter.primitive;
         Primitive primitive = primitives[primitiveId];
@@ -319,38 +354,44 @@ vec3 shadeHit(Ray ray, HitInfo hitInfo)
 
         LightSample lightSample;
 
-        if(primitive.type == PRIMITIVE_TYPE_MESH)
+#ifdef HAS_MESHES
+        if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_MESH))
         {
             lightSample = sampleMesh(primitive.index, primitive.material, objSpacePosition, noise);
         }
-        else if(primitive.type == PRIMITIVE_TYPE_SPHERE)
+#endif
+#ifdef HAS_SPHERES
+        if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_SPHERE))
         {
             lightSample = sampleSphere(primitive.index, primitive.material, objSpacePosition, noise);
         }
-        else if(primitive.type == PRIMITIVE_TYPE_PLANE)
+#endif
+#ifdef HAS_PLANES
+        if(IS_PRIMITIVE_TYPE(primitive, PRIMITIVE_TYPE_PLANE))
         {
             lightSample = samplePlane(primitive.index, primitive.material, objSpacePosition, noise);
         }
+#endif
 
         lightSample.direction = rotate(quatConj(instance.quaternion), lightSample.direction);
 
-        if(dot(lightSample.direction, hitInfo.normal) <= 0)
-            continue;
-
         Ray shadowRay;
         shadowRay.origin = hitInfo.position;
         shadowRay.direction = lightSample.direction;
 
-        if(shadowcast(shadowRay, lightSample.distance))
+        // Selection probability folds into the sampled solid angle
+        if(dot(lightSample.direction, hitInfo.normal) > 0 && shadowcast(shadowRay, lightSample.distance))
         {
             L_out += lightSample.emission * evaluateBSDF(
                         hitInfo,
                         ray.direction,
                         lightSample.direction,
-                        lightSample.solidAngle);
+                        lightSample.solidAngle / emitterPdf);
         }
     }
+#endif
 
+#ifdef HAS_DIRECTIONAL_LIGHTS
     for(uint dl = 0; dl < directionalLights.length(); ++dl)
     {
         LightSample lightSample = sampleDirectionalLight(dl, hitInfo.position, noise);
@@ -368,9 +409,38 @@ vec3 shadeHit(Ray ray, HitInfo hitInfo)
                         lightSample.solidAngle);
         }
     }
+#endif
+
+    // Environment
+    vec3 envDirection;
+    float envPdf;
+    vec4 envNoise = sampleNoise(ray.depth + 2 * PATH_LENGTH);
+    if(sampleEnvironment(envNoise, envDirection, envPdf) && dot(envDirection, hitInfo.normal) > 0)
+    {
+        Ray shadowRay;
+        shadowRay.origin = hitInfo.position;
+        shadowRay.direction = envDirection;
+
+        if(shadowcast(shadowRay, INFINITY))
+        {
+            vec3 skyLuminance;
+            vec3 skyTransmittance;
+            SampleSkyLuminance(
+                skyLuminance,
+                skyTransmittance,
+                hitInfo.position,
+                envDirection);
+
+            L_out += skyLuminance * evaluateBSDF(
+                        hitInfo,
+                        ray.direction,
+                        envDirection,
+                        1 / envPdf);
+        }
+    }
 
     // Emission
-    float weight = misHeuristic(1, ray.bsdfPdf, 1, hitInfo.primitiveAreaPdf);
+    float weight = hitInfo.primitiveAreaPdf > 0 ? misHeuristic(1, ray.bsdfPdf, 1, hitInfo.primitiveAreaPdf) : 1;
     L_out += weight * hitInfo.emission;
 
     return ray.throughput * L_out;
@@ -386,8 +456,11 @@ vec3 shadeSky(in Ray ray)
         ray.origin,
         ray.direction);
 
-    vec3 L_in = skyLuminance;
+    float envPdf = environmentPdf(ray.direction);
+    float envWeight = envPdf > 0 ? misHeuristic(1, ray.bsdfPdf, 1, envPdf) : 1;
+    vec3 L_in = envWeight * skyLuminance;
 
+#ifdef HAS_DIRECTIONAL_LIGHTS
     for(uint dl = 0; dl < directionalLights.length(); ++dl)
     {
         DirectionalLight light = directionalLights[dl];
@@ -401,6 +474,7 @@ vec3 shadeSky(in Ray ray)
             L_in += weight * emission * skyTransmittance;
         }
     }
+#endif
 
     return ray.throughput * L_in;
 }
@@ -411,7 +485,7 @@ Ray scatter(Ray rayIn, HitInfo hitInfo)
     rayOut.origin = hitInfo.position;
     rayOut.depth = rayIn.depth + 1;
 
-    vec4 noise = sampleBlueNoise(rayOut.depth);
+    vec4 noise = sampleNoise(rayOut.depth);
 
     vec3 T, B, N = hitInfo.normal;
     makeOrthBase(N, T, B);
@@ -464,42 +538,261 @@ Ray scatter(Ray rayIn, HitInfo hitInfo)
     return rayOut;
 }
 
+// Optional outputs
+#ifdef AOV_ALBEDO
+uniform layout(rgba32f) image2D aovAlbedo;
+#endif
+#ifdef AOV_NORMAL_DEPTH
+uniform layout(rgba32f) image2D aovNormalDepth;
+#endif
+#ifdef AOV_IDS
+uniform layout(rgba32f) image2D aovIds;
+#endif
+#ifdef AOV_DIRECT
+uniform layout(rgba32f) image2D aovDirect;
+#endif
+#ifdef AOV_INDIRECT
+uniform layout(rgba32f) image2D aovIndirect;
+#endif
+
+#ifdef REPROJECTION
+layout (std140) uniform PathTracerHistoryParams
+{
+    mat4 historyScreenMatrix;
+    vec4 historyLensePosition;
+    float historyMaxSampleCount;
+    uint historyIsValid;
+};
+
+uniform sampler2D historyResult;
+uniform sampler2D historyMoments;
+uniform sampler2D historyNormalDepth;
+
+// Disocclusion thresholds on the relative first hit distance and normal
+const float HISTORY_DEPTH_TOLERANCE = 0.05;
+const float HISTORY_NORMAL_TOLERANCE = 0.9;
+
+// Accumulation of the previous camera for the surface seen through the pixel
+bool reprojectHistory(Ray primaryRay, vec4 normalDepth, out vec4 history, out vec4 historyMomentsValue)
+{
+    if(historyIsValid == 0)
+        return false;
+
+    bool isSky = normalDepth.w == 0;
+    vec3 position = primaryRay.origin + primaryRay.direction * normalDepth.w;
+    vec3 historyDirection = isSky ? primaryRay.direction : position - historyLensePosition.xyz;
+
+    vec4 historyPixel = historyScreenMatrix * vec4(historyDirection, 1);
+    if(historyPixel.w <= 0)
+        return false;
+
+    ivec2 historyPos = ivec2(floor(historyPixel.xy / historyPixel.w));
+    if(any(lessThan(historyPos, ivec2(0))) || any(greaterThanEqual(historyPos, textureSize(historyResult, 0))))
+        return false;
+
+    vec4 historyGuide = texelFetch(historyNormalDepth, historyPos, 0);
+    if(isSky != (historyGuide.w == 0))
+        return false;
+
+    if(!isSky)
+    {
+        float expectedDepth = length(historyDirection);
+        if(abs(historyGuide.w - expectedDepth) > HISTORY_DEPTH_TOLERANCE * expectedDepth)
+            return false;
+
+        float normalLength = length(historyGuide.xyz);
+        if(normalLength == 0 || dot(historyGuide.xyz / normalLength, normalDepth.xyz) < HISTORY_NORMAL_TOLERANCE)
+            return false;
+    }
+
+    history = texelFetch(historyResult, historyPos, 0);
+    historyMomentsValue = texelFetch(historyMoments, historyPos, 0);
+
+    // Clamp history so moving content keeps adapting
+    float scale = min(1, historyMaxSampleCount / max(historyMomentsValue.b, 1));
+    history *= scale;
+    historyMomentsValue *= scale;
+
+    return true;
+}
+#endif
+
 layout(local_size_x = 8, local_size_y = 4, local_size_z = 1) in;
 
-void main()
+uvec2 g_PixelPos;
+
+shared uint g_GroupPathCount;
+shared uint g_GroupSegmentCount;
+
+uvec2 getPixelPos()
+{
+    return g_PixelPos;
+}
+
+uint tracePixel()
 {
     vec3 colorAccum = vec3(0, 0, 0);
 
-    Ray ray = genRay(gl_GlobalInvocationID.xy);
+    Ray ray = genRay(g_PixelPos);
+    Ray primaryRay = ray;
 
+    // First hit outputs, the sky has no depth nor ids
+    vec3 firstAlbedo = vec3(1, 1, 1);
+    vec4 firstNormalDepth = vec4(-ray.direction, 0);
+    vec2 firstIds = vec2(-1, -1);
+    vec3 directAccum = vec3(0, 0, 0);
+
+    uint segmentCount = 0;
     for(uint depthId = 0; depthId < PATH_LENGTH; ++depthId)
     {
         Intersection bestIntersection = raycast(ray);
+        ++segmentCount;
 
         if (bestIntersection.t != INFINITY)
         {
             HitInfo hitInfo = resolveHit(ray, bestIntersection);
-            colorAccum += shadeHit(ray, hitInfo);
+
+            if(depthId == 0)
+            {
+                firstAlbedo = min(vec3(1, 1, 1), hitInfo.diffuseAlbedo + hitInfo.specularF0);
+                firstNormalDepth = vec4(hitInfo.normal, bestIntersection.t);
+                firstIds = vec2(bestIntersection.materialId, bestIntersection.instanceId);
+            }
+
+            vec3 shading = shadeHit(ray, hitInfo);
+            colorAccum += shading;
+
+            if(depthId == 0)
+                directAccum = shading;
+
             ray = scatter(ray, hitInfo);
+
+            // Russian roulette, scatter leaves the 'w' noise channel unused
+            if(ray.depth >= RUSSIAN_ROULETTE_DEPTH)
+            {
+                float survival = min(1, maxV(ray.throughput));
+                if(sampleNoise(ray.depth).w >= survival)
+                    break;
+
+                ray.throughput /= survival;
+            }
         }
         else
         {
-            colorAccum += shadeSky(ray);
+            vec3 shading = shadeSky(ray);
+            colorAccum += shading;
+
+            if(depthId == 0)
+                directAccum = shading;
+
             break;
         }
     }
 
-    vec3 finalLinear = exposure * colorAccum;
+    // Linear color sum and sample count, resolved and exposed by the grading pass
+    vec4 pixelResult = vec4(colorAccum, 1);
+
+    // Luminance sum, squared luminance sum and sample count
+    float luminance = toLuminance(colorAccum);
+    vec4 pixelMoments = vec4(luminance, luminance * luminance, 1, 0);
+
+    vec4 pixelAlbedo = vec4(firstAlbedo, 0);
+    vec4 pixelNormalDepth = firstNormalDepth;
+    vec4 pixelDirect = vec4(directAccum, 0);
+    vec4 pixelIndirect = vec4(colorAccum - directAccum, 0);
+
+    // Regional restarts clear pixels in the middle of the accumulation
+    bool isFirstSample = frameIndex == 0;
 
     if(frameIndex != 0)
     {
-        vec4 prevFrameSRGB = imageLoad(result, ivec2(gl_GlobalInvocationID));
-        vec3 prevFrameLinear = toLinear(prevFrameSRGB.rgb);
+        vec4 prevMoments = imageLoad(moments, ivec2(g_PixelPos));
+        isFirstSample = prevMoments.b == 0;
+        pixelResult += imageLoad(result, ivec2(g_PixelPos));
+        pixelMoments += prevMoments;
+
+        float blend = prevMoments.b / (prevMoments.b + 1);
+
+#ifdef AOV_ALBEDO
+        pixelAlbedo = mix(pixelAlbedo, imageLoad(aovAlbedo, ivec2(g_PixelPos)), blend);
+#endif
+#ifdef AOV_NORMAL_DEPTH
+        pixelNormalDepth = mix(pixelNormalDepth, imageLoad(aovNormalDepth, ivec2(g_PixelPos)), blend);
+#endif
+#ifdef AOV_DIRECT
+        pixelDirect = mix(pixelDirect, imageLoad(aovDirect, ivec2(g_PixelPos)), blend);
+#endif
+#ifdef AOV_INDIRECT
+        pixelIndirect = mix(pixelIndirect, imageLoad(aovIndirect, ivec2(g_PixelPos)), blend);
+#endif
+    }
+#ifdef REPROJECTION
+    else
+    {
+        vec4 history;
+        vec4 historyMomentsValue;
+        if(reprojectHistory(primaryRay, firstNormalDepth, history, historyMomentsValue))
+        {
+            pixelResult += history;
+            pixelMoments += historyMomentsValue;
+        }
+    }
+#endif
+
+    imageStore(moments, ivec2(g_PixelPos), pixelMoments);
+
+#ifdef AOV_ALBEDO
+    imageStore(aovAlbedo, ivec2(g_PixelPos), pixelAlbedo);
+#endif
+#ifdef AOV_NORMAL_DEPTH
+    imageStore(aovNormalDepth, ivec2(g_PixelPos), pixelNormalDepth);
+#endif
+#ifdef AOV_IDS
+    // Ids cannot be blended, the first sample's are kept
+    if(isFirstSample)
+        imageStore(aovIds, ivec2(g_PixelPos), vec4(firstIds, 0, 0));
+#endif
+#ifdef AOV_DIRECT
+    imageStore(aovDirect, ivec2(g_PixelPos), pixelDirect);
+#endif
+#ifdef AOV_INDIRECT
+    imageStore(aovIndirect, ivec2(g_PixelPos), pixelIndirect);
+#endif
+
+    imageStore(result, ivec2(g_PixelPos), pixelResult);
 
-        float blend = frameIndex / float(frameIndex+1);
-        finalLinear = mix(finalLinear, prevFrameLinear, blend);
+    return segmentCount;
+}
+
+void main()
+{
+    if(gl_LocalInvocationIndex == 0)
+    {
+        g_GroupPathCount = 0;
+        g_GroupSegmentCount = 0;
     }
 
-    vec4 finalSRGB = vec4(sRGB(finalLinear), 0);
-    imageStore(result, ivec2(gl_GlobalInvocationID), finalSRGB);
+    barrier();
+
+    // One work group per tile, only a range of the unconverged tiles is dispatched
+    ivec2 viewportSize = imageSize(result);
+    uint tilesX = (viewportSize.x + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    uint tileId = activeTiles[tileOffset + gl_WorkGroupID.x];
+    g_PixelPos = uvec2(tileId % tilesX, tileId / tilesX) * gl_WorkGroupSize.xy + gl_LocalInvocationID.xy;
+
+    if(all(lessThan(g_PixelPos, uvec2(viewportSize))))
+    {
+        uint segmentCount = tracePixel();
+        atomicAdd(g_GroupPathCount, 1);
+        atomicAdd(g_GroupSegmentCount, segmentCount);
+    }
+
+    barrier();
+
+    // Path length statistics, one global atomic per work group
+    if(gl_LocalInvocationIndex == 0)
+    {
+        atomicAdd(statsPathCount, g_GroupPathCount);
+        atomicAdd(statsSegmentCount, g_GroupSegmentCount);
+    }
 }
@@ -0,0 +1,56 @@
+layout (std140) uniform AtmosphereParams
+{
+    vec4 sunDirection;
+    vec4 moonDirection;
+    vec4 moonQuaternion;
+    float sunToMoonRatio;
+    float groundHeightKM;
+};
+
+layout (std430) buffer SkyCapture
+{
+    float skyCapture[];
+};
+
+#define PI 3.14159265359
+
+vec3 GetSkyLuminance(
+        vec3 camera,
+        vec3 view_ray,
+        float shadow_length,
+        vec3 sun_direction,
+        out vec3 transmittance);
+
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+void main()
+{
+    uvec2 size = gl_NumWorkGroups.xy * uvec2(8, 8);
+    uvec2 cell = gl_GlobalInvocationID.xy;
+
+    // Inverse of findUV() at the cell center
+    vec2 uv = (vec2(cell) + 0.5) / vec2(size);
+    float theta = (uv.x - 0.5) * 2 * PI;
+    float phi = (uv.y - 0.5) * PI;
+    vec3 viewDir = vec3(cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi));
+
+    vec3 cameraKM = vec3(0, 0, groundHeightKM);
+    vec3 transmittance;
+
+    vec3 skyLuminance = GetSkyLuminance(
+        cameraKM,
+        viewDir,
+        0,                // shadow_length
+        sunDirection.xyz,
+        transmittance);
+
+    skyLuminance += sunToMoonRatio * GetSkyLuminance(
+        cameraKM,
+        viewDir,
+        0,                // shadow_length
+        moonDirection.xyz,
+        transmittance);
+
+    skyCapture[cell.y * size.x + cell.x] = dot(skyLuminance, vec3(0.2126, 0.7152, 0.0722));
+}
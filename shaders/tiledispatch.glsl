@@ -0,0 +1,36 @@
+layout (std140) uniform TileDispatchParams
+{
+    uint chunkTileCount;
+    uint chunkCount;
+};
+
+layout (std430) buffer PathTracerTiles
+{
+    uvec4 activeTileCount;
+    uint activeTiles[];
+};
+
+// Indirect dispatch arguments of each chunk of active tiles
+layout (std430) buffer PathTracerDispatch
+{
+    uint dispatchArgs[];
+};
+
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+void main()
+{
+    uint chunk = gl_GlobalInvocationID.x;
+
+    if(chunk >= chunkCount)
+        return;
+
+    // Chunks past the last active tile dispatch no work group
+    uint firstTile = chunk * chunkTileCount;
+    uint tileCount = activeTileCount.x > firstTile ? min(chunkTileCount, activeTileCount.x - firstTile) : 0;
+
+    dispatchArgs[chunk * 3 + 0] = tileCount;
+    dispatchArgs[chunk * 3 + 1] = 1;
+    dispatchArgs[chunk * 3 + 2] = 1;
+}
@@ -324,6 +324,21 @@ float Profiler::getGpuSyncNs() const
     return getGpuPointNs(PID_GPU(SwapBuffers));
 }
 
+void Profiler::reportCriticalPath(const std::string& phase, const std::string& path, uint64_t elapsedNs)
+{
+    for(CriticalPath& criticalPath : _criticalPaths)
+    {
+        if(criticalPath.phase == phase)
+        {
+            criticalPath.path = path;
+            criticalPath.elapsedNs = elapsedNs;
+            return;
+        }
+    }
+
+    _criticalPaths.push_back({phase, path, elapsedNs});
+}
+
 const float BOX_HEIGHT = 20;
 const float BOX_SPACING = 4;
 
@@ -370,6 +385,9 @@ void Profiler::ui()
             ImGui::TreePop();
         }
 
+        for(const CriticalPath& criticalPath : _criticalPaths)
+            ImGui::Text("   %s critical path %.3gms: %s", criticalPath.phase.c_str(), criticalPath.elapsedNs / 1e6f, criticalPath.path.c_str());
+
         ImGui::TreePop();
     }
 
@@ -60,6 +60,9 @@ public:
     float getCpuSyncNs() const;
     float getGpuSyncNs() const;
 
+    // Longest chain of dependent jobs of a parallel phase, profile points cannot be nested on workers
+    void reportCriticalPath(const std::string& phase, const std::string& path, uint64_t elapsedNs);
+
     void ui();
 
 private:
@@ -83,6 +86,15 @@ private:
     std::vector<ProfileNode> _activeGpuTree;
     std::vector<ProfileNode> _completedGpuTree;
     std::vector<ResolvedPoint> _renderedGpuTree;
+
+    struct CriticalPath
+    {
+        std::string phase;
+        std::string path;
+        uint64_t elapsedNs;
+    };
+
+    std::vector<CriticalPath> _criticalPaths;
 };
 
 
@@ -6,11 +6,194 @@
 # include <iostream>
 # include <ctime>
 
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define RANDOM_SSE2
+#endif
+
 using namespace std;
 
 namespace unisim
 {
 
+namespace
+{
+
+struct SobolDirections
+{
+    SobolDirections()
+    {
+        // Joe and Kuo's primitive polynomials and initial direction numbers, dimension 0 is van der Corput
+        const unsigned int degrees[4] = {0, 1, 2, 3};
+        const unsigned int coefficients[4] = {0, 0, 1, 1};
+        const unsigned int initials[4][3] = {{}, {1}, {1, 3}, {1, 3, 1}};
+
+        for(unsigned int d = 0; d < 4; ++d)
+        {
+            uint32_t v[SOBOL_DIRECTION_COUNT];
+            unsigned int s = degrees[d];
+
+            for(unsigned int i = 0; i < SOBOL_DIRECTION_COUNT; ++i)
+            {
+                if(d == 0)
+                    v[i] = 1u << (31 - i);
+                else if(i < s)
+                    v[i] = initials[d][i] << (31 - i);
+                else
+                {
+                    v[i] = v[i - s] ^ (v[i - s] >> s);
+                    for(unsigned int k = 1; k < s; ++k)
+                        v[i] ^= ((coefficients[d] >> (s - 1 - k)) & 1) * v[i - k];
+                }
+
+                directions[i][d] = v[i];
+            }
+        }
+    }
+
+    glm::uvec4 directions[SOBOL_DIRECTION_COUNT];
+};
+
+const SobolDirections g_sobolDirections;
+
+uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+#ifdef RANDOM_SSE2
+// SSE2 has no 32 bit low multiply
+__m128i mullo(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__m128i reverseBits(__m128i x)
+{
+    const __m128i m1 = _mm_set1_epi32(0x55555555);
+    const __m128i m2 = _mm_set1_epi32(0x33333333);
+    const __m128i m4 = _mm_set1_epi32(0x0f0f0f0f);
+    const __m128i m8 = _mm_set1_epi32(0x00ff00ff);
+
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 1), m1), _mm_slli_epi32(_mm_and_si128(x, m1), 1));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 2), m2), _mm_slli_epi32(_mm_and_si128(x, m2), 2));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 4), m4), _mm_slli_epi32(_mm_and_si128(x, m4), 4));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), m8), _mm_slli_epi32(_mm_and_si128(x, m8), 8));
+    return _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16));
+}
+
+// Laine-Karras style hash of reversed bits, Burley's practical hash-based Owen scrambling
+__m128i nestedUniformScramble(__m128i x, __m128i seed)
+{
+    x = reverseBits(x);
+    x = _mm_add_epi32(x, seed);
+    x = _mm_xor_si128(x, mullo(x, _mm_set1_epi32(0x6c50b47c)));
+    x = _mm_xor_si128(x, mullo(x, _mm_set1_epi32(0xb82f1e52)));
+    x = _mm_xor_si128(x, mullo(x, _mm_set1_epi32(0xc7afe638)));
+    x = _mm_xor_si128(x, mullo(x, _mm_set1_epi32(0x8d22f6e6)));
+    return reverseBits(x);
+}
+#endif
+
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+}
+
+
+const glm::uvec4* sobolDirections()
+{
+    return g_sobolDirections.directions;
+}
+
+glm::vec4 sobolOwen(uint32_t index, uint32_t seed)
+{
+    glm::vec4 sample;
+    sobolOwen(index, 1, seed, &sample);
+    return sample;
+}
+
+void sobolOwen(uint32_t firstIndex, uint32_t count, uint32_t seed, glm::vec4* samples)
+{
+#ifdef RANDOM_SSE2
+    // Dimensions are processed in parallel, each with its own scrambling seed
+    __m128i dimensionSeeds = _mm_setr_epi32(
+        hashUint(seed ^ 0x3c6ef372u),
+        hashUint(seed ^ 0xa54ff53au),
+        hashUint(seed ^ 0x510e527fu),
+        hashUint(seed ^ 0x9b05688cu));
+
+    const __m128i* directions = reinterpret_cast<const __m128i*>(g_sobolDirections.directions);
+    const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+
+    for(uint32_t s = 0; s < count; ++s)
+    {
+        // Shuffling the index keeps the points stratified in any power of two range
+        uint32_t index = nestedUniformScramble(firstIndex + s, seed);
+
+        __m128i x = _mm_setzero_si128();
+        for(unsigned int bit = 0; index != 0; ++bit, index >>= 1)
+        {
+            if(index & 1)
+                x = _mm_xor_si128(x, _mm_loadu_si128(&directions[bit]));
+        }
+
+        x = nestedUniformScramble(x, dimensionSeeds);
+
+        // 24 bits fit a float's mantissa, keeping samples below 1
+        __m128 sample = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), scale);
+        _mm_storeu_ps(&samples[s].x, sample);
+    }
+#else
+    const uint32_t dimensionSeeds[4] = {
+        hashUint(seed ^ 0x3c6ef372u),
+        hashUint(seed ^ 0xa54ff53au),
+        hashUint(seed ^ 0x510e527fu),
+        hashUint(seed ^ 0x9b05688cu)};
+
+    for(uint32_t s = 0; s < count; ++s)
+    {
+        uint32_t index = nestedUniformScramble(firstIndex + s, seed);
+
+        glm::uvec4 x(0u);
+        for(unsigned int bit = 0; index != 0; ++bit, index >>= 1)
+        {
+            if(index & 1)
+                x ^= g_sobolDirections.directions[bit];
+        }
+
+        for(int d = 0; d < 4; ++d)
+            samples[s][d] = float(nestedUniformScramble(x[d], dimensionSeeds[d]) >> 8) * (1.0f / 16777216.0f);
+    }
+#endif
+}
+
+uint32_t hashUint(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
 //****************************************************************************80
 
 double *halton ( int i, int m )
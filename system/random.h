@@ -1,12 +1,27 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
+#include <cstdint>
+
 #include <GLM/glm.hpp>
 
 
 namespace unisim
 {
 
+// Owen-scrambled Sobol points, must match shaders/common/utils.glsl
+const unsigned int SOBOL_DIRECTION_COUNT = 32;
+
+// Direction numbers of the first four dimensions, one dimension per component
+const glm::uvec4* sobolDirections();
+
+// 'seed' decorrelates the sequences of pixels and bounces
+glm::vec4 sobolOwen(uint32_t index, uint32_t seed);
+void sobolOwen(uint32_t firstIndex, uint32_t count, uint32_t seed, glm::vec4* samples);
+
+uint32_t hashUint(uint32_t x);
+
+
 double *halton ( int i, int m );
 double *halton_base ( int i, int m, int b[] );
 int halton_inverse ( double r[], int m );
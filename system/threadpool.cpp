@@ -0,0 +1,148 @@
+#include "threadpool.h"
+
+#include <GLM/glm.hpp>
+
+
+namespace unisim
+{
+
+namespace
+{
+
+// Lets jobs submitted from a worker land in its own queue
+thread_local const ThreadPool* t_pool = nullptr;
+thread_local unsigned int t_queueIndex = 0;
+
+}
+
+
+ThreadPool::ThreadPool(unsigned int threadCount) :
+    _queuedJobCount(0),
+    _pendingJobCount(0),
+    _stopping(false)
+{
+    if(threadCount == 0)
+        threadCount = glm::max(2u, std::thread::hardware_concurrency()) - 1;
+
+    for(unsigned int i = 0; i < threadCount + 1; ++i)
+        _queues.emplace_back(new Queue());
+
+    for(unsigned int i = 0; i < threadCount; ++i)
+        _workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+
+    for(std::thread& worker : _workers)
+        worker.join();
+}
+
+void ThreadPool::submit(Job&& job)
+{
+    unsigned int queueIndex = t_pool == this ? t_queueIndex : _queues.size() - 1;
+
+    ++_pendingJobCount;
+    ++_queuedJobCount;
+
+    {
+        Queue& queue = *_queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+    }
+    _workAvailable.notify_one();
+    _workDone.notify_all();
+}
+
+void ThreadPool::wait()
+{
+    unsigned int queueIndex = t_pool == this ? t_queueIndex : _queues.size() - 1;
+
+    while(_pendingJobCount > 0)
+    {
+        Job job;
+        if(findJob(queueIndex, job))
+        {
+            execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _workDone.wait(lock, [&]{ return _pendingJobCount == 0 || _queuedJobCount > 0; });
+    }
+}
+
+bool ThreadPool::findJob(unsigned int queueIndex, Job& job)
+{
+    for(unsigned int i = 0; i < _queues.size(); ++i)
+    {
+        Queue& queue = *_queues[(queueIndex + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if(queue.jobs.empty())
+            continue;
+
+        // Own jobs are the most recent ones, still hot in cache
+        if(i == 0)
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+
+        --_queuedJobCount;
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::execute(Job& job)
+{
+    job();
+
+    if(--_pendingJobCount == 0)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+    }
+    _workDone.notify_all();
+}
+
+void ThreadPool::workerLoop(unsigned int queueIndex)
+{
+    t_pool = this;
+    t_queueIndex = queueIndex;
+
+    while(true)
+    {
+        Job job;
+        if(findJob(queueIndex, job))
+        {
+            execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _workAvailable.wait(lock, [&]{ return _stopping || _queuedJobCount > 0; });
+
+        if(_stopping && _queuedJobCount == 0)
+            return;
+    }
+}
+
+}
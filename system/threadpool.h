@@ -0,0 +1,60 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace unisim
+{
+
+// Work-stealing pool, each worker pops its own jobs last in first out and steals the oldest jobs of the others
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Job;
+
+    // Uses every hardware thread but the caller's when 'threadCount' is 0
+    ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    unsigned int threadCount() const { return _workers.size(); }
+
+    // Jobs submitted from a worker are queued on that worker
+    void submit(Job&& job);
+
+    // Runs pending jobs on the calling thread until every submitted job completed
+    void wait();
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    bool findJob(unsigned int queueIndex, Job& job);
+    void execute(Job& job);
+    void workerLoop(unsigned int queueIndex);
+
+    // One queue per worker, the last one receives the jobs of other threads
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _workDone;
+    std::atomic<unsigned int> _queuedJobCount;
+    std::atomic<unsigned int> _pendingJobCount;
+    bool _stopping;
+};
+
+}
+
+#endif // THREADPOOL_H
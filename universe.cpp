@@ -1,5 +1,6 @@
 #include "universe.h"
 
+#include <cstdio>
 #include <iostream>
 
 #include <GLFW/glfw3.h>
@@ -16,6 +17,9 @@
 
 #include "engine/scene.h"
 #include "engine/project.h"
+#include "engine/grading/imagewriter.h"
+#include "engine/pathtracer/accumulation.h"
+#include "engine/pathtracer/pathtracertask.h"
 
 #include "projects/solar/solarsystemproject.h"
 #include "projects/pathtracer/pathtracerproject.h"
@@ -33,13 +37,34 @@ DefineProfilePoint(SwapBuffers);
 
 DefineProfilePointGpu(SwapBuffers);
 
+// Wakes the idle loop to pick up streamed assets
+const double IDLE_WAIT_SECONDS = 0.1;
+
 DeclareProfilePoint(Frame);
 DeclareProfilePointGpu(Frame);
 DeclareProfilePointGpu(PathTracer);
 
 
-Universe::Universe() :
+namespace
+{
+
+std::string frameFileName(const std::string& pattern, unsigned int frame)
+{
+    if(pattern.find('%') == std::string::npos)
+        return pattern;
+
+    std::vector<char> fileName(pattern.size() + 32);
+    std::snprintf(fileName.data(), fileName.size(), pattern.c_str(), frame);
+
+    return fileName.data();
+}
+
+}
+
+
+Universe::Universe(const std::string& projectName) :
     _timeFactor(0.0),
+    _projectName(projectName),
     _showUi(false)
 {
 }
@@ -64,7 +89,12 @@ int Universe::launch()
 
         {
             Profile(PollEvents);
-            _mainWindow->pollEvents();
+
+            // A converged image stays on screen, only events and asset loads wake the loop up
+            if(_graphic.isIdle())
+                _mainWindow->waitEvents(IDLE_WAIT_SECONDS);
+            else
+                _mainWindow->pollEvents();
         }
 
         // Start ImGui frame
@@ -77,6 +107,7 @@ int Universe::launch()
         ui();
         draw();
 
+        if(_graphic.hasRedrawn())
         {
             Profile(SwapBuffers);
             ProfileGpu(SwapBuffers);
@@ -85,14 +116,127 @@ int Universe::launch()
     }
 
     _mainWindow->unregisterEventListener(this);
+    _graphic.release();
     _mainWindow->close();
 
     return 0;
 }
 
-void Universe::onWindowResize(const Window& window, int width, int height)
+int Universe::render(const OfflineRenderSettings& settings)
 {
+    _mainWindow.reset(new Window(settings.width, settings.height, true));
+
+    if (!_mainWindow->isValid())
+    {
+        PILS_ERROR("Could not create offscreen context. Exiting.");
+        return -1;
+    }
+
+    // Shaders are compiled with these settings during setup
+    // Moving bodies restart the whole image between sequence frames
+    GraphicSettings& graphicSettings = _graphic.settings();
+    graphicSettings.reprojection = false;
+    graphicSettings.regionalRestart = false;
+    graphicSettings.pathTracerBudgetMs = 100.0f;
+    graphicSettings.denoiser = settings.denoise ? DenoiserType::Gpu : DenoiserType::None;
+    graphicSettings.sampleOffset = settings.workerIndex * settings.sampleCount;
+
+    if(!setup())
+        return -1;
+
+    Camera& camera = _project->cameraMan().camera();
+    if(!settings.cameraFile.empty() && !camera.load(settings.cameraFile))
+        return -1;
+
+    unsigned int sampleCount = glm::min(settings.sampleCount, PathTracerTask::MAX_FRAME_COUNT);
+    bool partial = settings.outputFile.find(".acc") != std::string::npos;
+
+    // Frames are graded and encoded while the next one is traced,
+    // the BVH, textures and programs are only rebuilt when the scene requires it
+    ImageWriter writer;
+
+    for(unsigned int frame = 0; frame < settings.frameCount; ++frame)
+    {
+        if(frame > 0)
+        {
+            if(std::shared_ptr<Sky> sky = _project->scene().sky())
+            {
+                SkyLocalization& localization = sky->localization();
+                localization.setTimeOfDay(glm::mod(
+                    localization.timeOfDay() + settings.timeOfDayStep,
+                    SkyLocalization::MAX_TIME_OF_DAY));
+            }
+
+            _engine.execute(
+                settings.simulationStep,
+                _project->scene(),
+                camera,
+                _graphic.resources());
+        }
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        accumulate(camera, sampleCount);
+
+        std::chrono::duration<double> renderTime = std::chrono::high_resolution_clock::now() - startTime;
+        std::cout << "Rendered frame " << frame << " with " << _graphic.pathTracerSampleCount() << " samples in "
+                  << renderTime.count() << "s" << (_graphic.isPathTracerConverged() ? " (converged)" : "") << std::endl;
+
+        Accumulation accumulation;
+        _graphic.readResult(
+            _project->cameraMan().view(),
+            _project->scene(),
+            camera,
+            partial,
+            accumulation);
+
+        writer.write(std::move(accumulation), frameFileName(settings.outputFile, frame));
+    }
+
+    bool ok = writer.finish();
 
+    _graphic.release();
+    _mainWindow->close();
+
+    return ok ? 0 : -1;
+}
+
+void Universe::accumulate(Camera& camera, unsigned int sampleCount)
+{
+    unsigned int reportedSampleCount = 0;
+
+    // Scene changes only restart the path tracer on the next draw, the previous frame's count is stale until then
+    // The camera man is not updated, it would override the loaded camera
+    do
+    {
+        Profiler::GetInstance().swapFrames();
+
+        _mainWindow->pollEvents();
+        _mainWindow->ImGuiNewFrame();
+
+        _engine.execute(
+            0.0,
+            _project->scene(),
+            camera,
+            _graphic.resources());
+
+        draw();
+
+        _mainWindow->present();
+
+        unsigned int currentSampleCount = _graphic.pathTracerSampleCount();
+        if(currentSampleCount >= reportedSampleCount + 64)
+        {
+            reportedSampleCount = currentSampleCount;
+            std::cout << "Rendered " << currentSampleCount << "/" << sampleCount << " samples" << std::endl;
+        }
+    }
+    while (_graphic.pathTracerSampleCount() < sampleCount && !_graphic.isPathTracerConverged());
+}
+
+void Universe::onWindowResize(const Window& window, int width, int height)
+{
+    _graphic.requestRedraw();
 }
 
 void Universe::onWindowKeyboard(const Window& window, const KeyboardEvent& event)
@@ -103,6 +247,7 @@ void Universe::onWindowKeyboard(const Window& window, const KeyboardEvent& event
         if(event.key == GLFW_KEY_F10)
         {
             _showUi = !_showUi;
+            _graphic.requestRedraw();
         }
     }
 
@@ -161,8 +306,15 @@ bool Universe::setup()
 
     _mainView.reset(new View(*_mainWindow));
 
-    //_project.reset(new SolarSystemProject());
-    _project.reset(new PathTracerProject());
+    if(_projectName == "solar")
+        _project.reset(new SolarSystemProject());
+    else if(_projectName == "pathtracer")
+        _project.reset(new PathTracerProject());
+    else
+    {
+        PILS_ERROR("Unknown project '", _projectName, "'");
+        return false;
+    }
 
     _project->addView(_mainView);
 
@@ -221,6 +373,9 @@ void Universe::ui()
     if(!_showUi)
         return;
 
+    // Widgets may change every frame
+    _graphic.requestRedraw();
+
     if(ImGui::Begin(_project->scene().name().c_str(), &_showUi))
     {
         if(ImGui::BeginTabBar("#tabs"))
@@ -252,23 +407,15 @@ void Universe::ui()
                 ImGui::Separator();
 
                 if(ImGui::Button("Reload Shaders"))
-                {
-                    std::cout << "\n** Reloading shaders ** \n\n";
-
-                    bool ok = _graphic.reloadShaders(
-                        _project->cameraMan().view(),
-                        _project->scene(),
-                        _project->cameraMan().camera());
-
-                    if(!ok)
-                    {
-                        std::cerr << "Failed to reload some shaders\n\n";
-                    }
-                    else
-                    {
-                        std::cout << "\n** Shaders reloaded ** \n" << std::endl;
-                    }
-                }
+                    reloadShaders();
+
+                ImGui::EndTabItem();
+            }
+
+            if(ImGui::BeginTabItem("Graphics"))
+            {
+                if(_graphic.ui())
+                    reloadShaders();
 
                 ImGui::EndTabItem();
             }
@@ -298,4 +445,23 @@ void Universe::ui()
     ImGui::End();
 }
 
+void Universe::reloadShaders()
+{
+    std::cout << "\n** Reloading shaders ** \n\n";
+
+    bool ok = _graphic.reloadShaders(
+        _project->cameraMan().view(),
+        _project->scene(),
+        _project->cameraMan().camera());
+
+    if(!ok)
+    {
+        std::cerr << "Failed to reload some shaders\n\n";
+    }
+    else
+    {
+        std::cout << "\n** Shaders reloaded ** \n" << std::endl;
+    }
+}
+
 }
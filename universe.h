@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include <memory>
+#include <string>
 
 #include "system/input.h"
 
@@ -21,11 +22,34 @@ class Window;
 class Project;
 
 
+// Headless render parameters, see main.cpp for the command line
+struct OfflineRenderSettings
+{
+    std::string cameraFile;
+    unsigned int sampleCount;
+    std::string outputFile;
+    int width;
+    int height;
+    bool denoise;
+
+    // Distributed render workers trace disjoint sample ranges
+    unsigned int workerIndex;
+
+    // Sequences advance the simulation and the sky between frames,
+    // output file names are printf patterns of the frame index
+    unsigned int frameCount;
+    double simulationStep;
+    float timeOfDayStep;
+};
+
+
 class Universe : public WindowEventListener
 {
 public:
-    Universe();
+    // Project is either 'pathtracer' or 'solar'
+    Universe(const std::string& projectName = "pathtracer");
     int launch();
+    int render(const OfflineRenderSettings& settings);
 
     void onWindowResize(const Window& window, int width, int height) override;
     void onWindowKeyboard(const Window& window, const KeyboardEvent& event) override;
@@ -38,6 +62,11 @@ public:
     void draw();
     void ui();
 
+    // Renders offscreen until the image has 'sampleCount' samples or converges
+    void accumulate(Camera& camera, unsigned int sampleCount);
+
+    void reloadShaders();
+
 public:
     std::shared_ptr<Window> _mainWindow;
     std::shared_ptr<View> _mainView;
@@ -55,6 +84,7 @@ public:
     std::chrono::time_point<std::chrono::high_resolution_clock> _lastTime;
 
     // Projet
+    std::string _projectName;
     std::unique_ptr<Project> _project;
 
     // UI